@@ -35,8 +35,10 @@ find_file(HAVE_STDIO_H stdio.h)
 find_file(HAVE_STRINGS_H strings.h)
 find_file(HAVE_SYS_SELECT_H sys/select.h)
 find_file(HAVE_SYS_STDTYPES_H sys/stdtypes.h)
+find_file(HAVE_SYS_EVENTFD_H sys/eventfd.h)
 find_file(HAVE_X11_XREGION_H X11/Xregion.h)
 find_path(HAVE_XDBE_H Xdbe.h PATH_SUFFIXES X11/extensions extensions)
+find_path(HAVE_XSHM_H XShm.h PATH_SUFFIXES X11/extensions extensions)
 
 if (MSVC)
   message(STATUS "Note: The following three headers should all be found!")
@@ -72,7 +74,7 @@ mark_as_advanced(HAVE_LIBPNG_PNG_H HAVE_LOCALE_H HAVE_NDIR_H)
 mark_as_advanced(HAVE_OPENGL_GLU_H HAVE_PNG_H HAVE_PTHREAD_H)
 mark_as_advanced(HAVE_STDIO_H HAVE_STRINGS_H HAVE_SYS_DIR_H)
 mark_as_advanced(HAVE_SYS_NDIR_H HAVE_SYS_SELECT_H)
-mark_as_advanced(HAVE_SYS_STDTYPES_H HAVE_XDBE_H)
+mark_as_advanced(HAVE_SYS_STDTYPES_H HAVE_SYS_EVENTFD_H HAVE_XDBE_H HAVE_XSHM_H)
 mark_as_advanced(HAVE_X11_XREGION_H)
 
 # where to find freetype headers
@@ -119,6 +121,14 @@ set(CMAKE_REQUIRED_LIBRARIES ${CMAKE_DL_LIBS})
 CHECK_FUNCTION_EXISTS(dlsym			HAVE_DLSYM)
 set(CMAKE_REQUIRED_LIBRARIES)
 
+# clock_gettime() is in librt with glibc before 2.17
+CHECK_FUNCTION_EXISTS(clock_gettime		HAVE_CLOCK_GETTIME)
+if(NOT HAVE_CLOCK_GETTIME)
+   set(CMAKE_REQUIRED_LIBRARIES rt)
+   CHECK_FUNCTION_EXISTS(clock_gettime		HAVE_LIBRT)
+   set(CMAKE_REQUIRED_LIBRARIES)
+endif(NOT HAVE_CLOCK_GETTIME)
+
 CHECK_FUNCTION_EXISTS(localeconv		HAVE_LOCALECONV)
 
 if(LIB_png)
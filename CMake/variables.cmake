@@ -35,6 +35,10 @@ if(HAVE_DLSYM)
    list(APPEND FLTK_LDLIBS -ldl)
 endif(HAVE_DLSYM)
 
+if(HAVE_LIBRT)
+   list(APPEND FLTK_LDLIBS -lrt)
+endif(HAVE_LIBRT)
+
 if(LIB_png)
    list(APPEND IMAGELIBS -lpng)
 endif(LIB_png)
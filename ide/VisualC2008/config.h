@@ -106,6 +106,22 @@
 
 #define USE_XDBE HAVE_XDBE
 
+/*
+ * HAVE_XSHM:
+ *
+ * Do we have the MIT shared memory extension?
+ */
+
+#define HAVE_XSHM 0
+
+/*
+ * USE_XSHM:
+ *
+ * Actually try to use the shared memory extension?
+ */
+
+#define USE_XSHM HAVE_XSHM
+
 /*
  * HAVE_XFIXES:
  *
@@ -262,6 +278,24 @@
 
 #define USE_POLL 0
 
+/*
+ * USE_EPOLL:
+ *
+ * Use the epoll() calls provided on Linux to watch file descriptors,
+ * falling back to poll() or select() if epoll is not available at runtime.
+ */
+
+#define USE_EPOLL 0
+
+/*
+ * USE_EVENT_TRACE:
+ *
+ * Record the time spent in the parts of the event loop, see
+ * Fl::trace_start().
+ */
+
+#define USE_EVENT_TRACE 0
+
 /*
  * Do we have various image libraries?
  */
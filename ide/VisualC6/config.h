@@ -9,6 +9,8 @@
 #define USE_COLORMAP 1
 #define HAVE_XDBE 0
 #define USE_XDBE HAVE_XDBE
+#define HAVE_XSHM 0
+#define USE_XSHM HAVE_XSHM
 #define HAVE_OVERLAY 0
 #define HAVE_GL_OVERLAY 1
 #define WORDS_BIGENDIAN 0
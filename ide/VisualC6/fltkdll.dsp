@@ -453,6 +453,10 @@ SOURCE=..\..\src\Fl_Paged_Device.cxx
 # End Source File
 # Begin Source File
 
+SOURCE=..\..\src\fl_pixel_convert.cxx
+# End Source File
+# Begin Source File
+
 SOURCE=..\..\src\Fl_Pixmap.cxx
 # End Source File
 # Begin Source File
@@ -465,6 +469,10 @@ SOURCE=..\..\src\Fl_Positioner.cxx
 # End Source File
 # Begin Source File
 
+SOURCE=..\..\src\Fl_post_task.cxx
+# End Source File
+# Begin Source File
+
 SOURCE=..\..\src\Fl_PostScript.cxx
 # End Source File
 # Begin Source File
@@ -585,6 +593,34 @@ SOURCE=..\..\src\Fl_Text_Editor.cxx
 # End Source File
 # Begin Source File
 
+SOURCE=..\..\src\Fl_Text_Highlighter.cxx
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\src\Fl_Text_Line_Index.cxx
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\src\Fl_Text_Piece_Table.cxx
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\src\fl_text_scan.cxx
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\src\Fl_Text_Search.cxx
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\src\Fl_Text_Undo.cxx
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\src\Fl_Text_Wrap_Cache.cxx
+# End Source File
+# Begin Source File
+
 SOURCE=..\..\src\Fl_Tile.cxx
 # End Source File
 # Begin Source File
@@ -597,6 +633,10 @@ SOURCE=..\..\src\Fl_Tooltip.cxx
 # End Source File
 # Begin Source File
 
+SOURCE=..\..\src\Fl_Trace.cxx
+# End Source File
+# Begin Source File
+
 SOURCE=..\..\src\Fl_Tree.cxx
 # End Source File
 # Begin Source File
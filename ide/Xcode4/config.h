@@ -16,6 +16,8 @@
 #define USE_XFT 0
 #define HAVE_XDBE 0
 #define USE_XDBE HAVE_XDBE
+#define HAVE_XSHM 0
+#define USE_XSHM HAVE_XSHM
 #define __APPLE_QUARTZ__ 1
 #define HAVE_OVERLAY 0
 #define HAVE_GL_OVERLAY HAVE_OVERLAY
@@ -38,6 +40,8 @@
 #define HAVE_LOCALECONV 1
 #define HAVE_SYS_SELECT_H 1
 #define USE_POLL 0
+#define USE_EPOLL 0
+#define USE_EVENT_TRACE 0
 #define HAVE_LIBPNG 1
 #define HAVE_LIBZ 1
 #define HAVE_LIBJPEG 1
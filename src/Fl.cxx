@@ -53,6 +53,7 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include "flstring.h"
+#include "Fl_Trace.H"
 
 #if defined(DEBUG) || defined(DEBUG_WATCH)
 #  include <stdio.h>
@@ -252,6 +253,96 @@ int Fl::event_inside(const Fl_Widget *o) /*const*/ {
 // timer support
 //
 
+// Timeouts that are due within this many seconds are called together
+// with the one that woke us up, see Fl::timeout_slack().
+static double timeout_slack_;
+static Fl_Timeout_Stats timeout_stats_;
+
+// A timeout that is called later than this after its deadline counts
+// as a missed deadline in Fl_Timeout_Stats.
+#define FL_TIMEOUT_LATE 0.001
+
+/**
+  Sets the timeout coalescing window, in seconds.
+
+  When Fl::wait() wakes up to call a timeout, it also calls all other
+  timeouts that are due within \p slack seconds, instead of waking up
+  again for each of them. This saves a lot of wakeups when many timeouts
+  are set to expire close together, at the cost of calling some of them
+  up to \p slack seconds early. Fl::repeat_timeout() compensates for
+  this, so repeated timeouts keep their period on average.
+
+  The default is 0, which calls every timeout as close to its deadline
+  as possible.
+
+  \note Currently this is only implemented for X11.
+  \see Fl::timeout_stats()
+*/
+void Fl::timeout_slack(double slack) {
+  timeout_slack_ = slack > 0.0 ? slack : 0.0;
+}
+
+/**
+  Returns the timeout coalescing window, in seconds.
+  \see Fl::timeout_slack(double)
+*/
+double Fl::timeout_slack() {
+  return timeout_slack_;
+}
+
+/**
+  Copies the timeout statistics into \p stats.
+
+  The statistics count the wakeups of Fl::wait() that called timeouts,
+  the number of timeout callbacks, and how many of them missed their
+  deadline by more than a millisecond. Fl_Timeout_Stats::missed_timeout_by
+  tells how late (negative) or early (positive, see Fl::timeout_slack())
+  the most recent timeout callback was called, in seconds.
+
+  \note Currently this is only implemented for X11, the statistics
+	remain 0 on other platforms.
+  \see Fl::reset_timeout_stats()
+*/
+void Fl::timeout_stats(Fl_Timeout_Stats *stats) {
+  *stats = timeout_stats_;
+}
+
+/**
+  Resets all timeout statistics to 0.
+  \see Fl::timeout_stats()
+*/
+void Fl::reset_timeout_stats() {
+  memset(&timeout_stats_, 0, sizeof(timeout_stats_));
+}
+
+////////////////////////////////////////////////////////////////
+// The clock of timeouts, frame pacing, lock statistics and event traces.
+// It counts seconds from an arbitrary origin, using the monotonic clock
+// where available, so that setting the system clock does not disturb it.
+
+#ifndef WIN32
+#  include <sys/time.h>
+#  include <time.h>
+#endif
+
+double fl_clock() {
+#ifdef WIN32
+  LARGE_INTEGER freq, count;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&count);
+  return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+#  ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+    return ts.tv_sec + ts.tv_nsec/1e9;
+#  endif // CLOCK_MONOTONIC
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec/1000000.0;
+#endif // WIN32
+}
+
 #ifdef WIN32
 
 // implementation in Fl_win32.cxx
@@ -268,40 +359,118 @@ int Fl::event_inside(const Fl_Widget *o) /*const*/ {
 
 
 ////////////////////////////////////////////////////////////////////////
-// Timeouts are stored in a sorted list (*first_timeout), so only the
-// first one needs to be checked to see if any should be called.
-// Allocated, but unused (free) Timeout structs are stored in another
-// linked list (*free_timeout).
+// Timeouts are stored in a binary heap ordered by their absolute
+// deadline, so the next one to expire is always heap[0]. Timeouts with
+// the same deadline are called in the order they were added. Every
+// timeout also sits in a hash table keyed by its callback and argument,
+// which makes has_timeout() and remove_timeout() fast, and knows its
+// position in the heap, so it can be removed in O(log n).
+// Allocated, but unused (free) Timeout structs are stored in a linked
+// list (*free_timeout).
 
 struct Timeout {
-  double time;
+  double time;          // absolute deadline
+  unsigned seq;         // order of equal deadlines
+  int index;            // position in the heap
   void (*cb)(void*);
   void* arg;
-  Timeout* next;
+  Timeout* next;        // next in hash chain or free list
 };
-static Timeout* first_timeout, *free_timeout;
-
-#include <sys/time.h>
-
-// I avoid the overhead of getting the current time when we have no
-// timeouts by setting this flag instead of getting the time.
-// In this case calling elapse_timeouts() does nothing, but records
-// the current time, and the next call will actually elapse time.
+static Timeout** heap;
+static int heap_size, heap_alloc;
+static unsigned heap_seq;
+static Timeout** hash_table;
+static int hash_mask = -1;      // number of buckets - 1
+static Timeout* free_timeout;
+
+// The time of the last call to elapse_timeouts(), see fl_clock(). I avoid
+// the overhead of getting the current time when we have no timeouts by
+// setting the reset_clock flag instead of getting the time; the next
+// timeout that is added gets the time first.
+static double current_time;
 static char reset_clock = 1;
 
 static void elapse_timeouts() {
-  static struct timeval prevclock;
-  struct timeval newclock;
-  gettimeofday(&newclock, NULL);
-  double elapsed = newclock.tv_sec - prevclock.tv_sec +
-    (newclock.tv_usec - prevclock.tv_usec)/1000000.0;
-  prevclock.tv_sec = newclock.tv_sec;
-  prevclock.tv_usec = newclock.tv_usec;
-  if (reset_clock) {
-    reset_clock = 0;
-  } else if (elapsed > 0) {
-    for (Timeout* t = first_timeout; t; t = t->next) t->time -= elapsed;
+  current_time = fl_clock();
+  reset_clock = 0;
+}
+
+static inline int timeout_before(const Timeout* a, const Timeout* b) {
+  return a->time < b->time || (a->time == b->time && (int)(a->seq - b->seq) < 0);
+}
+
+static void heap_set(int i, Timeout* t) {
+  heap[i] = t;
+  t->index = i;
+}
+
+static void heap_up(int i) {
+  Timeout* t = heap[i];
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (!timeout_before(t, heap[parent])) break;
+    heap_set(i, heap[parent]);
+    i = parent;
+  }
+  heap_set(i, t);
+}
+
+static void heap_down(int i) {
+  Timeout* t = heap[i];
+  for (;;) {
+    int child = 2 * i + 1;
+    if (child >= heap_size) break;
+    if (child + 1 < heap_size && timeout_before(heap[child + 1], heap[child]))
+      child++;
+    if (!timeout_before(heap[child], t)) break;
+    heap_set(i, heap[child]);
+    i = child;
+  }
+  heap_set(i, t);
+}
+
+static inline unsigned timeout_hash(void (*cb)(void*), void* arg) {
+  unsigned long h = (unsigned long)cb ^ ((unsigned long)arg * 2654435761UL);
+  return (unsigned)(h ^ (h >> 16) ^ (h >> 7));
+}
+
+// Grow the hash table so that it has at least one bucket per timeout.
+static void hash_grow() {
+  int n = (hash_mask + 1) ? 2 * (hash_mask + 1) : 64;
+  Timeout** table = (Timeout**)calloc(n, sizeof(Timeout*));
+  for (int b = 0; b <= hash_mask; b++) {
+    for (Timeout* t = hash_table[b]; t;) {
+      Timeout* next = t->next;
+      Timeout** p = table + (timeout_hash(t->cb, t->arg) & (n - 1));
+      t->next = *p;
+      *p = t;
+      t = next;
+    }
+  }
+  free(hash_table);
+  hash_table = table;
+  hash_mask = n - 1;
+}
+
+// Remove a timeout from the hash table and put it on the free list.
+static void free_timeout_(Timeout* t) {
+  Timeout** p = hash_table + (timeout_hash(t->cb, t->arg) & hash_mask);
+  while (*p != t) p = &((*p)->next);
+  *p = t->next;
+  t->next = free_timeout;
+  free_timeout = t;
+}
+
+// Remove a timeout from the heap and the hash table and free it.
+static void delete_timeout(Timeout* t) {
+  int i = t->index;
+  Timeout* last = heap[--heap_size];
+  if (last != t) {
+    heap_set(i, last);
+    heap_up(i);
+    heap_down(last->index);
   }
+  free_timeout_(t);
 }
 
 // Continuously-adjusted error value, this is a number <= 0 for how late
@@ -316,6 +485,7 @@ void Fl::add_timeout(double time, Fl_Timeout_Handler cb, void *argp) {
 }
 
 void Fl::repeat_timeout(double time, Fl_Timeout_Handler cb, void *argp) {
+  if (reset_clock) elapse_timeouts();
   time += missed_timeout_by; if (time < -.05) time = 0;
   Timeout* t = free_timeout;
   if (t) {
@@ -323,12 +493,18 @@ void Fl::repeat_timeout(double time, Fl_Timeout_Handler cb, void *argp) {
   } else {
       t = new Timeout;
   }
-  t->time = time;
+  t->time = current_time + time;
+  t->seq = heap_seq++;
   t->cb = cb;
   t->arg = argp;
-  // insert-sort the new timeout:
-  Timeout** p = &first_timeout;
-  while (*p && (*p)->time <= time) p = &((*p)->next);
+  if (heap_size == heap_alloc) {
+    heap_alloc = heap_alloc ? 2 * heap_alloc : 32;
+    heap = (Timeout**)realloc(heap, heap_alloc * sizeof(Timeout*));
+  }
+  heap_set(heap_size++, t);
+  heap_up(heap_size - 1);
+  if (heap_size > hash_mask) hash_grow();
+  Timeout** p = hash_table + (timeout_hash(cb, argp) & hash_mask);
   t->next = *p;
   *p = t;
 }
@@ -337,7 +513,8 @@ void Fl::repeat_timeout(double time, Fl_Timeout_Handler cb, void *argp) {
   Returns true if the timeout exists and has not been called yet.
 */
 int Fl::has_timeout(Fl_Timeout_Handler cb, void *argp) {
-  for (Timeout* t = first_timeout; t; t = t->next)
+  if (!heap_size) return 0;
+  for (Timeout* t = hash_table[timeout_hash(cb, argp) & hash_mask]; t; t = t->next)
     if (t->cb == cb && t->arg == argp) return 1;
   return 0;
 }
@@ -350,15 +527,24 @@ int Fl::has_timeout(Fl_Timeout_Handler cb, void *argp) {
 	This may change in the future.
 */
 void Fl::remove_timeout(Fl_Timeout_Handler cb, void *argp) {
-  for (Timeout** p = &first_timeout; *p;) {
-    Timeout* t = *p;
-    if (t->cb == cb && (t->arg == argp || !argp)) {
-      *p = t->next;
-      t->next = free_timeout;
-      free_timeout = t;
-    } else {
-      p = &(t->next);
+  if (!heap_size) return;
+  if (!argp) {
+    // any argument matches, so check all timeouts and rebuild the heap
+    int n = 0;
+    for (int i = 0; i < heap_size; i++) {
+      Timeout* t = heap[i];
+      if (t->cb == cb) free_timeout_(t);
+      else heap_set(n++, t);
     }
+    heap_size = n;
+    for (int i = n / 2 - 1; i >= 0; i--) heap_down(i);
+    return;
+  }
+  Timeout** p = hash_table + (timeout_hash(cb, argp) & hash_mask);
+  for (Timeout* t = *p; t;) {
+    Timeout* next = t->next;
+    if (t->cb == cb && t->arg == argp) delete_timeout(t);
+    t = next;
   }
 }
 
@@ -459,9 +645,11 @@ static void run_checks()
   // checks are a bit messy so that add/remove and wait may be called
   // from inside them without causing an infinite loop:
   if (next_check == first_check) {
+    FL_TRACE("checks", 0);
     while (next_check) {
       Check* checkp = next_check;
       next_check = checkp->next;
+      FL_TRACE("check", checkp->cb);
       (checkp->cb)(checkp->arg);
     }
     next_check = first_check;
@@ -562,22 +750,38 @@ double Fl::wait(double time_to_wait) {
 
 #else
 
-  if (first_timeout) {
+  if (heap_size) {
+    FL_TRACE("timeouts", 0);
     elapse_timeouts();
+    double due = current_time + timeout_slack_;
+    if (heap[0]->time <= due) timeout_stats_.wakeups++;
+    // Timeouts that the callbacks add are left for the next call, else a
+    // repeat_timeout() with a period shorter than the slack would run
+    // several times in a row here:
+    unsigned seq_end = heap_seq;
     Timeout *t;
-    while ((t = first_timeout)) {
-      if (t->time > 0) break;
-      // The first timeout in the array has expired.
-      missed_timeout_by = t->time;
-      // We must remove timeout from array before doing the callback:
+    while (heap_size) {
+      t = heap[0];
+      if (t->time > due || (int)(t->seq - seq_end) >= 0) break;
+      // The first timeout in the heap has expired, or will do so within
+      // the coalescing slack. In the latter case missed_timeout_by is
+      // positive, so that repeat_timeout() keeps the period exact.
+      missed_timeout_by = t->time - current_time;
+      timeout_stats_.calls++;
+      if (-missed_timeout_by > timeout_stats_.max_late)
+        timeout_stats_.max_late = -missed_timeout_by;
+      if (-missed_timeout_by > FL_TIMEOUT_LATE) timeout_stats_.missed++;
+      timeout_stats_.missed_timeout_by = missed_timeout_by;
+      // We must remove timeout from heap before doing the callback:
       void (*cb)(void*) = t->cb;
       void *argp = t->arg;
-      first_timeout = t->next;
-      t->next = free_timeout;
-      free_timeout = t;
+      delete_timeout(t);
       // Now it is safe for the callback to do add_timeout:
+      FL_TRACE("timeout", cb);
       cb(argp);
     }
+    // only repeat_timeout() in the callbacks above makes up for the delay
+    missed_timeout_by = 0;
   } else {
     reset_clock = 1; // we are not going to check the clock
   }
@@ -585,6 +789,7 @@ double Fl::wait(double time_to_wait) {
 //  if (idle && !fl_ready()) {
   if (idle) {
     if (!in_idle) {
+      FL_TRACE("idle", 0);
       in_idle = 1;
       idle();
       in_idle = 0;
@@ -592,8 +797,8 @@ double Fl::wait(double time_to_wait) {
     // the idle function may turn off idle, we can then wait:
     if (idle) time_to_wait = 0.0;
   }
-  if (first_timeout && first_timeout->time < time_to_wait)
-    time_to_wait = first_timeout->time;
+  if (heap_size && heap[0]->time - current_time < time_to_wait)
+    time_to_wait = heap[0]->time - current_time;
   if (time_to_wait <= 0.0) {
     // do flush second so that the results of events are visible:
     int ret = fl_wait(0.0);
@@ -694,9 +899,9 @@ int Fl::check() {
 */
 int Fl::ready() {
 #if ! defined( WIN32 )  &&  ! defined(__APPLE__)
-  if (first_timeout) {
+  if (heap_size) {
     elapse_timeouts();
-    if (first_timeout->time <= 0) return 1;
+    if (heap[0]->time <= current_time + timeout_slack_) return 1;
   } else {
     reset_clock = 1;
   }
@@ -767,25 +972,184 @@ void Fl::redraw() {
   for (Fl_X* i = Fl_X::first; i; i = i->next) i->w->redraw();
 }
 
+////////////////////////////////////////////////////////////////
+// Frame pacing:
+// With a frame rate set, flush() redraws at most once per frame interval.
+// Damage that arrives in between stays in the windows, where it is merged
+// as usual, and a timeout wakes up Fl::wait() when the next frame is due.
+// The time every window takes to draw is recorded in a short list,
+// which is searched linearly as there are only a few windows.
+
+static double frame_interval;   // 0 if frame pacing is off
+static double last_frame;       // when the last paced frame was drawn
+
+struct Frame_Record {
+  const Fl_Window *window;
+  Fl_Frame_Stats stats;
+};
+static Frame_Record *frame_records;
+static int frame_records_size, frame_records_alloc;
+
+// Bytes that double buffered windows copied to the screen in their
+// flush() method, see Fl_Double_Window::flush():
+unsigned long fl_frame_bytes;
+
+static Frame_Record *frame_record(const Fl_Window *w, int create) {
+  for (int n = 0; n < frame_records_size; n++)
+    if (frame_records[n].window == w) return frame_records + n;
+  if (!create) return 0;
+  if (frame_records_size == frame_records_alloc) {
+    frame_records_alloc = frame_records_alloc ? 2 * frame_records_alloc : 8;
+    frame_records = (Frame_Record*)realloc(frame_records,
+                                           frame_records_alloc * sizeof(Frame_Record));
+  }
+  Frame_Record *r = frame_records + frame_records_size++;
+  memset(r, 0, sizeof(Frame_Record));
+  r->window = w;
+  return r;
+}
+
+static void remove_frame_record(const Fl_Window *w) {
+  Frame_Record *r = frame_record(w, 0);
+  if (r) *r = frame_records[--frame_records_size];
+}
+
+// Set while frame_timeout() is pending. It is added with an argument, so
+// that remove_timeout() finds it without checking all timeouts.
+static char frame_timeout_pending;
+
+static void frame_timeout(void*) {
+  // Fl::wait() flushes after calling timeouts
+  frame_timeout_pending = 0;
+}
+
+static void remove_frame_timeout() {
+  if (!frame_timeout_pending) return;
+  Fl::remove_timeout(frame_timeout, &frame_interval);
+  frame_timeout_pending = 0;
+}
+
+// Return 1 if the next frame may be drawn now, otherwise make sure that
+// Fl::wait() wakes up when it is due.
+static int frame_due() {
+  if (!frame_interval) return 1;
+  double now = fl_clock();
+  double next = last_frame + frame_interval;
+  if (now < next) {
+    if (!frame_timeout_pending) {
+      Fl::add_timeout(next - now, frame_timeout, &frame_interval);
+      frame_timeout_pending = 1;
+    }
+    return 0;
+  }
+  // keep the frame cadence unless we fell behind by a whole frame:
+  last_frame = now - next < frame_interval ? next : now;
+  remove_frame_timeout();
+  return 1;
+}
+
+/**
+  Sets the maximum rate at which Fl::flush() redraws windows, in frames
+  per second.
+
+  By default, Fl::wait() redraws damaged windows after every batch of
+  events, so a program that updates a widget a thousand times per second
+  also redraws it a thousand times per second. With a frame rate set,
+  Fl::flush() only redraws if the last frame is at least 1/\p fps
+  seconds ago. Damage that occurs in between accumulates and is drawn
+  with the next frame, which is scheduled with a timeout, so nothing
+  is lost.
+
+  A good value is the refresh rate of the screen, typically 60. Set
+  the rate to 0 (the default) to redraw as soon as possible.
+
+  \see Fl::frame_stats()
+*/
+void Fl::frame_rate(double fps) {
+  frame_interval = fps > 0.0 ? 1.0 / fps : 0.0;
+  if (!frame_interval) remove_frame_timeout();
+}
+
+/**
+  Returns the maximum frame rate, or 0 if frame pacing is off.
+  \see Fl::frame_rate(double)
+*/
+double Fl::frame_rate() {
+  return frame_interval ? 1.0 / frame_interval : 0.0;
+}
+
+/**
+  Copies the drawing statistics of a window into \p stats.
+
+  Every time Fl::flush() redraws the window, the time its flush() method
+  takes is recorded. A frame is over budget if it took longer than the
+  frame interval set with Fl::frame_rate(), or 1/60 second if frame
+  pacing is off.
+
+  Double buffered windows also count the bytes they copy from the back
+  buffer to the screen (as 4 bytes per pixel). Fl_Double_Window copies
+  only what it redrew, so this shows how much drawing a frame costs on
+  remote displays.
+
+  The statistics are reset when the window is hidden, and are all 0 for
+  windows that were not drawn yet.
+  \see Fl::reset_frame_stats()
+*/
+void Fl::frame_stats(const Fl_Window *window, Fl_Frame_Stats *stats) {
+  Frame_Record *r = frame_record(window, 0);
+  if (r) *stats = r->stats;
+  else memset(stats, 0, sizeof(Fl_Frame_Stats));
+}
+
+/**
+  Resets the drawing statistics of a window, or of all windows if
+  \p window is NULL.
+  \see Fl::frame_stats()
+*/
+void Fl::reset_frame_stats(const Fl_Window *window) {
+  if (window) remove_frame_record(window);
+  else frame_records_size = 0;
+}
+
 /**
   Causes all the windows that need it to be redrawn and graphics forced
   out through the pipes.
 
   This is what wait() does before looking for events.
 
+  If a frame rate is set with Fl::frame_rate(), windows are only
+  redrawn when the next frame is due.
+
   Note: in multi-threaded applications you should only call Fl::flush()
   from the main thread. If a child thread needs to trigger a redraw event,
   it should instead call Fl::awake() to get the main thread to process the
   event queue.
 */
 void Fl::flush() {
-  if (damage()) {
+  FL_TRACE("flush", 0);
+  if (damage() && frame_due()) {
     damage_ = 0;
+    double budget = frame_interval ? frame_interval : 1.0 / 60.0;
     for (Fl_X* i = Fl_X::first; i; i = i->next) {
       if (i->wait_for_expose) {damage_ = 1; continue;}
       Fl_Window* wi = i->w;
       if (!wi->visible_r()) continue;
-      if (wi->damage()) {i->flush(); wi->clear_damage();}
+      if (wi->damage()) {
+        FL_TRACE("draw", wi);
+        double start = fl_clock();
+        fl_frame_bytes = 0;
+        i->flush();
+        wi->clear_damage();
+        double t = fl_clock() - start;
+        Fl_Frame_Stats &s = frame_record(wi, 1)->stats;
+        s.frames++;
+        if (t > budget) s.over_budget++;
+        s.last = t;
+        s.total += t;
+        if (t > s.max) s.max = t;
+        s.bytes = fl_frame_bytes;
+        s.total_bytes += fl_frame_bytes;
+      }
       // destroy damage regions for windows that don't use them:
       if (i->region) {XDestroyRegion(i->region); i->region = 0;}
     }
@@ -1568,6 +1932,7 @@ void Fl_Window::hide() {
   if (!parent()) cursor(FL_CURSOR_DEFAULT);
 #endif
   i = 0;
+  remove_frame_record(this);
 
   // recursively remove any subwindows:
   for (Fl_X *wi = Fl_X::first; wi;) {
@@ -382,6 +382,69 @@ void fl_end_offscreen() {
 # error unsupported platform
 #endif
 
+extern unsigned long fl_frame_bytes;     // in Fl.cxx
+
+// Copy a rectangle of the back buffer to the window, and count the
+// bytes for Fl::frame_stats():
+static void copy_back_buffer(Fl_X *i, int X, int Y, int W, int H) {
+  if (W <= 0 || H <= 0) return;
+  fl_copy_offscreen(X, Y, W, H, i->other_xid, X, Y);
+  fl_frame_bytes += (unsigned long)W * H * 4;
+}
+
+#if defined(USE_X11) || defined(WIN32)
+
+// If only some children of the window need to be redrawn, flush() draws
+// and copies just their rectangles (clipped to them, so that the window
+// and the back buffer stay the same), instead of all of the window. This
+// matters most on remote displays, and with Xdbe, which would otherwise
+// swap the whole window.
+
+#  define FL_PARTIAL_MAX 16
+
+struct Partial_Rect {
+  int x, y, w, h;
+};
+
+// Collect the rectangles of the damaged children of g, looking into
+// groups of which only children are damaged. A group that has
+// FL_DAMAGE_CHILD without damaged children redraws parts of itself,
+// like Fl_Table::redraw_range() does, so all of it is taken. Returns 0
+// if there are too many rectangles.
+static int damaged_children(Fl_Group *g, Partial_Rect *r, int &n) {
+  Fl_Widget *const *a = g->array();
+  for (int i = g->children(); i--;) {
+    Fl_Widget *o = *a++;
+    if (!o->damage() || !o->visible() || o->type() >= FL_WINDOW) continue;
+    int m = n;
+    if (o->damage() == FL_DAMAGE_CHILD && o->as_group()) {
+      if (!damaged_children(o->as_group(), r, n)) return 0;
+    }
+    if (n == m) {
+      if (n == FL_PARTIAL_MAX) return 0;
+      r[n].x = o->x(); r[n].y = o->y(); r[n].w = o->w(); r[n].h = o->h();
+      n++;
+    }
+  }
+  return 1;
+}
+
+static Fl_Region partial_region(const Partial_Rect *r, int n) {
+  Fl_Region region = XRectangleRegion(r[0].x, r[0].y, r[0].w, r[0].h);
+  for (int i = 1; i < n; i++) {
+    Fl_Region R = XRectangleRegion(r[i].x, r[i].y, r[i].w, r[i].h);
+#  ifdef WIN32
+    CombineRgn(region, region, R, RGN_OR);
+#  else
+    XUnionRegion(R, region, region);
+#  endif
+    XDestroyRegion(R);
+  }
+  return region;
+}
+
+#endif // USE_X11 || WIN32
+
 /**
   Forces the window to be redrawn.
 */
@@ -419,6 +482,20 @@ void Fl_Double_Window::flush(int eraseoverlay) {
 # error unsupported platform
 #endif
   }
+  int n = -1; // number of damaged rectangles, -1 for all of the window
+#if defined(USE_X11) || defined(WIN32)
+  Partial_Rect r[FL_PARTIAL_MAX];
+  if (damage() == FL_DAMAGE_CHILD && !myi->region && !eraseoverlay
+#  if USE_XDBE
+      && !(use_xdbe && myi->backbuffer_bad)
+#  endif
+      ) {
+    n = 0;
+    // without damaged children, the window draws parts of itself:
+    if (!damaged_children(this, r, n) || !n) n = -1;
+    else myi->region = partial_region(r, n);
+  }
+#endif // USE_X11 || WIN32
 #if USE_XDBE
   if (use_xdbe) {
     if (myi->backbuffer_bad || eraseoverlay) {
@@ -436,11 +513,17 @@ void Fl_Double_Window::flush(int eraseoverlay) {
       fl_window = myi->xid;
     }
 
-    // Copy contents of back buffer to window...
+    // Copy the redrawn rectangles of the back buffer to the window, or
+    // all of it by swapping the buffers...
+    if (n > 0) {
+      for (int i = 0; i < n; i++) copy_back_buffer(myi, r[i].x, r[i].y, r[i].w, r[i].h);
+      return;
+    }
     XdbeSwapInfo s;
     s.swap_window = fl_xid(this);
     s.swap_action = XdbeCopied;
     XdbeSwapBuffers(fl_display, &s, 1);
+    fl_frame_bytes += (unsigned long)w() * h() * 4;
     return;
   } else
 #endif
@@ -474,10 +557,17 @@ void Fl_Double_Window::flush(int eraseoverlay) {
 #endif
   }
   if (eraseoverlay) fl_clip_region(0);
+  if (!myi->other_xid) return;
+#if defined(USE_X11) || defined(WIN32)
+  if (n > 0) {
+    for (int i = 0; i < n; i++) copy_back_buffer(myi, r[i].x, r[i].y, r[i].w, r[i].h);
+    return;
+  }
+#endif // USE_X11 || WIN32
   // on Irix (at least) it is faster to reduce the area copied to
   // the current clip region:
   int X,Y,W,H; fl_clip_box(0,0,w(),h(),X,Y,W,H);
-  if (myi->other_xid) fl_copy_offscreen(X, Y, W, H, myi->other_xid, X, Y);
+  copy_back_buffer(myi, X, Y, W, H);
 }
 
 void Fl_Double_Window::resize(int X,int Y,int W,int H) {
@@ -24,6 +24,10 @@
 #include <FL/Fl_Image.H>
 #include <FL/Fl_Printer.H>
 #include "flstring.h"
+#include "fl_pixel_convert.h"
+#if !defined(WIN32) && defined(HAVE_PTHREAD)
+#  include <pthread.h>
+#endif
 
 #ifdef WIN32
 void fl_release_dc(HWND, HDC); // from Fl_win32.cxx
@@ -217,6 +221,7 @@ Fl_Image::measure(const Fl_Label *lo,		// I - Label
 
 /** Sets the RGB image scaling method used for copy(int, int).
     Applies to all RGB images, defaults to FL_RGB_SCALING_NEAREST.
+    \see Fl_RGB_Image::scale_cache_size(size_t)
 */
 void Fl_Image::RGB_scaling(Fl_RGB_Scaling method) {
   RGB_scaling_ = method;
@@ -290,8 +295,349 @@ Fl_RGB_Image::Fl_RGB_Image(const Fl_Pixmap *pxm, Fl_Color bg):
  The destructor frees all memory and server resources that are used by 
  the image. 
  */
+
+//
+// Scaled copies, see Fl_RGB_Image::scale_cache_size()
+//
+
+size_t Fl_RGB_Image::scale_cache_size_ = 16 * 1024 * 1024;
+
+struct Scaled_Copy {
+  Scaled_Copy *prev, *next;	// most recently used first
+  const Fl_RGB_Image *img;
+  const uchar *array;		// the data of img when the copy was made
+  int w, h;			// size of the copy
+  int scaling;			// Fl_RGB_Scaling of the copy
+  uchar *pixels;		// w * h * img->d() bytes
+};
+
+static Scaled_Copy *scaled_first, *scaled_last;
+static size_t scaled_size;	// bytes in all copies
+
+// Images can be copied in any thread, so the copies are protected by a
+// mutex. All scaled_*() functions except scaled_get(), scaled_keep()
+// and scaled_uncache() must be called with it locked.
+#ifdef WIN32
+static CRITICAL_SECTION scaled_mutex;
+static struct Scaled_Mutex_Init {
+  Scaled_Mutex_Init() { InitializeCriticalSection(&scaled_mutex); }
+} scaled_mutex_init;
+static void scaled_lock() { EnterCriticalSection(&scaled_mutex); }
+static void scaled_unlock() { LeaveCriticalSection(&scaled_mutex); }
+#elif defined(HAVE_PTHREAD)
+static pthread_mutex_t scaled_mutex = PTHREAD_MUTEX_INITIALIZER;
+static void scaled_lock() { pthread_mutex_lock(&scaled_mutex); }
+static void scaled_unlock() { pthread_mutex_unlock(&scaled_mutex); }
+#else
+static void scaled_lock() {}
+static void scaled_unlock() {}
+#endif // WIN32
+
+static void scaled_unlink(Scaled_Copy *c) {
+  if (c->prev) c->prev->next = c->next;
+  else scaled_first = c->next;
+  if (c->next) c->next->prev = c->prev;
+  else scaled_last = c->prev;
+}
+
+static void scaled_link(Scaled_Copy *c) {
+  c->prev = 0;
+  c->next = scaled_first;
+  if (scaled_first) scaled_first->prev = c;
+  else scaled_last = c;
+  scaled_first = c;
+}
+
+static void scaled_free(Scaled_Copy *c) {
+  scaled_unlink(c);
+  scaled_size -= (size_t)c->w * c->h * c->img->d();
+  delete[] c->pixels;
+  delete c;
+}
+
+// Return the data of the copy of img with the given size and scaling, or NULL:
+static const uchar *scaled_find(const Fl_RGB_Image *img, int w, int h, int scaling) {
+  for (Scaled_Copy *c = scaled_first; c; c = c->next) {
+    if (c->img != img || c->w != w || c->h != h || c->scaling != scaling) continue;
+    if (c->array != img->array) {
+      // the image has new data
+      scaled_free(c);
+      return 0;
+    }
+    scaled_unlink(c);
+    scaled_link(c);
+    return c->pixels;
+  }
+  return 0;
+}
+
+// Keep the data of a copy, which is delete[]'d when the copy is freed:
+static void scaled_add(const Fl_RGB_Image *img, int w, int h, int scaling, uchar *pixels) {
+  Scaled_Copy *c = new Scaled_Copy;
+  c->img = img;
+  c->array = img->array;
+  c->w = w;
+  c->h = h;
+  c->scaling = scaling;
+  c->pixels = pixels;
+  scaled_link(c);
+  scaled_size += (size_t)w * h * img->d();
+}
+
+// Free the least recently used copies that exceed the cache size:
+static void scaled_trim() {
+  while (scaled_last && scaled_size > Fl_RGB_Image::scale_cache_size())
+    scaled_free(scaled_last);
+}
+
+// Copy the data of a copy of img to pixels, return 0 if there is none:
+static int scaled_get(const Fl_RGB_Image *img, int w, int h, int scaling, uchar *pixels) {
+  scaled_lock();
+  const uchar *found = scaled_find(img, w, h, scaling);
+  if (found) memcpy(pixels, found, (size_t)w * h * img->d());
+  scaled_unlock();
+  return found != 0;
+}
+
+// Keep a copy of pixels if it fits, and trim the cache:
+static void scaled_keep(const Fl_RGB_Image *img, int w, int h, int scaling, const uchar *pixels) {
+  size_t n = (size_t)w * h * img->d();
+  uchar *p = 0;
+  if (n <= Fl_RGB_Image::scale_cache_size()) {
+    p = new uchar[n];
+    memcpy(p, pixels, n);
+  }
+  scaled_lock();
+  if (p) scaled_add(img, w, h, scaling, p);
+  scaled_trim();
+  scaled_unlock();
+}
+
+static void scaled_uncache(const Fl_RGB_Image *img) {
+  scaled_lock();
+  Scaled_Copy *next;
+  for (Scaled_Copy *c = scaled_first; c; c = next) {
+    next = c->next;
+    if (c->img == img) scaled_free(c);
+  }
+  scaled_unlock();
+}
+
+void Fl_RGB_Image::scale_cache_size(size_t size) {
+  scaled_lock();
+  scale_cache_size_ = size;
+  scaled_trim();
+  scaled_unlock();
+}
+
+// Rounded t / 255 for 0 <= t <= 255*255:
+static inline uchar div255(unsigned t) {
+  t += 128;
+  return (uchar)((t + (t >> 8)) >> 8);
+}
+
+//
+// Area averaging: each pixel of the copy is the average of the area of the
+// image that it covers. The rows of the image are filtered first, and then
+// the columns of the filtered rows with fl_pixel_vfilter(). The weights of
+// each pixel of the copy add up to 128 in both directions. Colors are
+// averaged premultiplied by alpha, so that transparent pixels don't bleed
+// into the copy.
+//
+
+struct Area_Taps {
+  int *first;		// the first pixel of the image for each pixel of the copy
+  int *count;		// the number of pixels of the image
+  short *weights;	// max weights for each pixel of the copy
+  int max;
+};
+
+static void area_taps(Area_Taps &t, int src, int dst) {
+  t.max = (src + dst - 1) / dst + 1;
+  t.first = new int[dst];
+  t.count = new int[dst];
+  t.weights = new short[dst * t.max];
+  for (int x = 0; x < dst; x++) {
+    // in units of 1/dst pixels of the image, pixel x covers a ... b:
+    long a = (long)x * src, b = a + src;
+    int first = (int)(a / dst), last = (int)((b - 1) / dst);
+    short *w = t.weights + x * t.max;
+    int sum = 0, big = 0;
+    for (int i = first; i <= last; i++) {
+      long lo = (long)i * dst > a ? (long)i * dst : a;
+      long hi = (long)(i + 1) * dst < b ? (long)(i + 1) * dst : b;
+      w[i - first] = (short)(((hi - lo) * 128 + src / 2) / src);
+      sum += w[i - first];
+      if (w[i - first] > w[big]) big = i - first;
+    }
+    w[big] += 128 - sum; // so that they add up to exactly 128
+    t.first[x] = first;
+    t.count[x] = last - first + 1;
+  }
+}
+
+static void area_free(Area_Taps &t) {
+  delete[] t.first;
+  delete[] t.count;
+  delete[] t.weights;
+}
+
+struct Area_Job {
+  const uchar *from;
+  int w, d, ld;
+  uchar *to;
+  int W, H;
+  Area_Taps xt, yt;
+};
+
+#define FL_AREA_BAND 32			// rows of the copy per area_band()
+#define FL_AREA_PARALLEL 0x100000	// bytes of the image worth threads
+
+static void area_band(void *data, int band) {
+  Area_Job *job = (Area_Job *)data;
+  const int d = job->d, alpha = !(d & 1), len = job->W * d;
+  int y0 = band * FL_AREA_BAND, y1 = y0 + FL_AREA_BAND;
+  if (y1 > job->H) y1 = job->H;
+  int sy0 = job->yt.first[y0];
+  int sy1 = job->yt.first[y1 - 1] + job->yt.count[y1 - 1];
+  short *rows = new short[(sy1 - sy0) * len];
+  uchar *premul = alpha ? new uchar[job->w * d] : 0;
+
+  // filter the rows of the image that this band covers...
+  for (int sy = sy0; sy < sy1; sy++) {
+    const uchar *p = job->from + sy * job->ld;
+    if (alpha) {
+      for (int x = 0; x < job->w * d; x += d) {
+        for (int c = 0; c < d - 1; c++) premul[x + c] = div255(p[x + c] * p[x + d - 1]);
+        premul[x + d - 1] = p[x + d - 1];
+      }
+      p = premul;
+    }
+    short *r = rows + (sy - sy0) * len;
+    for (int x = 0; x < job->W; x++) {
+      const uchar *s = p + job->xt.first[x] * d;
+      const short *w = job->xt.weights + x * job->xt.max;
+      int n = job->xt.count[x];
+      for (int c = 0; c < d; c++) {
+        int t = 0;
+        for (int k = 0; k < n; k++) t += w[k] * s[k * d + c];
+        *r++ = (short)t;
+      }
+    }
+  }
+
+  // ...and then the columns:
+  const short **col = new const short *[job->yt.max];
+  for (int y = y0; y < y1; y++) {
+    int n = job->yt.count[y];
+    for (int k = 0; k < n; k++) col[k] = rows + (job->yt.first[y] + k - sy0) * len;
+    uchar *to = job->to + y * len;
+    fl_pixel_vfilter(col, job->yt.weights + y * job->yt.max, n, len, to);
+    if (alpha) {
+      for (int x = 0; x < len; x += d) {
+        unsigned a = to[x + d - 1];
+        if (!a || a == 255) continue;
+        for (int c = 0; c < d - 1; c++) {
+          unsigned v = (to[x + c] * 255 + a / 2) / a;
+          to[x + c] = (uchar)(v > 255 ? 255 : v);
+        }
+      }
+    }
+  }
+
+  delete[] col;
+  delete[] premul;
+  delete[] rows;
+}
+
+// Defined in Fl_post_task.cxx
+extern void fl_parallel_for(int n, void (*func)(void *data, int i), void *data);
+
+static void area_scale(const uchar *from, int w, int h, int d, int ld,
+                       uchar *to, int W, int H) {
+  Area_Job job;
+  job.from = from;
+  job.w = w;
+  job.d = d;
+  job.ld = ld;
+  job.to = to;
+  job.W = W;
+  job.H = H;
+  area_taps(job.xt, w, W);
+  area_taps(job.yt, h, H);
+  int bands = (H + FL_AREA_BAND - 1) / FL_AREA_BAND;
+  if ((long)w * h * d >= FL_AREA_PARALLEL) {
+    fl_parallel_for(bands, area_band, &job);
+  } else {
+    for (int i = 0; i < bands; i++) area_band(&job, i);
+  }
+  area_free(job.xt);
+  area_free(job.yt);
+}
+
+// Shrink a large image in steps of half the size, which are kept, so
+// that the last step, and the copies of other sizes later, start from
+// an image no more than twice as large as the copy. The cache is only
+// locked to look up the smallest step that exists and to keep the new
+// ones, so that other threads can copy images while this one scales:
+static void area_copy(const Fl_RGB_Image *img, uchar *to, int W, int H) {
+  const int d = img->d();
+  int sw[32], sh[32], n = 0;	// sizes of the steps
+  int w = img->w(), h = img->h();
+  while (n < 32) {
+    int hw = w >= 2 * W ? (w + 1) / 2 : w;
+    int hh = h >= 2 * H ? (h + 1) / 2 : h;
+    if ((hw == w && hh == h) || (hw == W && hh == H)) break;
+    sw[n] = w = hw;
+    sh[n] = h = hh;
+    n++;
+  }
+  const uchar *from = img->array;
+  w = img->w();
+  h = img->h();
+  int ld = img->ld() ? img->ld() : w * d;
+  uchar *cached = 0;		// private copy of a cached step
+  int first = 0;		// first step that must be made
+  scaled_lock();
+  for (int i = n - 1; i >= 0; i--) {
+    const uchar *found = scaled_find(img, sw[i], sh[i], FL_RGB_SCALING_AREA);
+    if (!found) continue;
+    size_t size = (size_t)sw[i] * sh[i] * d;
+    cached = new uchar[size];
+    memcpy(cached, found, size);
+    from = cached;
+    w = sw[i];
+    h = sh[i];
+    ld = w * d;
+    first = i + 1;
+    break;
+  }
+  scaled_unlock();
+  uchar *made[32];
+  for (int i = first; i < n; i++) {
+    made[i] = new uchar[(size_t)sw[i] * sh[i] * d];
+    area_scale(from, w, h, d, ld, made[i], sw[i], sh[i]);
+    from = made[i];
+    w = sw[i];
+    h = sh[i];
+    ld = w * d;
+  }
+  area_scale(from, w, h, d, ld, to, W, H);
+  delete[] cached;
+  if (first < n) {
+    scaled_lock();
+    for (int i = first; i < n; i++) {
+      // another thread may have kept the same step meanwhile
+      if (scaled_find(img, sw[i], sh[i], FL_RGB_SCALING_AREA)) delete[] made[i];
+      else scaled_add(img, sw[i], sh[i], FL_RGB_SCALING_AREA, made[i]);
+    }
+    scaled_unlock();
+  }
+}
+
 Fl_RGB_Image::~Fl_RGB_Image() {
 #ifdef __APPLE__
+  scaled_uncache(this);
   if (id_) CGImageRelease((CGImageRef)id_);
   else if (alloc_array) delete[] (uchar *)array;
 #else
@@ -300,7 +646,12 @@ Fl_RGB_Image::~Fl_RGB_Image() {
 #endif
 }
 
+#if !defined(WIN32) && !defined(__APPLE__)
+static void blend_uncache(Fl_RGB_Image *img);
+#endif
+
 void Fl_RGB_Image::uncache() {
+  scaled_uncache(this);
 #ifdef __APPLE__
   if (id_) {
     if (mask_) *(bool*)mask_ = false;
@@ -318,9 +669,24 @@ void Fl_RGB_Image::uncache() {
     fl_delete_bitmask((Fl_Bitmask)mask_);
     mask_ = 0;
   }
+#  ifndef WIN32
+  blend_uncache(this);
+#  endif
 #endif
 }
 
+/**
+  Creates a copy of the image, scaled to \p W x \p H with the method
+  set by Fl_Image::RGB_scaling().
+
+  Copies that are scaled with FL_RGB_SCALING_BILINEAR or
+  FL_RGB_SCALING_AREA are kept for the next copy of the same size, see
+  scale_cache_size(size_t). copy() can be called in any thread.
+
+  FL_RGB_SCALING_AREA shrinks images of 1 MB or more (w() * h() * d())
+  with the threads of the FLTK thread pool, which copy() starts on
+  first use, see Fl::post_task().
+*/
 Fl_Image *Fl_RGB_Image::copy(int W, int H) {
   Fl_RGB_Image	*new_image;	// New RGB image
   uchar		*new_array;	// New array for image data
@@ -367,7 +733,13 @@ Fl_Image *Fl_RGB_Image::copy(int W, int H) {
 
   line_d = ld() ? ld() : w() * d();
 
-  if (Fl_Image::RGB_scaling() == FL_RGB_SCALING_NEAREST) {
+  const int scaling = Fl_Image::RGB_scaling();
+  int cached = scaling != FL_RGB_SCALING_NEAREST &&
+               scaled_get(this, W, H, scaling, new_array);
+
+  if (cached) {
+    // scaled_get() has filled new_array
+  } else if (scaling == FL_RGB_SCALING_NEAREST) {
 
     int		c,		// Channel number
 		sy,		// Source coordinate
@@ -402,6 +774,8 @@ Fl_Image *Fl_RGB_Image::copy(int W, int H) {
         sy ++;
       }
     }
+  } else if (scaling == FL_RGB_SCALING_AREA) {
+    area_copy(this, new_array, W, H);
   } else {
     // Bilinear scaling (FL_RGB_SCALING_BILINEAR)
     const float xscale = (w() - 1) / (float) W;
@@ -466,6 +840,9 @@ Fl_Image *Fl_RGB_Image::copy(int W, int H) {
     }
   }
 
+  if (!cached && scaling != FL_RGB_SCALING_NEAREST)
+    scaled_keep(this, W, H, scaling, new_array);
+
   return new_image;
 }
 
@@ -570,13 +947,113 @@ void Fl_RGB_Image::desaturate() {
 #if !defined(WIN32) && !defined(__APPLE__)
 // Composite an image with alpha on systems that don't have accelerated
 // alpha compositing...
+
+// Defined in fl_draw_image.cxx
+extern const signed char *fl_blend_order();
+extern int fl_blend_image(const uchar *pixels, int ld, int X, int Y, int W, int H);
+
+// The images that were drawn last keep a premultiplied copy in the byte
+// order of the window pixels, so that drawing them again, like the icons
+// of a browser, only has to composite. Larger images are converted each
+// time they are drawn.
+#define FL_BLEND_COPIES 16
+#define FL_BLEND_COPY_MAX (256*256)	// pixels
+
+struct Blend_Copy {
+  Fl_RGB_Image *img;
+  const uchar *array;	// the data of img when the copy was made
+  uchar *pixels;
+};
+
+static Blend_Copy blend_copies[FL_BLEND_COPIES]; // most recently used first
+static uchar *blend_buffer;			// scratch buffer
+static long blend_buffer_size;
+
+static uchar *blend_scratch(long size) {
+  if (size > blend_buffer_size) {
+    delete[] blend_buffer;
+    blend_buffer_size = size;
+    blend_buffer = new uchar[size];
+  }
+  return blend_buffer;
+}
+
+// Convert W*H pixels of img from cx,cy into premultiplied pixels with
+// the given byte order:
+static void blend_convert(Fl_RGB_Image *img, int cx, int cy, int W, int H,
+                          const signed char *order, uchar *to) {
+  int d = img->d();
+  int ld = img->ld();
+  if (ld == 0) ld = img->w() * d;
+  for (int y = 0; y < H; y++) {
+    const uchar *from = img->array + (cy + y) * ld + cx * d;
+    for (int x = 0; x < W; x++, from += d, to += 4) {
+      unsigned a = from[d - 1];
+      for (int i = 0; i < 4; i++) {
+        if (order[i] < 0) to[i] = (uchar)a;
+        else to[i] = div255(from[d == 2 ? 0 : order[i]] * a);
+      }
+    }
+  }
+}
+
+static void blend_uncache(Fl_RGB_Image *img) {
+  for (int i = 0; i < FL_BLEND_COPIES && blend_copies[i].img; i++) {
+    if (blend_copies[i].img != img) continue;
+    delete[] blend_copies[i].pixels;
+    for (; i < FL_BLEND_COPIES - 1; i++) blend_copies[i] = blend_copies[i + 1];
+    blend_copies[i].img = 0;
+    break;
+  }
+}
+
+// Return the premultiplied copy of img, or NULL if it is too large:
+static const uchar *blend_pixels(Fl_RGB_Image *img, const signed char *order) {
+  if (img->w() * img->h() > FL_BLEND_COPY_MAX) return 0;
+  int i;
+  for (i = 0; i < FL_BLEND_COPIES - 1 && blend_copies[i].img; i++)
+    if (blend_copies[i].img == img) break;
+  Blend_Copy c = blend_copies[i];
+  if (c.img && (c.img != img || c.array != img->array)) {
+    // replace the least recently used copy, or one of changed data
+    delete[] c.pixels;
+    c.img = 0;
+  }
+  if (!c.img) {
+    c.img = img;
+    c.array = img->array;
+    c.pixels = new uchar[img->w() * img->h() * 4];
+    blend_convert(img, 0, 0, img->w(), img->h(), order, c.pixels);
+  }
+  for (; i > 0; i--) blend_copies[i] = blend_copies[i - 1];
+  blend_copies[0] = c;
+  return c.pixels;
+}
+
 static void alpha_blend(Fl_RGB_Image *img, int X, int Y, int W, int H, int cx, int cy) {
+  const signed char *order = fl_blend_order();
+  if (order) {
+    const uchar *pixels = blend_pixels(img, order);
+    int ld = img->w() * 4;
+    if (pixels) {
+      pixels += cy * ld + cx * 4;
+    } else {
+      uchar *p = blend_scratch(W * H * 4);
+      blend_convert(img, cx, cy, W, H, order, p);
+      pixels = p;
+      ld = W * 4;
+    }
+    if (fl_blend_image(pixels, ld, X, Y, W, H)) return;
+  }
+
+  // Read the window pixels back as RGB and draw the result like any
+  // other image...
   int ld = img->ld();
   if (ld == 0) ld = img->w() * img->d();
   uchar *srcptr = (uchar*)img->array + cy * ld + cx * img->d();
   int srcskip = ld - img->d() * W;
 
-  uchar *dst = new uchar[W * H * 3];
+  uchar *dst = blend_scratch(W * H * 3);
   uchar *dstptr = dst;
 
   fl_read_image(dst, X, Y, W, H, 0);
@@ -621,8 +1098,6 @@ static void alpha_blend(Fl_RGB_Image *img, int X, int Y, int W, int H, int cx, i
   }
 
   fl_draw_image(dst, X, Y, W, H, 3, 0);
-
-  delete[] dst;
 }
 #endif // !WIN32 && !__APPLE__
 
@@ -18,6 +18,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <FL/fl_utf8.h>
 #include "flstring.h"
 
@@ -42,11 +44,189 @@ int	Fl_Shared_Image::alloc_handlers_ = 0;	// Allocated format handlers
 
 
 //
-// Typedef the C API sort function type the only way I know how...
-//
+// The index of the shared images: a hash table of their names, so that
+// find() takes the same time for any number of images, and a list from
+// the most to the least recently used image for cache_size().
+//
+
+struct Shared_Node {
+  Shared_Node *next;		// next node in the hash bucket
+  Shared_Node *newer, *older;	// neighbors in the list of recent use
+  Fl_Shared_Image *image;
+  unsigned hash;		// of the name
+  int index;			// of the image in images_
+  size_t bytes;			// memory of the image, counted in cache_bytes
+  int drawn;			// the image may have a server-side copy
+  time_t mtime;			// of the file when the image was released
+  off_t size;
+};
+
+static Shared_Node **buckets;	// hash table
+static int num_buckets;		// size of the hash table, a power of 2
+static int num_nodes;
+static Shared_Node *newest, *oldest;
+static size_t cache_bytes;	// memory of all images
+static size_t cache_limit;	// see Fl_Shared_Image::cache_size()
+
+// FNV-1a:
+static unsigned shared_hash(const char *name) {
+  unsigned h = 2166136261U;
+  for (; *name; name++) h = (h ^ (uchar)*name) * 16777619U;
+  return h;
+}
+
+static void lru_unlink(Shared_Node *n) {
+  if (n->newer) n->newer->older = n->older;
+  else newest = n->older;
+  if (n->older) n->older->newer = n->newer;
+  else oldest = n->newer;
+}
 
-extern "C" {
-  typedef int (*compare_func_t)(const void *, const void *);
+// Make n the most recently used image:
+static void lru_touch(Shared_Node *n) {
+  if (n == newest) return;
+  lru_unlink(n);
+  n->newer = 0;
+  n->older = newest;
+  if (newest) newest->newer = n;
+  else oldest = n;
+  newest = n;
+}
+
+// The node of an image, or NULL if it was not added:
+static Shared_Node *shared_node(Fl_Shared_Image *img) {
+  if (!num_buckets || !img->name()) return 0;
+  Shared_Node *n = buckets[shared_hash(img->name()) & (num_buckets - 1)];
+  while (n && n->image != img) n = n->next;
+  return n;
+}
+
+// The memory of the decoded image, plus that of a server-side copy once
+// it has been drawn; the server may not need one, e.g. for scaled images,
+// so this is an estimate.
+static void shared_account(Shared_Node *n) {
+  size_t bytes = (size_t)n->image->w() * n->image->h() * 4;
+  if (!n->drawn) bytes = 0;
+  Fl_Image *img = n->image;
+  if (img->count()) {
+    int d = img->d() ? img->d() : 1;
+    bytes += (size_t)img->w() * img->h() * d;
+  }
+  cache_bytes += bytes - n->bytes;
+  n->bytes = bytes;
+}
+
+// Everything in the index that needs protected members of Fl_Shared_Image:
+class Fl_Shared_Image_Cache {
+public:
+  static void insert(Fl_Shared_Image *img);
+  static void remove(Shared_Node *n);
+  static int keep(Fl_Shared_Image *img);
+  static int changed(Shared_Node *n);
+  static void trim(Shared_Node *drawing = 0);
+};
+
+void Fl_Shared_Image_Cache::insert(Fl_Shared_Image *img) {
+  if (num_nodes >= num_buckets) {
+    // grow the table, so that the buckets stay short
+    int nb = num_buckets ? 2 * num_buckets : 64;
+    Shared_Node **b = new Shared_Node *[nb];
+    memset(b, 0, nb * sizeof(Shared_Node *));
+    for (int i = 0; i < num_buckets; i++) {
+      Shared_Node *next;
+      for (Shared_Node *n = buckets[i]; n; n = next) {
+        next = n->next;
+        n->next = b[n->hash & (nb - 1)];
+        b[n->hash & (nb - 1)] = n;
+      }
+    }
+    delete[] buckets;
+    buckets = b;
+    num_buckets = nb;
+  }
+  Shared_Node *n = new Shared_Node;
+  memset(n, 0, sizeof(Shared_Node));
+  n->image = img;
+  n->hash = shared_hash(img->name_);
+  n->index = img->num_images_ - 1;
+  n->next = buckets[n->hash & (num_buckets - 1)];
+  buckets[n->hash & (num_buckets - 1)] = n;
+  n->older = newest;
+  if (newest) newest->newer = n;
+  else oldest = n;
+  newest = n;
+  num_nodes++;
+  shared_account(n);
+}
+
+// Remove an image from the index and from images_, without deleting it:
+void Fl_Shared_Image_Cache::remove(Shared_Node *n) {
+  Shared_Node **p = buckets + (n->hash & (num_buckets - 1));
+  while (*p != n) p = &(*p)->next;
+  *p = n->next;
+  lru_unlink(n);
+  num_nodes--;
+  cache_bytes -= n->bytes;
+
+  // move the last image into the hole:
+  Fl_Shared_Image **images = Fl_Shared_Image::images_;
+  int last = --Fl_Shared_Image::num_images_;
+  if (n->index < last) {
+    images[n->index] = images[last];
+    Shared_Node *m = shared_node(images[last]);
+    if (m) m->index = n->index;
+  }
+  delete n;
+
+  if (Fl_Shared_Image::num_images_ == 0 && images) {
+    delete[] images;
+    Fl_Shared_Image::images_ = 0;
+    Fl_Shared_Image::alloc_images_ = 0;
+  }
+}
+
+// Keep an image that was released for the last time, if it can be
+// found again and the memory limit allows it. Returns 1 if it was kept.
+int Fl_Shared_Image_Cache::keep(Fl_Shared_Image *img) {
+  if (!cache_limit || !img->alloc_image_ || !img->image_) return 0;
+  Shared_Node *n = shared_node(img);
+  struct stat st;
+  if (!n || fl_stat(img->name_, &st)) return 0;
+  // remember the file, so that a changed file is loaded again:
+  n->mtime = st.st_mtime;
+  n->size = st.st_size;
+  lru_touch(n);
+  trim();
+  return 1;
+}
+
+// Check whether the file of a kept image was changed:
+int Fl_Shared_Image_Cache::changed(Shared_Node *n) {
+  struct stat st;
+  return fl_stat(n->image->name_, &st) ||
+         st.st_mtime != n->mtime || st.st_size != n->size;
+}
+
+// Free the server-side copies of the least recently used images, and the
+// images that are not in use, until the memory limit is met. The image
+// that is being drawn keeps its copy even if it alone exceeds the limit,
+// otherwise it would be sent to the server again on every redraw:
+void Fl_Shared_Image_Cache::trim(Shared_Node *drawing) {
+  if (!cache_limit) return;
+  Shared_Node *newer;
+  for (Shared_Node *n = oldest; n && cache_bytes > cache_limit; n = newer) {
+    newer = n->newer;
+    if (n == drawing) continue;
+    if (n->image->refcount_ <= 0) {
+      Fl_Shared_Image *img = n->image;
+      remove(n);
+      delete img;
+    } else if (n->drawn) {
+      n->image->uncache();
+      n->drawn = 0;
+      shared_account(n);
+    }
+  }
 }
 
 
@@ -132,7 +312,8 @@ Fl_Shared_Image::add() {
 
   if (num_images_ >= alloc_images_) {
     // Allocate more memory...
-    temp = new Fl_Shared_Image *[alloc_images_ + 32];
+    int n = alloc_images_ ? 2 * alloc_images_ : 32;
+    temp = new Fl_Shared_Image *[n];
 
     if (alloc_images_) {
       memcpy(temp, images_, alloc_images_ * sizeof(Fl_Shared_Image *));
@@ -141,16 +322,14 @@ Fl_Shared_Image::add() {
     }
 
     images_       = temp;
-    alloc_images_ += 32;
+    alloc_images_ = n;
   }
 
   images_[num_images_] = this;
   num_images_ ++;
 
-  if (num_images_ > 1) {
-    qsort(images_, num_images_, sizeof(Fl_Shared_Image *),
-          (compare_func_t)compare);
-  }
+  Fl_Shared_Image_Cache::insert(this);
+  Fl_Shared_Image_Cache::trim();
 }
 
 
@@ -189,31 +368,15 @@ Fl_Shared_Image::~Fl_Shared_Image() {
   In the latter case, it will reorganize the shared image array so that no hole will occur.
 */
 void Fl_Shared_Image::release() {
-  int	i;	// Looping var...
-
   refcount_ --;
   if (refcount_ > 0) return;
 
-  for (i = 0; i < num_images_; i ++)
-    if (images_[i] == this) {
-      num_images_ --;
-
-      if (i < num_images_) {
-        memmove(images_ + i, images_ + i + 1,
-               (num_images_ - i) * sizeof(Fl_Shared_Image *));
-      }
+  if (Fl_Shared_Image_Cache::keep(this)) return;
 
-      break;
-    }
+  Shared_Node *n = shared_node(this);
+  if (n) Fl_Shared_Image_Cache::remove(n);
 
   delete this;
-
-  if (num_images_ == 0 && images_) {
-    delete[] images_;
-
-    images_       = 0;
-    alloc_images_ = 0;
-  }
 }
 
 
@@ -328,6 +491,13 @@ Fl_Shared_Image::desaturate() {
 // 'Fl_Shared_Image::draw()' - Draw a shared image...
 //
 void Fl_Shared_Image::draw(int X, int Y, int W, int H, int cx, int cy) {
+  Shared_Node *node = cache_limit ? shared_node(this) : 0;
+  if (node) {
+    lru_touch(node);
+    node->drawn = 1;
+    shared_account(node);
+    Fl_Shared_Image_Cache::trim(node);
+  }
 #if FLTK_ABI_VERSION >= 10304
   if (!image_) {
     Fl_Image::draw(X, Y, W, H, cx, cy);
@@ -424,26 +594,26 @@ void Fl_Shared_Image::uncache()
 
 /** Finds a shared image from its named and size specifications */
 Fl_Shared_Image* Fl_Shared_Image::find(const char *n, int W, int H) {
-  Fl_Shared_Image	*key,		// Image key
-			**match;	// Matching image
-
-  if (num_images_) {
-    key = new Fl_Shared_Image();
-    key->name_ = new char[strlen(n) + 1];
-    strcpy((char *)key->name_, n);
-    key->w(W);
-    key->h(H);
-
-    match = (Fl_Shared_Image **)bsearch(&key, images_, num_images_,
-                                        sizeof(Fl_Shared_Image *),
-                                        (compare_func_t)compare);
-
-    delete key;
-
-    if (match) {
-      (*match)->refcount_ ++;
-      return *match;
+  if (!num_buckets) return 0;
+
+  unsigned hash = shared_hash(n);
+  Shared_Node *node, *next;
+  for (node = buckets[hash & (num_buckets - 1)]; node; node = next) {
+    next = node->next;
+    Fl_Shared_Image *img = node->image;
+    if (node->hash != hash || strcmp(img->name_, n)) continue;
+    // the original image for W == 0, else one of that size:
+    if (!(W == 0 && img->original_) && (img->w() != W || img->h() != H)) continue;
+
+    if (img->refcount_ <= 0 && Fl_Shared_Image_Cache::changed(node)) {
+      // a released image that was kept, but its file has changed
+      Fl_Shared_Image_Cache::remove(node);
+      delete img;
+      continue;
     }
+    img->refcount_ ++;
+    lru_touch(node);
+    return img;
   }
 
   return 0;
@@ -508,6 +678,52 @@ Fl_Shared_Image *Fl_Shared_Image::get(Fl_RGB_Image *rgb, int own_it)
 }
 
 
+/**
+  Sets the memory that shared images may use, in bytes.
+
+  With a size of 0, the default, an image is deleted when it is released
+  for the last time, as it is not in use anymore, and there is no limit.
+
+  Otherwise images that were loaded from files stay in memory after their
+  last release(), so that get() and find() can return them again without
+  loading them. When the images use more memory than \p size, the least
+  recently used ones that are not in use are deleted, and the server-side
+  copies of the least recently used ones that are in use are freed with
+  uncache(); they are created again when the image is drawn. The memory
+  of an image is its decoded data plus an estimate of its server-side
+  copy, once it has been drawn.
+
+  An image that was kept is loaded again by get() when its file changes.
+  Kept images have a refcount() of 0 and are still in images().
+
+  \param size maximum memory in bytes, or 0
+  \version 1.3.4
+*/
+void Fl_Shared_Image::cache_size(size_t size) {
+  if (!size) {
+    // delete the images that are only kept
+    Shared_Node *newer;
+    for (Shared_Node *n = oldest; n; n = newer) {
+      newer = n->newer;
+      Fl_Shared_Image *img = n->image;
+      if (img->refcount_ > 0) continue;
+      Fl_Shared_Image_Cache::remove(n);
+      delete img;
+    }
+  }
+  cache_limit = size;
+  Fl_Shared_Image_Cache::trim();
+}
+
+/**
+  Returns the memory that shared images may use, in bytes.
+  \see cache_size(size_t)
+*/
+size_t Fl_Shared_Image::cache_size() {
+  return cache_limit;
+}
+
+
 /** Adds a shared image handler, which is basically a test function for adding new formats */
 void Fl_Shared_Image::add_handler(Fl_Shared_Handler f) {
   int			i;		// Looping var...
@@ -23,7 +23,12 @@
 #include <ctype.h>
 #include <FL/Fl.H>
 #include <FL/Fl_Text_Buffer.H>
+#include <FL/Fl_Text_Search.H>
 #include <FL/fl_ask.H>
+#include "Fl_Text_Line_Index.H"
+#include "Fl_Text_Piece_Table.H"
+#include "Fl_Text_Undo.H"
+#include "fl_text_scan.h"
 
 
 /*
@@ -68,6 +73,44 @@ static int min(int i1, int i2)
 #endif
 
 
+/*
+ The line start index only pays off for long distances. Shorter ranges
+ are still counted by scanning the buffer, which is faster than the
+ two block lookups an indexed query needs.
+ */
+#define LINE_INDEX_MIN_BYTES 16384
+#define LINE_INDEX_MIN_LINES 64
+
+
+#if FLTK_ABI_VERSION >= 10304
+
+/*
+ The state that was added to Fl_Text_Buffer in FLTK 1.3.4. Keeping it
+ out of the class means that mPrivate is the only new member.
+ */
+struct Fl_Text_Buffer_Private {
+  Fl_Text_Line_Index *mLineIndex; // optional newline index, NULL if disabled
+  Fl_Text_Piece_Table *mPieces;   // text storage of a PIECE_TABLE, else NULL
+  Fl_Text_Undo *mUndo;            // undo and redo history of the buffer
+  int mBulkDepth;                 // nesting depth of begin_bulk_edit()
+  int mBulkStart;                 // start of the range changed by a bulk edit,
+                                  // or -1 if nothing was changed yet
+  int mBulkOldEnd;                // end of that range before the bulk edit
+  int mBulkNewEnd;                // end of that range in the current text
+  int mBulkRefresh;               // set if the callbacks were called without
+                                  // a change during a bulk edit
+  char *mBulkText;                // text of the range before the bulk edit,
+                                  // starting at mBulkText + mBulkHead
+  int mBulkHead;                  // free space in front of the saved text
+  int mBulkAlloc;                 // allocated size of mBulkText
+};
+
+#else
+
+/*
+ Without FLTK_ABI_VERSION 10304 there is no room for an undo history in
+ the buffer, so only the last change of all buffers can be undone.
+ */
 static char *undobuffer;
 static int undobufferlength;
 static Fl_Text_Buffer *undowidget;
@@ -94,21 +137,66 @@ static void undobuffersize(int n)
   }
 }
 
+#endif // FLTK_ABI_VERSION >= 10304
+
+
 static void def_transcoding_warning_action(Fl_Text_Buffer *text)
 {
   fl_alert("%s", text->file_encoding_warning_message);
 }
 
 /*
- Initialize all variables.
+ Create a gap buffer.
  */
 Fl_Text_Buffer::Fl_Text_Buffer(int requestedSize, int preferredGapSize)
 {
+  init_(GAP_BUFFER, requestedSize, preferredGapSize);
+}
+
+
+/*
+ Create a buffer with the given storage engine.
+ */
+Fl_Text_Buffer::Fl_Text_Buffer(Storage storage, int requestedSize, int preferredGapSize)
+{
+  init_(storage, requestedSize, preferredGapSize);
+}
+
+
+Fl_Text_Buffer::Storage Fl_Text_Buffer::storage() const
+{
+#if FLTK_ABI_VERSION >= 10304
+  return mPrivate->mPieces ? PIECE_TABLE : GAP_BUFFER;
+#else
+  return GAP_BUFFER;
+#endif
+}
+
+
+/*
+ Initialize all variables.
+ */
+void Fl_Text_Buffer::init_(Storage storage, int requestedSize, int preferredGapSize)
+{
+#if FLTK_ABI_VERSION >= 10304
+  Fl_Text_Buffer_Private *priv = mPrivate = new Fl_Text_Buffer_Private;
+#endif
   mLength = 0;
   mPreferredGapSize = preferredGapSize;
+#if FLTK_ABI_VERSION >= 10304
+  if (storage == PIECE_TABLE) {
+    priv->mPieces = new Fl_Text_Piece_Table;
+    mBuf = NULL;
+  } else {
+    priv->mPieces = NULL;
+    mBuf = (char *) malloc(requestedSize + mPreferredGapSize);
+  }
+#else
+  (void) storage;
   mBuf = (char *) malloc(requestedSize + mPreferredGapSize);
+#endif
   mGapStart = 0;
-  mGapEnd = mPreferredGapSize;
+  mGapEnd = mBuf ? mPreferredGapSize : 0;
   mTabDist = 8;
   mPrimary.mSelected = 0;
   mPrimary.mStart = mPrimary.mEnd = 0;
@@ -124,6 +212,16 @@ Fl_Text_Buffer::Fl_Text_Buffer(int requestedSize, int preferredGapSize)
   mPredeleteCbArgs = NULL;
   mCursorPosHint = 0;
   mCanUndo = 1;
+#if FLTK_ABI_VERSION >= 10304
+  priv->mUndo = new Fl_Text_Undo(this);
+  priv->mBulkDepth = 0;
+  priv->mBulkStart = -1;
+  priv->mBulkOldEnd = priv->mBulkNewEnd = 0;
+  priv->mBulkRefresh = 0;
+  priv->mBulkText = NULL;
+  priv->mBulkHead = priv->mBulkAlloc = 0;
+  priv->mLineIndex = NULL;
+#endif
   input_file_was_transcoded = 0;
   transcoding_warning_action = def_transcoding_warning_action;
 }
@@ -134,6 +232,16 @@ Fl_Text_Buffer::Fl_Text_Buffer(int requestedSize, int preferredGapSize)
  */
 Fl_Text_Buffer::~Fl_Text_Buffer()
 {
+#if FLTK_ABI_VERSION >= 10304
+  delete mPrivate->mUndo;
+  free(mPrivate->mBulkText);
+  delete mPrivate->mLineIndex;
+  delete mPrivate->mPieces;
+  delete mPrivate;
+#else
+  if (undowidget == this)
+    undowidget = 0;
+#endif
   free(mBuf);
   if (mNModifyProcs != 0) {
     delete[]mModifyProcs;
@@ -152,8 +260,7 @@ Fl_Text_Buffer::~Fl_Text_Buffer()
  */
 char *Fl_Text_Buffer::text() const {
   char *t = (char *) malloc(mLength + 1);
-  memcpy(t, mBuf, mGapStart);
-  memcpy(t+mGapStart, mBuf+mGapEnd, mLength - mGapStart);
+  copy_range_(0, mLength, t);
   t[mLength] = '\0';
   return t;
 } 
@@ -175,15 +282,36 @@ void Fl_Text_Buffer::text(const char *t)
   /* Save information for redisplay, and get rid of the old buffer */
   const char *deletedText = text();
   int deletedLength = mLength;
-  free((void *) mBuf);
-  
-  /* Start a new buffer with a gap of mPreferredGapSize at the end */
   int insertedLength = (int) strlen(t);
-  mBuf = (char *) malloc(insertedLength + mPreferredGapSize);
   mLength = insertedLength;
-  mGapStart = insertedLength;
-  mGapEnd = mGapStart + mPreferredGapSize;
-  memcpy(mBuf, t, insertedLength);
+
+#if FLTK_ABI_VERSION >= 10304
+  Fl_Text_Buffer_Private *priv = mPrivate;
+  if (priv->mPieces) {
+    /* Drop all pieces and the memory they refer to */
+    priv->mPieces->clear();
+    char *s = priv->mPieces->reserve(insertedLength);
+    memcpy(s, t, insertedLength);
+    priv->mPieces->insert(0, s, insertedLength);
+  } else
+#endif
+  {
+    /* Start a new buffer with a gap of mPreferredGapSize at the end */
+    free((void *) mBuf);
+    mBuf = (char *) malloc(insertedLength + mPreferredGapSize);
+    mGapStart = insertedLength;
+    mGapEnd = mGapStart + mPreferredGapSize;
+    memcpy(mBuf, t, insertedLength);
+  }
+  /* The old undo history does not apply to the new text */
+#if FLTK_ABI_VERSION >= 10304
+  if (priv->mLineIndex)
+    priv->mLineIndex->rebuild();
+  priv->mUndo->clear();
+#else
+  if (undowidget == this)
+    undowidget = 0;
+#endif
   
   /* Zero all of the existing selections */
   update_selections(0, deletedLength, 0);
@@ -222,15 +350,7 @@ char *Fl_Text_Buffer::text_range(int start, int end) const {
   s = (char *) malloc(copiedLength + 1);
   
   /* Copy the text from the buffer to the returned string */
-  if (end <= mGapStart) {
-    memcpy(s, mBuf + start, copiedLength);
-  } else if (start >= mGapStart) {
-    memcpy(s, mBuf + start + (mGapEnd - mGapStart), copiedLength);
-  } else {
-    int part1Length = mGapStart - start;
-    memcpy(s, mBuf + start, part1Length);
-    memcpy(s + part1Length, mBuf + mGapEnd, copiedLength - part1Length);
-  }
+  copy_range_(start, end, s);
   s[copiedLength] = '\0';
   return s;
 }
@@ -370,31 +490,36 @@ void Fl_Text_Buffer::copy(Fl_Text_Buffer * fromBuf, int fromStart,
   
   int copiedLength = fromEnd - fromStart;
   
-  /* Prepare the buffer to receive the new text.  If the new text fits in
-   the current buffer, just move the gap (if necessary) to where
-   the text should be inserted.  If the new text is too large, reallocate
-   the buffer with a gap large enough to accomodate the new text and a
-   gap of mPreferredGapSize */
-  if (copiedLength > mGapEnd - mGapStart)
-    reallocate_with_gap(toPos, copiedLength + mPreferredGapSize);
-  else if (toPos != mGapStart)
-    move_gap(toPos);
-  
-  /* Insert the new text (toPos now corresponds to the start of the gap) */
-  if (fromEnd <= fromBuf->mGapStart) {
-    memcpy(&mBuf[toPos], &fromBuf->mBuf[fromStart], copiedLength);
-  } else if (fromStart >= fromBuf->mGapStart) {
-    memcpy(&mBuf[toPos],
-	   &fromBuf->mBuf[fromStart + (fromBuf->mGapEnd - fromBuf->mGapStart)],
-	   copiedLength);
-  } else {
-    int part1Length = fromBuf->mGapStart - fromStart;
-    memcpy(&mBuf[toPos], &fromBuf->mBuf[fromStart], part1Length);
-    memcpy(&mBuf[toPos + part1Length],
-	   &fromBuf->mBuf[fromBuf->mGapEnd], copiedLength - part1Length);
+#if FLTK_ABI_VERSION >= 10304
+  Fl_Text_Buffer_Private *priv = mPrivate;
+  if (priv->mPieces) {
+    /* Copy into new piece memory first, fromBuf may be this buffer */
+    char *s = priv->mPieces->reserve(copiedLength);
+    fromBuf->copy_range_(fromStart, fromEnd, s);
+    priv->mPieces->insert(toPos, s, copiedLength);
+  } else
+#endif
+  {
+    /* Prepare the buffer to receive the new text.  If the new text fits in
+     the current buffer, just move the gap (if necessary) to where
+     the text should be inserted.  If the new text is too large, reallocate
+     the buffer with a gap large enough to accomodate the new text and a
+     gap of mPreferredGapSize */
+    if (copiedLength > mGapEnd - mGapStart)
+      reallocate_with_gap(toPos, copiedLength + mPreferredGapSize);
+    else if (toPos != mGapStart)
+      move_gap(toPos);
+    
+    /* Insert the new text (toPos now corresponds to the start of the gap) */
+    fromBuf->copy_range_(fromStart, fromEnd, &mBuf[toPos]);
+    mGapStart += copiedLength;
   }
-  mGapStart += copiedLength;
   mLength += copiedLength;
+#if FLTK_ABI_VERSION >= 10304
+  if (priv->mLineIndex)
+    priv->mLineIndex->inserted(toPos, copiedLength,
+                         count_lines_(toPos, toPos + copiedLength));
+#endif
   update_selections(toPos, 0, copiedLength);
 }
 
@@ -406,6 +531,11 @@ void Fl_Text_Buffer::copy(Fl_Text_Buffer * fromBuf, int fromStart,
  */ 
 int Fl_Text_Buffer::undo(int *cursorPos)
 {
+#if FLTK_ABI_VERSION >= 10304
+  if (!mCanUndo)
+    return 0;
+  return mPrivate->mUndo->undo(cursorPos);
+#else
   if (undowidget != this || (!undocut && !undoinsert && !mCanUndo))
     return 0;
   
@@ -439,6 +569,79 @@ int Fl_Text_Buffer::undo(int *cursorPos)
   }
   
   return 1;
+#endif
+}
+
+
+/*
+ Apply the changes that were undone last.
+ */
+int Fl_Text_Buffer::redo(int *cursorPos)
+{
+#if FLTK_ABI_VERSION >= 10304
+  if (!mCanUndo)
+    return 0;
+  return mPrivate->mUndo->redo(cursorPos);
+#else
+  (void) cursorPos;
+  return 0;
+#endif
+}
+
+
+int Fl_Text_Buffer::can_undo() const
+{
+#if FLTK_ABI_VERSION >= 10304
+  return mCanUndo && mPrivate->mUndo->can_undo();
+#else
+  return mCanUndo && undowidget == this && (undocut || undoinsert);
+#endif
+}
+
+
+int Fl_Text_Buffer::can_redo() const
+{
+#if FLTK_ABI_VERSION >= 10304
+  return mCanUndo && mPrivate->mUndo->can_redo();
+#else
+  return 0;
+#endif
+}
+
+
+void Fl_Text_Buffer::begin_undo_group()
+{
+#if FLTK_ABI_VERSION >= 10304
+  mPrivate->mUndo->begin_group();
+#endif
+}
+
+
+void Fl_Text_Buffer::end_undo_group()
+{
+#if FLTK_ABI_VERSION >= 10304
+  mPrivate->mUndo->end_group();
+#endif
+}
+
+
+void Fl_Text_Buffer::undo_limit(int bytes)
+{
+#if FLTK_ABI_VERSION >= 10304
+  mPrivate->mUndo->limit(bytes);
+#else
+  (void) bytes;
+#endif
+}
+
+
+int Fl_Text_Buffer::undo_limit() const
+{
+#if FLTK_ABI_VERSION >= 10304
+  return mPrivate->mUndo->limit();
+#else
+  return 0;
+#endif
 }
 
 
@@ -449,8 +652,13 @@ void Fl_Text_Buffer::canUndo(char flag)
 {
   mCanUndo = flag;
   // disabling undo also clears the last undo operation!
+#if FLTK_ABI_VERSION >= 10304
+  if (!mCanUndo)
+    mPrivate->mUndo->clear();
+#else
   if (!mCanUndo && undowidget==this) 
     undowidget = 0;
+#endif
 }
 
 
@@ -895,31 +1103,72 @@ int Fl_Text_Buffer::skip_displayed_characters(int lineStartPos, int nChars)
 }
 
 
+/*
+ Enable or disable the line start index.
+ */
+void Fl_Text_Buffer::line_index(int on)
+{
+#if FLTK_ABI_VERSION >= 10304
+  Fl_Text_Buffer_Private *priv = mPrivate;
+  if (on && !priv->mLineIndex) {
+    priv->mLineIndex = new Fl_Text_Line_Index(this);
+  } else if (!on && priv->mLineIndex) {
+    delete priv->mLineIndex;
+    priv->mLineIndex = NULL;
+  }
+#else
+  (void) on;
+#endif
+}
+
+
+int Fl_Text_Buffer::line_index() const
+{
+#if FLTK_ABI_VERSION >= 10304
+  return mPrivate->mLineIndex != 0;
+#else
+  return 0;
+#endif
+}
+
+
 /*
  Count the number of newline characters between start and end.
  startPos and endPos must be at a character boundary.
- This function is optimized for speed by not using UTF-8 calls.
+ Long ranges are answered by the line index if there is one.
  */
 int Fl_Text_Buffer::count_lines(int startPos, int endPos) const {
   IS_UTF8_ALIGNED2(this, (startPos))
   IS_UTF8_ALIGNED2(this, (endPos))
-  
-  int gapLen = mGapEnd - mGapStart;
+
+#if FLTK_ABI_VERSION >= 10304
+  Fl_Text_Line_Index *index = mPrivate->mLineIndex;
+  if (index && endPos - startPos > LINE_INDEX_MIN_BYTES) {
+    if (endPos > mLength)
+      endPos = mLength;
+    return index->lines_before(endPos) - index->lines_before(startPos);
+  }
+#endif
+  return count_lines_(startPos, endPos);
+}
+
+
+/*
+ Count the number of newline characters between start and end.
+ This function is optimized for speed by not using UTF-8 calls.
+ */
+int Fl_Text_Buffer::count_lines_(int startPos, int endPos) const {
+  if (endPos < startPos || endPos > mLength)
+    endPos = mLength;
+
   int lineCount = 0;
-  
-  int pos = startPos;
-  while (pos < mGapStart)
-  {
-    if (pos == endPos)
-      return lineCount;
-    if (mBuf[pos++] == '\n')
-      lineCount++;
-  } 
-  while (pos < mLength) {
-    if (pos == endPos)
-      return lineCount;
-    if (mBuf[pos++ + gapLen] == '\n')
-      lineCount++;
+  while (startPos < endPos) {
+    const char *p;
+    int len = segment_(startPos, &p, 1);
+    if (len > endPos - startPos)
+      len = endPos - startPos;
+    lineCount += fl_text_count_byte(p, len, '\n');
+    startPos += len;
   }
   return lineCount;
 }
@@ -928,35 +1177,41 @@ int Fl_Text_Buffer::count_lines(int startPos, int endPos) const {
 /*
  Skip to the first character, n lines ahead.
  StartPos must be at a character boundary.
- This function is optimized for speed by not using UTF-8 calls.
  */
 int Fl_Text_Buffer::skip_lines(int startPos, int nLines)
 {
   IS_UTF8_ALIGNED2(this, (startPos))
-  
-  if (nLines == 0)
+
+#if FLTK_ABI_VERSION >= 10304
+  Fl_Text_Line_Index *index = mPrivate->mLineIndex;
+  if (index && nLines > LINE_INDEX_MIN_LINES && startPos >= 0) {
+    int nl = index->newline_position(index->lines_before(startPos) + nLines);
+    return nl < 0 ? mLength : nl + 1;
+  }
+#endif
+  return skip_lines_(startPos, nLines);
+}
+
+
+/*
+ Skip to the first character, n lines ahead.
+ This function is optimized for speed by not using UTF-8 calls.
+ */
+int Fl_Text_Buffer::skip_lines_(int startPos, int nLines) const
+{
+  if (nLines <= 0)
     return startPos;
-  
-  int gapLen = mGapEnd - mGapStart;
+
   int pos = startPos;
-  int lineCount = 0;
-  while (pos < mGapStart) {
-    if (mBuf[pos++] == '\n') {
-      lineCount++;
-      if (lineCount == nLines) {
-        IS_UTF8_ALIGNED2(this, (pos))
-	return pos;
-      }
-    }
-  }
   while (pos < mLength) {
-    if (mBuf[pos++ + gapLen] == '\n') {
-      lineCount++;
-      if (lineCount >= nLines) {
-        IS_UTF8_ALIGNED2(this, (pos))
-	return pos;
-      }
+    const char *p;
+    int len = segment_(pos, &p, 1);
+    const char *nl = fl_text_find_byte(p, len, '\n', &nLines);
+    if (nl) {
+      IS_UTF8_ALIGNED2(this, (pos + (int)(nl - p) + 1))
+      return pos + (int)(nl - p) + 1;
     }
+    pos += len;
   }
   IS_UTF8_ALIGNED2(this, (pos))
   return pos;
@@ -966,35 +1221,50 @@ int Fl_Text_Buffer::skip_lines(int startPos, int nLines)
 /*
  Skip to the first character, n lines back.
  StartPos must be at a character boundary.
- This function is optimized for speed by not using UTF-8 calls.
  */
 int Fl_Text_Buffer::rewind_lines(int startPos, int nLines)
 {
   IS_UTF8_ALIGNED2(this, (startPos))
-  
-  int pos = startPos - 1;
-  if (pos <= 0)
-    return 0;
-  
-  int gapLen = mGapEnd - mGapStart;
-  int lineCount = -1;
-  while (pos >= mGapStart) {
-    if (mBuf[pos + gapLen] == '\n') {
-      if (++lineCount >= nLines) {
-        IS_UTF8_ALIGNED2(this, (pos+1))
-	return pos + 1;
-      }
-    }
-    pos--;
+
+#if FLTK_ABI_VERSION >= 10304
+  Fl_Text_Line_Index *index = mPrivate->mLineIndex;
+  if (index && nLines > LINE_INDEX_MIN_LINES) {
+    if (startPos <= 1)
+      return 0;
+    if (startPos > mLength)
+      startPos = mLength;
+    // find the newline that precedes the target line
+    int nl = index->newline_position(index->lines_before(startPos) - nLines);
+    return nl < 0 ? 0 : nl + 1;
   }
-  while (pos >= 0) {
-    if (mBuf[pos] == '\n') {
-      if (++lineCount >= nLines) {
-        IS_UTF8_ALIGNED2(this, (pos+1))
-	return pos + 1;
-      }
+#endif
+  return rewind_lines_(startPos, nLines);
+}
+
+
+/*
+ Skip to the first character, n lines back.
+ This function is optimized for speed by not using UTF-8 calls.
+ */
+int Fl_Text_Buffer::rewind_lines_(int startPos, int nLines) const
+{
+  if (startPos - 1 <= 0)
+    return 0;
+  if (startPos > mLength)
+    startPos = mLength;
+
+  /* the newline ending the line before the one we are looking for */
+  int n = (nLines < 0 ? 0 : nLines) + 1;
+  int pos = startPos;
+  while (pos > 0) {
+    const char *p;
+    int len = segment_before_(pos, &p, 1);
+    const char *nl = fl_text_rfind_byte(p, len, '\n', &n);
+    if (nl) {
+      IS_UTF8_ALIGNED2(this, (pos - len + (int)(nl - p) + 1))
+      return pos - len + (int)(nl - p) + 1;
     }
-    pos--;
+    pos -= len;
   }
   return 0;
 }
@@ -1002,6 +1272,7 @@ int Fl_Text_Buffer::rewind_lines(int startPos, int nLines)
 
 /*
  Find a matching string in the buffer.
+ The search is done by Fl_Text_Search, which skips over most of the text.
  */
 int Fl_Text_Buffer::search_forward(int startPos, const char *searchString,
 				   int *foundPos, int matchCase) const 
@@ -1011,48 +1282,8 @@ int Fl_Text_Buffer::search_forward(int startPos, const char *searchString,
   
   if (!searchString)
     return 0;
-  int bp;
-  const char *sp;
-  if (matchCase) {
-    while (startPos < length()) {
-      bp = startPos;
-      sp = searchString;
-      for (;;) {
-        char c = *sp;
-        // we reached the end of the "needle", so we found the string!
-        if (!c) {
-          *foundPos = startPos;
-          return 1;
-        }
-        int l = fl_utf8len1(c);
-        if (memcmp(sp, address(bp), l))
-          break;
-        sp += l; bp += l;
-      }
-      startPos = next_char(startPos);
-    }
-  } else {
-    while (startPos < length()) {
-      bp = startPos;
-      sp = searchString;
-      for (;;) {
-        // we reached the end of the "needle", so we found the string!
-        if (!*sp) {
-          *foundPos = startPos;
-          return 1;
-        }
-        int l;
-        unsigned int b = char_at(bp);
-        unsigned int s = fl_utf8decode(sp, 0, &l);
-        if (fl_tolower(b)!=fl_tolower(s))
-          break;
-        sp += l; 
-        bp = next_char(bp);
-      }
-      startPos = next_char(startPos);
-    }
-  }  
-  return 0;
+  Fl_Text_Search search(searchString, matchCase ? Fl_Text_Search::MATCH_CASE : 0);
+  return search.find_forward(this, startPos, foundPos);
 }
 
 int Fl_Text_Buffer::search_backward(int startPos, const char *searchString,
@@ -1063,48 +1294,8 @@ int Fl_Text_Buffer::search_backward(int startPos, const char *searchString,
   
   if (!searchString)
     return 0;
-  int bp;
-  const char *sp;
-  if (matchCase) {
-    while (startPos >= 0) {
-      bp = startPos;
-      sp = searchString;
-      for (;;) {
-        char c = *sp;
-        // we reached the end of the "needle", so we found the string!
-        if (!c) {
-          *foundPos = startPos;
-          return 1;
-        }
-        int l = fl_utf8len1(c);
-        if (memcmp(sp, address(bp), l))
-          break;
-        sp += l; bp += l;
-      }
-      startPos = prev_char(startPos);
-    }
-  } else {
-    while (startPos >= 0) {
-      bp = startPos;
-      sp = searchString;
-      for (;;) {
-        // we reached the end of the "needle", so we found the string!
-        if (!*sp) {
-          *foundPos = startPos;
-          return 1;
-        }
-        int l;
-        unsigned int b = char_at(bp);
-        unsigned int s = fl_utf8decode(sp, 0, &l);
-        if (fl_tolower(b)!=fl_tolower(s))
-          break;
-        sp += l; 
-        bp = next_char(bp);
-      }
-      startPos = prev_char(startPos);
-    }
-  }  
-  return 0;
+  Fl_Text_Search search(searchString, matchCase ? Fl_Text_Search::MATCH_CASE : 0);
+  return search.find_backward(this, startPos, foundPos);
 }
 
 
@@ -1120,22 +1311,44 @@ int Fl_Text_Buffer::insert_(int pos, const char *text)
   
   int insertedLength = (int) strlen(text);
   
-  /* Prepare the buffer to receive the new text.  If the new text fits in
-   the current buffer, just move the gap (if necessary) to where
-   the text should be inserted.  If the new text is too large, reallocate
-   the buffer with a gap large enough to accomodate the new text and a
-   gap of mPreferredGapSize */
-  if (insertedLength > mGapEnd - mGapStart)
-    reallocate_with_gap(pos, insertedLength + mPreferredGapSize);
-  else if (pos != mGapStart)
-    move_gap(pos);
-  
-  /* Insert the new text (pos now corresponds to the start of the gap) */
-  memcpy(&mBuf[pos], text, insertedLength);
-  mGapStart += insertedLength;
+#if FLTK_ABI_VERSION >= 10304
+  Fl_Text_Buffer_Private *priv = mPrivate;
+  if (priv->mPieces) {
+    char *s = priv->mPieces->reserve(insertedLength);
+    memcpy(s, text, insertedLength);
+    priv->mPieces->insert(pos, s, insertedLength);
+  } else
+#endif
+  {
+    /* Prepare the buffer to receive the new text.  If the new text fits in
+     the current buffer, just move the gap (if necessary) to where
+     the text should be inserted.  If the new text is too large, reallocate
+     the buffer with a gap large enough to accomodate the new text and a
+     gap of mPreferredGapSize */
+    if (insertedLength > mGapEnd - mGapStart)
+      reallocate_with_gap(pos, insertedLength + mPreferredGapSize);
+    else if (pos != mGapStart)
+      move_gap(pos);
+    
+    /* Insert the new text (pos now corresponds to the start of the gap) */
+    memcpy(&mBuf[pos], text, insertedLength);
+    mGapStart += insertedLength;
+  }
   mLength += insertedLength;
+#if FLTK_ABI_VERSION >= 10304
+  if (priv->mLineIndex) {
+    int nLines = 0;
+    for (const char *c = text; *c; c++)
+      if (*c == '\n') nLines++;
+    priv->mLineIndex->inserted(pos, insertedLength, nLines);
+  }
+#endif
   update_selections(pos, 0, insertedLength);
   
+#if FLTK_ABI_VERSION >= 10304
+  if (mCanUndo)
+    priv->mUndo->inserted(pos, insertedLength);
+#else
   if (mCanUndo) {
     if (undowidget == this && undoat == pos && undoinsert) {
       undoinsert += insertedLength;
@@ -1147,6 +1360,7 @@ int Fl_Text_Buffer::insert_(int pos, const char *text)
     undocut = 0;
     undowidget = this;
   }
+#endif
   
   return insertedLength;
 }
@@ -1158,8 +1372,18 @@ int Fl_Text_Buffer::insert_(int pos, const char *text)
  */
 void Fl_Text_Buffer::remove_(int start, int end)
 {
-  /* if the gap is not contiguous to the area to remove, move it there */
+#if FLTK_ABI_VERSION >= 10304
+  Fl_Text_Buffer_Private *priv = mPrivate;
+  if (priv->mLineIndex)
+    priv->mLineIndex->remove(start, end);
+
+  if (mCanUndo)
+    priv->mUndo->remove(start, end);
   
+  if (priv->mPieces) {
+    priv->mPieces->remove(start, end);
+  } else
+#else
   if (mCanUndo) {
     if (undowidget == this && undoat == end && undocut) {
       undobuffersize(undocut + end - start + 1);
@@ -1173,29 +1397,21 @@ void Fl_Text_Buffer::remove_(int start, int end)
     undoinsert = 0;
     undoyankcut = 0;
     undowidget = this;
+    copy_range_(start, end, undobuffer);
   }
-  
-  if (start > mGapStart) {
-    if (mCanUndo)
-      memcpy(undobuffer, mBuf + (mGapEnd - mGapStart) + start,
-	     end - start);
-    move_gap(start);
-  } else if (end < mGapStart) {
-    if (mCanUndo)
-      memcpy(undobuffer, mBuf + start, end - start);
-    move_gap(end);
-  } else {
-    int prelen = mGapStart - start;
-    if (mCanUndo) {
-      memcpy(undobuffer, mBuf + start, prelen);
-      memcpy(undobuffer + prelen, mBuf + mGapEnd, end - start - prelen);
-    }
+#endif
+  {
+    /* if the gap is not contiguous to the area to remove, move it there */
+    if (start > mGapStart)
+      move_gap(start);
+    else if (end < mGapStart)
+      move_gap(end);
+    
+    /* expand the gap to encompass the deleted characters */
+    mGapEnd += end - mGapStart;
+    mGapStart -= mGapStart - start;
   }
   
-  /* expand the gap to encompass the deleted characters */
-  mGapEnd += end - mGapStart;
-  mGapStart -= mGapStart - start;
-  
   /* update the length */
   mLength -= end - start;
   
@@ -1270,7 +1486,6 @@ void Fl_Text_Buffer::remove_selection_(Fl_Text_Selection * sel)
   if (!sel->position(&start, &end))
     return;
   remove(start, end);
-  //undoyankcut = undocut;
 }
 
 
@@ -1301,11 +1516,24 @@ void Fl_Text_Buffer::replace_selection_(Fl_Text_Selection * sel,
 /*
  Call all callbacks.
  Unicode safe.
+ During a bulk edit, only remember which range of text changed.
  */
 void Fl_Text_Buffer::call_modify_callbacks(int pos, int nDeleted,
 					   int nInserted, int nRestyled,
 					   const char *deletedText) const {
   IS_UTF8_ALIGNED2(this, pos)
+#if FLTK_ABI_VERSION >= 10304
+  Fl_Text_Buffer_Private *priv = mPrivate;
+  if (priv->mBulkDepth) {
+    if (nInserted || nDeleted)
+      priv->mBulkNewEnd += nInserted - nDeleted;    // predelete covered the range
+    else if (nRestyled)
+      bulk_extend_(pos, pos + nRestyled);
+    else
+      priv->mBulkRefresh = 1;
+    return;
+  }
+#endif
   for (int i = 0; i < mNModifyProcs; i++)
     (*mModifyProcs[i]) (pos, nInserted, nDeleted, nRestyled,
 			deletedText, mCbArgs[i]);
@@ -1317,11 +1545,124 @@ void Fl_Text_Buffer::call_modify_callbacks(int pos, int nDeleted,
  Unicode safe.
  */
 void Fl_Text_Buffer::call_predelete_callbacks(int pos, int nDeleted) const {
+#if FLTK_ABI_VERSION >= 10304
+  if (mPrivate->mBulkDepth) {
+    bulk_extend_(pos, pos + nDeleted);
+    return;
+  }
+#endif
   for (int i = 0; i < mNPredeleteProcs; i++)
     (*mPredeleteProcs[i]) (pos, nDeleted, mPredeleteCbArgs[i]);
 } 
 
 
+/*
+ Grow the range changed by a bulk edit to cover start..end of the
+ current text. Text outside the changed range is still unchanged, so the
+ old text of the new parts can be copied from the buffer.
+ */
+void Fl_Text_Buffer::bulk_extend_(int start, int end) const
+{
+#if FLTK_ABI_VERSION >= 10304
+  Fl_Text_Buffer_Private *priv = mPrivate;
+  if (priv->mBulkStart < 0)
+    priv->mBulkStart = priv->mBulkOldEnd = priv->mBulkNewEnd = start;
+  int len = priv->mBulkOldEnd - priv->mBulkStart;
+  if (start < priv->mBulkStart) {
+    int n = priv->mBulkStart - start;
+    if (n > priv->mBulkHead) {
+      /* leave as much room in front as the text is long, so that edits
+       moving backwards through the buffer need few reallocations */
+      int head = n + len;
+      int alloc = head + len + 1 + (priv->mBulkAlloc - priv->mBulkHead - len);
+      char *t = (char *) malloc(alloc);
+      if (len)
+        memcpy(t + head, priv->mBulkText + priv->mBulkHead, len);
+      free(priv->mBulkText);
+      priv->mBulkText = t;
+      priv->mBulkHead = head;
+      priv->mBulkAlloc = alloc;
+    }
+    priv->mBulkHead -= n;
+    copy_range_(start, priv->mBulkStart, priv->mBulkText + priv->mBulkHead);
+    priv->mBulkStart = start;
+    len += n;
+  }
+  if (end > priv->mBulkNewEnd) {
+    int n = end - priv->mBulkNewEnd;
+    if (priv->mBulkHead + len + n + 1 > priv->mBulkAlloc) {
+      priv->mBulkAlloc = 2 * (priv->mBulkHead + len + n) + 1;
+      priv->mBulkText = (char *) realloc(priv->mBulkText, priv->mBulkAlloc);
+    }
+    copy_range_(priv->mBulkNewEnd, end, priv->mBulkText + priv->mBulkHead + len);
+    priv->mBulkOldEnd += n;
+    priv->mBulkNewEnd = end;
+  }
+#else
+  (void) start; (void) end;
+#endif
+}
+
+
+int Fl_Text_Buffer::bulk_edit() const
+{
+#if FLTK_ABI_VERSION >= 10304
+  return mPrivate->mBulkDepth > 0;
+#else
+  return 0;
+#endif
+}
+
+
+/*
+ Start collecting changes.
+ */
+void Fl_Text_Buffer::begin_bulk_edit()
+{
+#if FLTK_ABI_VERSION >= 10304
+  mPrivate->mBulkDepth++;
+  mPrivate->mUndo->begin_group();
+#endif
+}
+
+
+/*
+ Report all changes collected since begin_bulk_edit() at once.
+ */
+void Fl_Text_Buffer::end_bulk_edit()
+{
+#if FLTK_ABI_VERSION >= 10304
+  Fl_Text_Buffer_Private *priv = mPrivate;
+  if (priv->mBulkDepth <= 0)
+    return;
+  priv->mUndo->end_group();
+  if (--priv->mBulkDepth)
+    return;
+  int start = priv->mBulkStart, oldEnd = priv->mBulkOldEnd, newEnd = priv->mBulkNewEnd;
+  int refresh = priv->mBulkRefresh;
+  priv->mBulkStart = -1;
+  priv->mBulkRefresh = 0;
+  if (start >= 0) {
+    char *deletedText = NULL;
+    if (oldEnd > start) {
+      deletedText = priv->mBulkText + priv->mBulkHead;
+      deletedText[oldEnd - start] = '\0';
+    }
+    call_modify_callbacks(start, oldEnd - start, newEnd - start, 0, deletedText);
+  } else if (refresh) {
+    call_modify_callbacks(0, 0, 0, 0, NULL);
+  }
+  /* Don't keep the copy of a large bulk edit around */
+  if (priv->mBulkAlloc > 65536) {
+    free(priv->mBulkText);
+    priv->mBulkText = NULL;
+    priv->mBulkAlloc = 0;
+  }
+  priv->mBulkHead = 0;
+#endif
+}
+
+
 /*
  Redisplay a new selected area.
  Unicode safe.
@@ -1378,6 +1719,88 @@ void Fl_Text_Buffer::redisplay_selection(Fl_Text_Selection *
 }
 
 
+/*
+ Return the address of the byte at pos and the number of bytes that
+ follow it without interruption by the gap.
+ */
+int Fl_Text_Buffer::segment_(int pos, const char **p, int raw) const
+{
+#if FLTK_ABI_VERSION >= 10304
+  if (!mBuf) {
+    // only a piece table has no gap buffer
+    Fl_Text_Piece_Table *pieces = mPrivate->mPieces;
+    if (pieces)
+      return pieces->segment(pos, p, raw);
+  }
+#else
+  (void) raw;
+#endif
+  if (pos < mGapStart) {
+    *p = mBuf + pos;
+    return mGapStart - pos;
+  }
+  *p = mBuf + pos + (mGapEnd - mGapStart);
+  return mLength - pos;
+}
+
+
+/*
+ Return the address and length of the run of bytes that ends just
+ before pos without interruption by the gap.
+ */
+int Fl_Text_Buffer::segment_before_(int pos, const char **p, int raw) const
+{
+#if FLTK_ABI_VERSION >= 10304
+  if (!mBuf) {
+    // only a piece table has no gap buffer
+    Fl_Text_Piece_Table *pieces = mPrivate->mPieces;
+    if (pieces)
+      return pieces->segment_before(pos, p, raw);
+  }
+#else
+  (void) raw;
+#endif
+  if (pos > mGapStart) {
+    *p = mBuf + mGapEnd;
+    return pos - mGapStart;
+  }
+  *p = mBuf;
+  return pos;
+}
+
+
+/*
+ Copy a range of the buffer into one contiguous block of memory.
+ */
+void Fl_Text_Buffer::copy_range_(int start, int end, char *dest) const
+{
+  while (start < end) {
+    const char *p;
+    int n = segment_(start, &p);
+    if (n > end - start)
+      n = end - start;
+    memcpy(dest, p, n);
+    dest += n;
+    start += n;
+  }
+}
+
+
+/*
+ Out of line part of address() for the piece table storage.
+ */
+char *Fl_Text_Buffer::piece_address_(int pos) const
+{
+#if FLTK_ABI_VERSION >= 10304
+  Fl_Text_Piece_Table *pieces = mPrivate->mPieces;
+  if (pieces)
+    return pieces->address(pos);
+#endif
+  // an empty gap buffer without memory
+  return (pos < mGapStart) ? mBuf+pos : mBuf+pos+mGapEnd-mGapStart;
+}
+
+
 /*
  Move the gap around without changing buffer content.
  Unicode safe. Pos must be at a character boundary.
@@ -1463,6 +1886,8 @@ void Fl_Text_Selection::update(int pos, int nDeleted, int nInserted)
 /*
  Find a UCS-4 character.
  StartPos must be at a character boundary, searchChar is UCS-4 encoded.
+ We scan for the first byte of the UTF-8 encoding of searchChar, which
+ always starts a character, and then compare the whole character.
  */
 int Fl_Text_Buffer::findchar_forward(int startPos, unsigned searchChar,
 				     int *foundPos) const 
@@ -1475,11 +1900,23 @@ int Fl_Text_Buffer::findchar_forward(int startPos, unsigned searchChar,
   if (startPos<0)
     startPos = 0;
   
-  for ( ; startPos<mLength; startPos = next_char(startPos)) {
-    if (searchChar == char_at(startPos)) {
-      *foundPos = startPos;
+  char utf8[4];
+  int utf8len = fl_utf8encode(searchChar, utf8);
+  int pos = startPos;
+  while (pos < mLength) {
+    const char *p;
+    int len = segment_(pos, &p), n = 1;
+    const char *m = fl_text_find_byte(p, len, utf8[0], &n);
+    if (!m) {
+      pos += len;
+      continue;
+    }
+    pos += (int)(m - p);
+    if (utf8len == 1 || char_at(pos) == searchChar) {
+      *foundPos = pos;
       return 1;
     }
+    pos++;
   }
   
   *foundPos = mLength;
@@ -1501,9 +1938,20 @@ int Fl_Text_Buffer::findchar_backward(int startPos, unsigned int searchChar,
   if (startPos > mLength)
     startPos = mLength;
   
-  for (startPos = prev_char(startPos); startPos>=0; startPos = prev_char(startPos)) {
-    if (searchChar == char_at(startPos)) {
-      *foundPos = startPos;
+  char utf8[4];
+  int utf8len = fl_utf8encode(searchChar, utf8);
+  int pos = startPos;
+  while (pos > 0) {
+    const char *p;
+    int len = segment_before_(pos, &p), n = 1;
+    const char *m = fl_text_rfind_byte(p, len, utf8[0], &n);
+    if (!m) {
+      pos -= len;
+      continue;
+    }
+    pos += (int)(m - p) - len;
+    if (utf8len == 1 || char_at(pos) == searchChar) {
+      *foundPos = pos;
       return 1;
     }
   }
@@ -1704,6 +2152,50 @@ const char *Fl_Text_Buffer::file_encoding_warning_message =
 }
 
 
+/*
+ Replace the buffer contents by a memory-mapped file.
+ */
+int Fl_Text_Buffer::mapfile(const char *file)
+{
+#if (defined(WIN32) && !defined(__CYGWIN__)) || FLTK_ABI_VERSION < 10304
+  return loadfile(file);
+#else
+  Fl_Text_Piece_Table *pieces = new Fl_Text_Piece_Table;
+  int e = pieces->map(file);
+  if (e) {
+    delete pieces;
+    return e;
+  }
+
+  Fl_Text_Buffer_Private *priv = mPrivate;
+  call_predelete_callbacks(0, length());
+  
+  /* Save information for redisplay, and get rid of the old text */
+  const char *deletedText = text();
+  int deletedLength = mLength;
+  delete priv->mPieces;
+  free((void *) mBuf);
+  mBuf = NULL;
+  mGapStart = mGapEnd = 0;
+  priv->mPieces = pieces;
+  mLength = priv->mPieces->length();
+  input_file_was_transcoded = 0;
+  if (priv->mLineIndex)
+    priv->mLineIndex->rebuild();
+  /* The old undo history does not apply to the new text */
+  priv->mUndo->clear();
+  
+  /* Zero all of the existing selections */
+  update_selections(0, deletedLength, 0);
+  
+  /* Call the saved display routine(s) to update the screen */
+  call_modify_callbacks(0, deletedLength, mLength, 0, deletedText);
+  free((void *) deletedText);
+  return 0;
+#endif
+}
+
+
 /*
  Write text to file.
  Unicode safe.
@@ -1712,6 +2204,12 @@ int Fl_Text_Buffer::outputfile(const char *file,
 			       int start, int end,
 			       int buflen) {
   FILE *fp;
+#if FLTK_ABI_VERSION >= 10304
+  // opening the mapped file for writing truncates it under our feet
+  Fl_Text_Piece_Table *pieces = mPrivate->mPieces;
+  if (pieces && pieces->is_mapped(file))
+    pieces->unmap();
+#endif
   if (!(fp = fl_fopen(file, "w")))
     return 1;
   for (int n; (n = min(end - start, buflen)); start += n) {
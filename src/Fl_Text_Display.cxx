@@ -30,6 +30,7 @@
 #include <FL/Fl_Text_Buffer.H>
 #include <FL/Fl_Text_Display.H>
 #include <FL/Fl_Window.H>
+#include "Fl_Text_Wrap_Cache.H"
 
 #undef min
 #undef max
@@ -165,6 +166,10 @@ Fl_Text_Display::Fl_Text_Display(int X, int Y, int W, int H, const char* l)
   mContinuousWrap = 0;
   mWrapMarginPix = 0;
   mSuppressResync = mNLinesDeleted = mModifyingTabDistance = 0;
+#if FLTK_ABI_VERSION >= 10304
+  mTailLines = mTailBytes = mTailAppending = 0;
+  mWrapCache = new Fl_Text_Wrap_Cache;
+#endif
 #if FLTK_ABI_VERSION >= 10303
   linenumber_font_    = FL_HELVETICA;
   linenumber_size_    = FL_NORMAL_SIZE;
@@ -193,6 +198,9 @@ Fl_Text_Display::~Fl_Text_Display() {
     mBuffer->remove_predelete_callback(buffer_predelete_cb, this);
   }
   if (mLineStarts) delete[] mLineStarts;
+#if FLTK_ABI_VERSION >= 10304
+  delete mWrapCache;
+#endif
 #if FLTK_ABI_VERSION >= 10303
   if (linenumber_format_) {
     free((void*)linenumber_format_);
@@ -398,6 +406,9 @@ void Fl_Text_Display::buffer( Fl_Text_Buffer *buf ) {
   /* Add the buffer to the display, and attach a callback to the buffer for
    receiving modification information when the buffer contents change */
   mBuffer = buf;
+#if FLTK_ABI_VERSION >= 10304
+  mWrapCache->reset(0);
+#endif
   if (mBuffer) {
     mBuffer->add_modify_callback( buffer_modified_cb, this );
     mBuffer->add_predelete_callback( buffer_predelete_cb, this );
@@ -452,7 +463,8 @@ void Fl_Text_Display::highlight_data(Fl_Text_Buffer *styleBuffer,
   mHighlightCBArg = cbArg;
   mColumnScale = 0;
 
-  mStyleBuffer->canUndo(0);
+  if (mStyleBuffer)
+    mStyleBuffer->canUndo(0);
   damage(FL_DAMAGE_EXPOSE);
 }
 
@@ -751,6 +763,21 @@ void Fl_Text_Display::redisplay_range(int startpos, int endpos) {
   IS_UTF8_ALIGNED2(buffer(), startpos)
   IS_UTF8_ALIGNED2(buffer(), endpos)
 
+#if FLTK_ABI_VERSION >= 10304
+  /* If styles use different fonts, the range may have been restyled and
+   wrap differently now */
+  if (mWrapCache->lines() && mStyleBuffer) {
+    for (int i = 0; i < mNStyles; i++) {
+      if (mStyleTable[i].font != textfont() || mStyleTable[i].size != textsize()) {
+        int first = mBuffer->count_lines(0, startpos);
+        int last = first + mBuffer->count_lines(startpos, min(endpos, mBuffer->length()));
+        mWrapCache->invalidate(first, last);
+        break;
+      }
+    }
+  }
+#endif
+
   if (damage_range1_start == -1 && damage_range1_end == -1) {
     damage_range1_start = startpos;
     damage_range1_end = endpos;
@@ -913,6 +940,14 @@ void Fl_Text_Display::cursor_style(int style) {
  the text is displayed. Different Text Displays can have different wrap modes,
  even if they share the same Text Buffer.
 
+ The widget remembers how many rows every line of text takes when it is
+ wrapped, so that scrolling through large wrapped texts does not measure
+ the text again. Only edited lines are measured again, or all lines if the
+ fonts or the wrap margin change. This turns on the line index of the
+ buffer (see Fl_Text_Buffer::line_index(int)). If the style table uses more
+ than one font or size and the style buffer changes, call redisplay_range()
+ for the restyled text so that the wrapping is updated.
+
  \param wrap new wrap mode is WRAP_NONE (don't wrap text at all), WRAP_AT_COLUMN
       (wrap text at the given text column), WRAP_AT_PIXEL (wrap text at a pixel
       position), or WRAP_AT_BOUNDS (wrap text so that it fits into the
@@ -930,6 +965,9 @@ void Fl_Text_Display::wrap_mode(int wrap, int wrapMargin) {
     case WRAP_NONE:
       mWrapMarginPix = 0;
       mContinuousWrap = 0;
+#if FLTK_ABI_VERSION >= 10304
+      mWrapCache->reset(0);
+#endif
       break;
     case WRAP_AT_COLUMN:
     default:
@@ -1560,11 +1598,18 @@ int Fl_Text_Display::rewind_lines(int startPos, int nLines) {
   if (!mContinuousWrap)
     return buf->rewind_lines(startPos, nLines);
 
+  Fl_Text_Wrap_Cache *cache = wrap_cache(buf, 0);
+  int line = cache ? buf->count_lines(0, startPos) : 0;
   pos = startPos;
   for (;;) {
     lineStart = buf->line_start(pos);
-    wrapped_line_counter(buf, lineStart, pos, INT_MAX, true, 0,
-                         &retPos, &retLines, &retLineStart, &retLineEnd, false);
+    if (cache && pos < startPos) {
+      /* pos is the newline at the end of a whole line */
+      retLines = wrapped_rows(line, lineStart) - 1;
+    } else {
+      wrapped_line_counter(buf, lineStart, pos, INT_MAX, true, 0,
+                           &retPos, &retLines, &retLineStart, &retLineEnd, false);
+    }
     if (retLines > nLines)
       return skip_lines(lineStart, retLines-nLines, true);
     nLines -= retLines;
@@ -1572,6 +1617,7 @@ int Fl_Text_Display::rewind_lines(int startPos, int nLines) {
     if (pos < 0)
       return 0;
     nLines -= 1;
+    line--;
   }
 }
 
@@ -1694,9 +1740,41 @@ void Fl_Text_Display::buffer_modified_cb( int pos, int nInserted, int nDeleted,
   if ( nInserted != 0 || nDeleted != 0 )
     textD->mCursorPreferredXPos = -1;
 
+#if FLTK_ABI_VERSION >= 10304
+  /* The modified lines must be measured again in continuous wrap mode */
+  Fl_Text_Wrap_Cache *cache = textD->mWrapCache;
+  if (cache->lines() && (nInserted != 0 || nDeleted != 0)) {
+    int line = buf->count_lines(0, pos);
+    int linesDel = nDeleted ? countlines(deletedText) + 1 : 1;
+    int linesIns = nInserted ? buf->count_lines(pos, pos + nInserted) + 1 : 1;
+    if (line + linesDel <= cache->lines())
+      cache->replace(line, linesDel, linesIns);
+    else
+      cache->reset(0);
+  }
+#endif
+
+  /* In continuous wrap mode, deleted lines are measured by the pre-delete
+   callback. That callback is not called for the changes of a bulk edit,
+   which are reported all at once afterwards, so the whole layout must
+   be recalculated instead */
+  int relayout = textD->mContinuousWrap && nDeleted != 0 && !textD->mSuppressResync;
+
   /* Count the number of lines inserted and deleted, and in the case
    of continuous wrap mode, how much has changed */
-  if (textD->mContinuousWrap) {
+  if (relayout) {
+    if (oldFirstChar >= pos + nDeleted)
+      textD->mFirstChar += nInserted - nDeleted;
+    else if (oldFirstChar > pos)
+      textD->mFirstChar = pos;
+    textD->mNBufferLines = textD->count_lines(0, buf->length(), true);
+    textD->mFirstChar = textD->line_start(textD->mFirstChar);
+    textD->mTopLineNum = textD->count_lines(0, textD->mFirstChar, true) + 1;
+    textD->reset_absolute_top_line_number();
+    textD->calc_line_starts(0, textD->mNVisibleLines);
+    textD->calc_last_char();
+    linesInserted = linesDeleted = 0;
+  } else if (textD->mContinuousWrap) {
     textD->find_wrap_range(deletedText, pos, nInserted, nDeleted,
                            &wrapModStart, &wrapModEnd, &linesInserted, &linesDeleted);
   } else {
@@ -1705,7 +1783,9 @@ void Fl_Text_Display::buffer_modified_cb( int pos, int nInserted, int nDeleted,
   }
 
   /* Update the line starts and mTopLineNum */
-  if ( nInserted != 0 || nDeleted != 0 ) {
+  if ( relayout ) {
+    scrolled = 1;
+  } else if ( nInserted != 0 || nDeleted != 0 ) {
     if (textD->mContinuousWrap) {
       textD->update_line_starts( wrapModStart, wrapModEnd-wrapModStart,
                                 nDeleted + pos-wrapModStart + (wrapModEnd-(pos+nInserted)),
@@ -1719,7 +1799,7 @@ void Fl_Text_Display::buffer_modified_cb( int pos, int nInserted, int nDeleted,
 
   /* If we're counting non-wrapped lines as well, maintain the absolute
    (non-wrapped) line number of the text displayed */
-  if (textD->maintaining_absolute_top_line_number() &&
+  if (!relayout && textD->maintaining_absolute_top_line_number() &&
       (nInserted != 0 || nDeleted != 0)) {
     if (deletedText && (pos + nDeleted < oldFirstChar))
       textD->mAbsTopLineNum += buf->count_lines(pos, pos + nInserted) -
@@ -1742,8 +1822,11 @@ void Fl_Text_Display::buffer_modified_cb( int pos, int nInserted, int nDeleted,
       textD->mCursorPos += nInserted - nDeleted;
   }
 
-  // refigure scrollbars & stuff
-  textD->resize(textD->x(), textD->y(), textD->w(), textD->h());
+  // refigure scrollbars & stuff, append() does this once when it is done
+#if FLTK_ABI_VERSION >= 10304
+  if (!textD->mTailAppending)
+#endif
+    textD->resize(textD->x(), textD->y(), textD->w(), textD->h());
 
   // don't need to do anything else if not visible?
   if (!textD->visible_r()) return;
@@ -1929,13 +2012,20 @@ int Fl_Text_Display::position_to_line( int pos, int *lineNum ) const {
     return 0;
   }
 
-  for ( i = mNVisibleLines - 1; i >= 0; i-- ) {
-    if ( mLineStarts[ i ] != -1 && pos >= mLineStarts[ i ] ) {
-      *lineNum = i;
-      return 1;
-    }
+  /* mLineStarts is ascending up to the first -1 entry, so we can do a
+   binary search for the last line that starts at or before pos */
+  int lo = 0, hi = mNVisibleLines - 1;
+  if ( mLineStarts[ 0 ] == -1 || pos < mLineStarts[ 0 ] )
+    return 0;   /* probably never be reached */
+  while ( lo < hi ) {
+    i = ( lo + hi + 1 ) / 2;
+    if ( mLineStarts[ i ] != -1 && pos >= mLineStarts[ i ] )
+      lo = i;
+    else
+      hi = i - 1;
   }
-  return 0;   /* probably never be reached */
+  *lineNum = lo;
+  return 1;
 }
 
 
@@ -2819,6 +2909,160 @@ void Fl_Text_Display::calc_last_char() {
 
 
 
+/**
+ \brief Limits the buffer to the last lines of text, for log viewers.
+
+ In tail mode, append() removes lines from the start of the buffer
+ whenever the buffer would otherwise contain more than \p maxLines lines
+ or more than \p maxBytes bytes. A limit of 0 means no limit, and setting
+ both limits to 0 turns tail mode off.
+
+ Removing text from the start of a gap buffer moves all remaining text,
+ so for buffers created as Fl_Text_Buffer::GAP_BUFFER, a few more lines
+ than necessary (one sixteenth of the limit) are removed at once. This
+ keeps the cost per appended line low. Buffers created as
+ Fl_Text_Buffer::PIECE_TABLE remove exactly the lines over the limit at
+ almost no cost.
+
+ A line limit turns on the line index of the buffer, which makes counting
+ the lines of large buffers fast.
+ Removing lines also clears the undo history of the buffer.
+ \param maxLines maximum number of lines, or 0
+ \param maxBytes maximum number of bytes, or 0
+ \see append(const char*), Fl_Text_Buffer::line_index(int)
+ \version 1.3.4 ABI feature (ignored in 1.3.x unless FLTK_ABI_VERSION is 10304 or higher)
+ */
+void Fl_Text_Display::tail_mode(int maxLines, int maxBytes) {
+#if FLTK_ABI_VERSION >= 10304
+  mTailLines = maxLines > 0 ? maxLines : 0;
+  mTailBytes = maxBytes > 0 ? maxBytes : 0;
+  if (mBuffer && tail_trim())
+    resize(x(), y(), w(), h());
+#else
+  // do nothing
+#endif
+}
+
+
+int Fl_Text_Display::tail_lines() const {
+#if FLTK_ABI_VERSION >= 10304
+  return mTailLines;
+#else
+  return 0;
+#endif
+}
+
+
+int Fl_Text_Display::tail_bytes() const {
+#if FLTK_ABI_VERSION >= 10304
+  return mTailBytes;
+#else
+  return 0;
+#endif
+}
+
+
+/**
+ \brief Appends text to the end of the buffer, keeping the end in view.
+
+ If the end of the buffer was visible before, the display scrolls down so
+ that it stays visible, like a terminal window. In tail mode, lines are
+ removed from the start of the buffer as needed.
+
+ Unlike Fl_Text_Buffer::append(), this updates the line starts of the
+ display only for the lines that actually changed and recalculates the
+ scrollbars once, which makes it much faster for logging many lines.
+ \param text UTF-8 encoded, nul terminated text
+ \see tail_mode(int, int)
+ */
+void Fl_Text_Display::append(const char *text) {
+  Fl_Text_Buffer *buf = mBuffer;
+  if (!buf || !text || !*text)
+    return;
+
+  int follow = mLastChar >= buf->length();
+#if FLTK_ABI_VERSION >= 10304
+  mTailAppending = 1;
+  buf->append(text);
+  tail_trim();
+  mTailAppending = 0;
+#else
+  buf->append(text);
+#endif
+
+  if (follow)
+    scroll_(mNBufferLines + 2 - mNVisibleLines, mHorizOffset);
+  mTopLineNumHint = mTopLineNum;
+
+  /* Only a full resize() can show scrollbars that were hidden */
+  if (scrollbar_width() &&
+      ((!mVScrollBar->visible() && scrollbar_align() & (FL_ALIGN_LEFT|FL_ALIGN_RIGHT) &&
+        mNBufferLines >= mNVisibleLines - 1) ||
+       (!mHScrollBar->visible() && scrollbar_align() & (FL_ALIGN_TOP|FL_ALIGN_BOTTOM) &&
+        !mContinuousWrap && longest_vline() > text_area.w))) {
+    resize(x(), y(), w(), h());
+    return;
+  }
+  update_v_scrollbar();
+  if (mHScrollBar->visible())
+    update_h_scrollbar();
+}
+
+
+/**
+ \brief Removes lines from the start of the buffer to enforce the limits
+ of tail mode.
+ \return number of bytes removed
+ */
+int Fl_Text_Display::tail_trim() {
+#if FLTK_ABI_VERSION >= 10304
+  Fl_Text_Buffer *buf = mBuffer;
+  int len = buf->length(), end = 0;
+  int slack = buf->storage() == Fl_Text_Buffer::GAP_BUFFER;
+
+  if (mTailLines) {
+    if (!buf->line_index())
+      buf->line_index(1);
+    int nLines = buf->count_lines(0, len);
+    if (len && buf->byte_at(len - 1) != '\n')
+      nLines++;
+    if (nLines > mTailLines) {
+      int drop = nLines - mTailLines;
+      if (slack)
+        drop += mTailLines / 16;
+      end = buf->skip_lines(0, drop);
+    }
+  }
+  if (mTailBytes && len - end > mTailBytes) {
+    int pos = buf->utf8_align(len - mTailBytes + (slack ? mTailBytes / 16 : 0));
+    if (pos < len - mTailBytes)
+      pos = buf->next_char(pos);
+    /* keep whole lines, unless the last line alone is too long */
+    if (pos > 0 && buf->byte_at(pos - 1) != '\n') {
+      int next = buf->skip_lines(pos, 1);
+      if (next < len)
+        pos = next;
+    }
+    if (pos > end)
+      end = pos;
+  }
+  if (end > 0) {
+    /* Don't copy the dropped text into the undo history. The older
+     changes in the history refer to positions that the removal shifts,
+     so the history is cleared as well. */
+    char canUndo = buf->mCanUndo;
+    buf->canUndo(0);
+    buf->remove(0, end);
+    buf->canUndo(canUndo);
+  }
+  return end;
+#else
+  return 0;
+#endif
+}
+
+
+
 /**
  \brief Scrolls the current buffer to start at the specified line and column.
  \param topLineNum top line number
@@ -3383,6 +3627,7 @@ void Fl_Text_Display::wrapped_line_counter(Fl_Text_Buffer *buf, int startPos,
   double width;
   int nLines = 0;
   unsigned int c;
+  int useCache = maxLines > 1 && buf == mBuffer && styleBufOffset == 0;
 
   /* Set the wrap margin to the wrap column or the view width */
   if (mWrapMarginPix != 0) {
@@ -3406,6 +3651,32 @@ void Fl_Text_Display::wrapped_line_counter(Fl_Text_Buffer *buf, int startPos,
   colNum = 0;
   width = 0;
   for (p=lineStart; p<buf->length(); p=buf->next_char(p)) {
+    /* At the start of a line, skip all following lines that end before
+     maxPos and have fewer rows than requested, as far as the cache knows */
+    if (useCache && p == lineStart && (p == 0 || buf->byte_at(p - 1) == '\n')) {
+      int n = p < maxPos ? buf->count_lines(p, maxPos) : 0;
+      if (n > 0 && wrap_cache(buf, 0)) {
+        int line = buf->count_lines(0, p), maxLine = line + n;
+        int nRows, next = skip_wrapped_lines(line, maxLine, maxLines - nLines, &nRows);
+        if (next > line) {
+          nLines += nRows;
+          p = lineStart = buf->skip_lines(p, next - line);
+          line = next;
+          if (p >= buf->length())
+            break;
+        }
+        /* the newline ending this line may complete the requested rows */
+        if (line < maxLine && nLines + wrapped_rows(line, p) == maxLines) {
+          int e = buf->line_end(p);
+          *retPos = e + 1;
+          *retLines = maxLines;
+          *retLineStart = e + 1;
+          *retLineEnd = e;
+          return;
+        }
+      }
+    }
+
     c = buf->char_at(p);  // UCS-4
 
     /* If the character was a newline, count the line and start over,
@@ -3537,6 +3808,132 @@ double Fl_Text_Display::measure_proportional_character(const char *s, int xPix,
 
 
 
+/**
+ \brief Wrapping calculations.
+
+ Returns the cache of wrapped rows per line if it can be used for counting
+ lines in \p buf, or NULL. The cache is only used for the buffer of this
+ widget, and forgets all rows if the fonts or the wrap margin have changed.
+ It needs the line index of the buffer, which is turned on as needed.
+ The cache needs FLTK_ABI_VERSION 10304 or higher, otherwise this always
+ returns NULL.
+
+ \param buf the text buffer to operate on
+ \param styleBufOffset offset of \p buf into the style buffer
+ \return the cache, or NULL
+ */
+Fl_Text_Wrap_Cache *Fl_Text_Display::wrap_cache(Fl_Text_Buffer *buf, int styleBufOffset) const {
+#if FLTK_ABI_VERSION >= 10304
+  if (!mContinuousWrap || buf != mBuffer || styleBufOffset != 0)
+    return 0;
+  if (!buf->line_index())
+    buf->line_index(1);
+  mWrapCache->layout(textfont(), textsize(),
+                     mWrapMarginPix != 0 ? mWrapMarginPix : text_area.w,
+                     mStyleTable, mNStyles, buf->tab_distance());
+  int nLines = buf->count_lines(0, buf->length()) + 1;
+  if (mWrapCache->lines() != nLines)
+    mWrapCache->reset(nLines);
+  return mWrapCache;
+#else
+  return 0;
+#endif
+}
+
+
+
+/**
+ \brief Wrapping calculations.
+
+ Returns the number of rows that a line ending in a newline takes in
+ continuous wrap mode, measuring it if the wrap cache does not know yet.
+
+ \param line number of the line, starting at 0
+ \param lineStart index of the first character of the line
+ \return number of rows
+ */
+int Fl_Text_Display::wrapped_rows(int line, int lineStart) const {
+#if FLTK_ABI_VERSION >= 10304
+  int nRows = mWrapCache->rows(line);
+#else
+  int nRows = 0;
+#endif
+  if (!nRows) {
+    int retPos, retLines, retLineStart, retLineEnd;
+    wrapped_line_counter(mBuffer, lineStart, mBuffer->line_end(lineStart),
+                         INT_MAX, true, 0, &retPos, &retLines, &retLineStart,
+                         &retLineEnd, false);
+    nRows = retLines + 1;
+#if FLTK_ABI_VERSION >= 10304
+    mWrapCache->rows(line, nRows);
+#endif
+  }
+  return nRows;
+}
+
+
+
+/**
+ \brief Wrapping calculations.
+
+ Skips whole lines, using the sums of the wrap cache where possible,
+ until reaching \p maxLine or a line that would make the number of rows
+ reach \p maxRows.
+
+ \param line number of the first line to skip
+ \param maxLine number of the line to stop at
+ \param maxRows the rows of the skipped lines must be fewer than this
+ \param[out] nRows number of rows of the skipped lines
+ \return number of the first line that was not skipped
+ */
+int Fl_Text_Display::skip_wrapped_lines(int line, int maxLine, int maxRows,
+                                        int *nRows) const {
+#if FLTK_ABI_VERSION >= 10304
+  Fl_Text_Wrap_Cache *cache = mWrapCache;
+  const int BLOCK = Fl_Text_Wrap_Cache::BLOCK;
+  int rows = 0;
+
+  while (line < maxLine) {
+    if (line % BLOCK == 0 && line + BLOCK <= maxLine) {
+      int sum = cache->block_rows(line / BLOCK);
+      if (sum < 0) {
+        /* measure the lines that are not known yet */
+        int pos = -1;
+        for (int i = line; i < line + BLOCK; i++) {
+          if (!cache->rows(i)) {
+            if (pos < 0)
+              pos = mBuffer->skip_lines(0, i);
+            wrapped_rows(i, pos);
+          }
+          if (pos >= 0)
+            pos = mBuffer->line_end(pos) + 1;
+        }
+        sum = cache->block_rows(line / BLOCK);
+      }
+      if (rows + sum < maxRows) {
+        rows += sum;
+        line += BLOCK;
+        continue;
+      }
+    }
+    int n = cache->rows(line);
+    if (!n)
+      n = wrapped_rows(line, mBuffer->skip_lines(0, line));
+    if (rows + n >= maxRows)
+      break;
+    rows += n;
+    line++;
+  }
+  *nRows = rows;
+  return line;
+#else
+  *nRows = 0;
+  return line;
+#endif
+}
+
+
+
 /**
  \brief Finds both the end of the current line and the start of the next line.
 
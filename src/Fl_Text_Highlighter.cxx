@@ -0,0 +1,322 @@
+//
+// "$Id$"
+//
+// Incremental syntax highlighting for the Fast Light Tool Kit (FLTK).
+//
+// Copyright 2001-2016 by Bill Spitzak and others.
+//
+// This library is free software. Distribution and use rights are outlined in
+// the file "COPYING" which should have been included with this file.  If this
+// file is missing or damaged, see the license at:
+//
+//     http://www.fltk.org/COPYING.php
+//
+// Please report all bugs and problems on the following page:
+//
+//     http://www.fltk.org/str.php
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <FL/Fl.H>
+#include <FL/Fl_Text_Highlighter.H>
+
+#define DEFAULT_CHUNK_SIZE (64 * 1024)
+
+
+/**
+ Creates a highlighter that is not attached to a display yet.
+ */
+Fl_Text_Highlighter::Fl_Text_Highlighter()
+{
+  mDisplay = 0;
+  mBuffer = 0;
+  mStyleBuffer = 0;
+  mUnfinishedStyle = 0;
+  mChunkSize = DEFAULT_CHUNK_SIZE;
+  mStates = 0;
+  mNLines = mNAlloc = 0;
+  mDirty = -1;
+  mDirtyEnd = -1;
+  mDamageStart = mDamageEnd = -1;
+}
+
+
+/**
+ Detaches the highlighter from its display and frees the style buffer.
+ */
+Fl_Text_Highlighter::~Fl_Text_Highlighter()
+{
+  detach();
+  free(mStates);
+}
+
+
+/**
+ \brief Starts highlighting the text of a display.
+
+ Creates a style buffer for the text buffer of \p display and installs it
+ with Fl_Text_Display::highlight_data(). All text is unstyled at first;
+ the visible text is styled when it is drawn, and the rest of the text in
+ the background. This turns on the line index of the text buffer.
+
+ \param display the display, which must already have a text buffer
+ \param styleTable the style table, which must stay valid while attached
+ \param nStyles number of entries in \p styleTable
+ */
+void Fl_Text_Highlighter::attach(Fl_Text_Display *display,
+                                 const Fl_Text_Display::Style_Table_Entry *styleTable,
+                                 int nStyles)
+{
+  detach();
+  if (!display || !display->buffer())
+    return;
+
+  mDisplay = display;
+  mBuffer = display->buffer();
+  mUnfinishedStyle = (char) ('A' + nStyles);
+  mBuffer->line_index(1);
+
+  int len = mBuffer->length();
+  char *style = (char *) malloc(len + 1);
+  memset(style, mUnfinishedStyle, len);
+  style[len] = 0;
+  mStyleBuffer = new Fl_Text_Buffer(len);
+  mStyleBuffer->text(style);
+  free(style);
+
+  mNLines = mBuffer->count_lines(0, len) + 1;
+  if (mNLines > mNAlloc) {
+    mNAlloc = mNLines + mNLines / 4;
+    mStates = (int *) realloc(mStates, mNAlloc * sizeof(int));
+  }
+  mStates[0] = 0;
+  for (int i = 1; i < mNLines; i++)
+    mStates[i] = -1;
+  mDirty = 0;
+  mDirtyEnd = mNLines - 1;
+
+  mBuffer->add_modify_callback(buffer_modified_cb, this);
+  display->highlight_data(mStyleBuffer, styleTable, nStyles, mUnfinishedStyle,
+                          unfinished_cb, this);
+  Fl::add_idle(idle_cb, this);
+}
+
+
+/**
+ Stops highlighting and removes the style buffer from the display.
+ */
+void Fl_Text_Highlighter::detach()
+{
+  if (!mDisplay)
+    return;
+  Fl::remove_idle(idle_cb, this);
+  mBuffer->remove_modify_callback(buffer_modified_cb, this);
+  mDisplay->highlight_data(0, 0, 0, 0, 0, 0);
+  delete mStyleBuffer;
+  mDisplay = 0;
+  mBuffer = 0;
+  mStyleBuffer = 0;
+  mNLines = 0;
+  mDirty = mDirtyEnd = -1;
+  mDamageStart = mDamageEnd = -1;
+}
+
+
+/**
+ Restyles all text in the background, for instance after settings of the
+ derived class have changed. The current styles remain visible until
+ they are replaced.
+ */
+void Fl_Text_Highlighter::restyle()
+{
+  if (!mDisplay)
+    return;
+  for (int i = 1; i < mNLines; i++)
+    mStates[i] = -1;
+  mDirty = 0;
+  mDirtyEnd = mNLines - 1;
+  if (!Fl::has_idle(idle_cb, this))
+    Fl::add_idle(idle_cb, this);
+}
+
+
+/**
+ Restyles all text that still needs it right away, without waiting for
+ the idle callback.
+ */
+void Fl_Text_Highlighter::finish()
+{
+  while (run(INT_MAX / 2)) {}
+  Fl::remove_idle(idle_cb, this);
+  redisplay();
+}
+
+
+/*
+ Restyle about nBytes of text, starting at the first dirty line, and
+ stop early when the lexer state converges. Return 1 if there is more
+ work to do.
+ */
+int Fl_Text_Highlighter::run(int nBytes)
+{
+  if (mDirty < 0)
+    return 0;
+
+  Fl_Text_Buffer *buf = mBuffer;
+  int len = buf->length();
+  int line = mDirty;
+  int start = buf->skip_lines(0, line);
+  int end = nBytes < len - start ? start + nBytes : len;
+  if (end < len) {
+    end = buf->line_end(buf->utf8_align(end));
+    if (end < len)
+      end++;
+  }
+
+  int n = end - start;
+  char *text = buf->text_range(start, end);
+  char *oldStyle = mStyleBuffer->text_range(start, end);
+  char *style = (char *) malloc(n + 1);
+  int state = mStates[line] >= 0 ? mStates[line] : 0;
+  int p = 0, done = 0;
+  while (p < n) {
+    const char *nl = (const char *) memchr(text + p, '\n', n - p);
+    int lineLen = nl ? (int) (nl - text) + 1 - p : n - p;
+    state = highlight_line(text + p, lineLen, state, style + p);
+    p += lineLen;
+    line++;
+    if (line >= mNLines || (line > mDirtyEnd && mStates[line] == state)) {
+      done = 1;
+      break;
+    }
+    mStates[line] = state;
+  }
+  if (start + p >= len)
+    done = 1;
+
+  /* only replace the styles that actually changed */
+  int a = 0, b = p;
+  while (a < b && oldStyle[a] == style[a])
+    a++;
+  while (b > a && oldStyle[b - 1] == style[b - 1])
+    b--;
+  if (a < b) {
+    style[b] = 0;
+    mStyleBuffer->replace(start + a, start + b, style + a);
+    if (mDamageStart < 0 || start + a < mDamageStart)
+      mDamageStart = start + a;
+    if (start + b > mDamageEnd)
+      mDamageEnd = start + b;
+  }
+  free(text);
+  free(oldStyle);
+  free(style);
+
+  mDirty = done ? -1 : line;
+  return !done;
+}
+
+
+/*
+ Redraw the text that was restyled since the last call.
+ */
+void Fl_Text_Highlighter::redisplay()
+{
+  if (mDamageStart < 0)
+    return;
+  mDisplay->redisplay_range(mDamageStart, mDamageEnd);
+  mDamageStart = mDamageEnd = -1;
+}
+
+
+void Fl_Text_Highlighter::idle_cb(void *cbArg)
+{
+  Fl_Text_Highlighter *h = (Fl_Text_Highlighter *) cbArg;
+  if (!h->run(h->mChunkSize))
+    Fl::remove_idle(idle_cb, h);
+  h->redisplay();
+}
+
+
+/*
+ Called by the display when it draws text that was not styled yet.
+ Restyle up to the line containing pos right away. The display is
+ drawing now, so text that was restyled before pos is redrawn later,
+ from the idle callback.
+ */
+void Fl_Text_Highlighter::unfinished_cb(int pos, void *cbArg)
+{
+  Fl_Text_Highlighter *h = (Fl_Text_Highlighter *) cbArg;
+  int line = h->mBuffer->count_lines(0, pos);
+  /* all unfinished text is in dirty lines, so this styles pos */
+  while (h->mDirty >= 0 && h->mDirty <= line)
+    h->run(h->mChunkSize);
+  if (!Fl::has_idle(idle_cb, h))
+    Fl::add_idle(idle_cb, h);
+}
+
+
+/*
+ Keep the style buffer and the line states in sync with the text buffer,
+ and mark the edited lines for restyling.
+ */
+void Fl_Text_Highlighter::buffer_modified_cb(int pos, int nInserted, int nDeleted,
+                                             int /*nRestyled*/,
+                                             const char *deletedText,
+                                             void *cbArg)
+{
+  if (nInserted == 0 && nDeleted == 0)
+    return;
+  Fl_Text_Highlighter *h = (Fl_Text_Highlighter *) cbArg;
+  Fl_Text_Buffer *buf = h->mBuffer;
+
+  /* inserted text is unfinished until it is restyled */
+  char *style = (char *) malloc(nInserted + 1);
+  memset(style, h->mUnfinishedStyle, nInserted);
+  style[nInserted] = 0;
+  h->mStyleBuffer->replace(pos, pos + nDeleted, style);
+  free(style);
+
+  int line = buf->count_lines(0, pos);
+  int linesDeleted = 0;
+  for (const char *p = deletedText, *e = deletedText + nDeleted;
+       p < e && (p = (const char *) memchr(p, '\n', e - p)) != 0; p++)
+    linesDeleted++;
+  int linesInserted = nInserted ? buf->count_lines(pos, pos + nInserted) : 0;
+  int delta = linesInserted - linesDeleted;
+
+  /* the state at the start of the edited line remains valid, the states
+   of the following lines are kept to detect when restyling converges */
+  if (delta) {
+    if (h->mNLines + delta > h->mNAlloc) {
+      h->mNAlloc = h->mNLines + delta + (h->mNLines + delta) / 4;
+      h->mStates = (int *) realloc(h->mStates, h->mNAlloc * sizeof(int));
+    }
+    int *s = h->mStates + line + 1;
+    memmove(s + linesInserted, s + linesDeleted,
+            (h->mNLines - line - 1 - linesDeleted) * sizeof(int));
+    h->mNLines += delta;
+  }
+  for (int i = line + 1; i <= line + linesInserted; i++)
+    h->mStates[i] = -1;
+
+  if (h->mDirty < 0) {
+    h->mDirty = line;
+    h->mDirtyEnd = line + linesInserted;
+  } else {
+    if (h->mDirty > line)
+      h->mDirty = line;
+    if (h->mDirtyEnd > line + linesDeleted)
+      h->mDirtyEnd += delta;
+    else if (h->mDirtyEnd < line + linesInserted)
+      h->mDirtyEnd = line + linesInserted;
+  }
+  if (!Fl::has_idle(idle_cb, h))
+    Fl::add_idle(idle_cb, h);
+}
+
+//
+// End of "$Id$".
+//
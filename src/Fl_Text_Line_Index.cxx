@@ -0,0 +1,279 @@
+//
+// "$Id$"
+//
+// Line start index for the Fl_Text_Buffer class.
+//
+// Copyright 2001-2016 by Bill Spitzak and others.
+//
+// This library is free software. Distribution and use rights are outlined in
+// the file "COPYING" which should have been included with this file.  If this
+// file is missing or damaged, see the license at:
+//
+//     http://www.fltk.org/COPYING.php
+//
+// Please report all bugs and problems on the following page:
+//
+//     http://www.fltk.org/str.php
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <FL/Fl_Text_Buffer.H>
+#include "Fl_Text_Line_Index.H"
+
+/*
+ Blocks are created with BLOCK_SIZE bytes and split again as soon as
+ insertions make them grow beyond twice that size. The block size bounds
+ the number of bytes that must be scanned to answer a query.
+ */
+#define BLOCK_SIZE 4096
+
+
+Fl_Text_Line_Index::Fl_Text_Line_Index(const Fl_Text_Buffer *buf)
+{
+  mBuffer = buf;
+  mBlocks = 0;
+  mTreeBytes = 0;
+  mTreeLines = 0;
+  mNBlocks = mNAlloc = mNEmpty = 0;
+  mTopBit = 0;
+  mTotalLines = 0;
+  rebuild();
+}
+
+
+Fl_Text_Line_Index::~Fl_Text_Line_Index()
+{
+  free(mBlocks);
+  free(mTreeBytes);
+  free(mTreeLines);
+}
+
+
+/*
+ Split the entire buffer into blocks of BLOCK_SIZE bytes and count them.
+ */
+void Fl_Text_Line_Index::rebuild()
+{
+  int len = mBuffer->length();
+  mNBlocks = 0;
+  mNEmpty = 0;
+  insert_blocks(0, len / BLOCK_SIZE + 1);
+  mTotalLines = 0;
+  for (int b = 0; b < mNBlocks; b++) {
+    int start = b * BLOCK_SIZE;
+    int end = start + BLOCK_SIZE;
+    if (end > len) end = len;
+    mBlocks[b].bytes = end - start;
+    mBlocks[b].lines = mBuffer->count_lines_(start, end);
+    mTotalLines += mBlocks[b].lines;
+  }
+  if (mBlocks[mNBlocks-1].bytes == 0)
+    mNEmpty = 1;
+  rebuild_tree();
+}
+
+
+/*
+ Make room for count uninitialized blocks at index at.
+ The Fenwick trees are invalid afterwards and must be rebuilt.
+ */
+void Fl_Text_Line_Index::insert_blocks(int at, int count)
+{
+  int n = mNBlocks + count;
+  if (n > mNAlloc) {
+    int na = mNAlloc ? mNAlloc : 64;
+    while (na < n) na *= 2;
+    mBlocks = (Block*)realloc(mBlocks, na * sizeof(Block));
+    mTreeBytes = (int*)realloc(mTreeBytes, (na + 1) * sizeof(int));
+    mTreeLines = (int*)realloc(mTreeLines, (na + 1) * sizeof(int));
+    mNAlloc = na;
+  }
+  memmove(mBlocks + at + count, mBlocks + at, (mNBlocks - at) * sizeof(Block));
+  mNBlocks = n;
+}
+
+
+/*
+ Build both Fenwick trees from the block array in O(n).
+ */
+void Fl_Text_Line_Index::rebuild_tree()
+{
+  int i;
+  for (i = 1; i <= mNBlocks; i++) {
+    mTreeBytes[i] = mBlocks[i-1].bytes;
+    mTreeLines[i] = mBlocks[i-1].lines;
+  }
+  for (i = 1; i <= mNBlocks; i++) {
+    int parent = i + (i & -i);
+    if (parent <= mNBlocks) {
+      mTreeBytes[parent] += mTreeBytes[i];
+      mTreeLines[parent] += mTreeLines[i];
+    }
+  }
+  for (mTopBit = 1; mTopBit * 2 <= mNBlocks; mTopBit *= 2) ;
+}
+
+
+/*
+ Add a byte and line delta to block b (0-based).
+ */
+void Fl_Text_Line_Index::tree_add(int b, int dBytes, int dLines)
+{
+  for (int i = b + 1; i <= mNBlocks; i += i & -i) {
+    mTreeBytes[i] += dBytes;
+    mTreeLines[i] += dLines;
+  }
+}
+
+
+/*
+ Return the index of the block that contains position pos, the position
+ of the first byte of that block, and the number of newlines in all
+ blocks before it. A position at the end of the buffer is reported as
+ part of the last block.
+ */
+int Fl_Text_Line_Index::find_block(int pos, int *blockStart, int *linesBefore) const
+{
+  int idx = 0, bytes = 0, lines = 0;
+  for (int step = mTopBit; step; step >>= 1) {
+    int next = idx + step;
+    if (next <= mNBlocks && bytes + mTreeBytes[next] <= pos) {
+      idx = next;
+      bytes += mTreeBytes[idx];
+      lines += mTreeLines[idx];
+    }
+  }
+  if (idx == mNBlocks) {
+    // pos is at the very end: step back into the last block
+    idx--;
+    bytes -= mBlocks[idx].bytes;
+    lines -= mBlocks[idx].lines;
+  }
+  *blockStart = bytes;
+  *linesBefore = lines;
+  return idx;
+}
+
+
+/*
+ Replace an oversized block by a run of blocks of BLOCK_SIZE bytes.
+ */
+void Fl_Text_Line_Index::split_block(int b, int blockStart)
+{
+  int bytes = mBlocks[b].bytes;
+  int n = (bytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  insert_blocks(b + 1, n - 1);
+  for (int i = 0; i < n; i++) {
+    int start = blockStart + i * BLOCK_SIZE;
+    int end = start + BLOCK_SIZE;
+    if (end > blockStart + bytes) end = blockStart + bytes;
+    mBlocks[b+i].bytes = end - start;
+    mBlocks[b+i].lines = mBuffer->count_lines_(start, end);
+  }
+  rebuild_tree();
+}
+
+
+/*
+ Drop all empty blocks. Called when deletions left too many of them.
+ */
+void Fl_Text_Line_Index::compact()
+{
+  int j = 0;
+  for (int i = 0; i < mNBlocks; i++) {
+    if (mBlocks[i].bytes > 0)
+      mBlocks[j++] = mBlocks[i];
+  }
+  if (j == 0) {
+    mBlocks[0].bytes = mBlocks[0].lines = 0;
+    j = 1;
+  }
+  mNBlocks = j;
+  mNEmpty = (mBlocks[0].bytes == 0);
+  rebuild_tree();
+}
+
+
+void Fl_Text_Line_Index::inserted(int pos, int nInserted, int nLines)
+{
+  if (nInserted <= 0)
+    return;
+  int blockStart, linesBefore;
+  int b = find_block(pos, &blockStart, &linesBefore);
+  if (mBlocks[b].bytes == 0)
+    mNEmpty--;
+  mBlocks[b].bytes += nInserted;
+  mBlocks[b].lines += nLines;
+  mTotalLines += nLines;
+  if (mBlocks[b].bytes > 2 * BLOCK_SIZE)
+    split_block(b, blockStart);
+  else
+    tree_add(b, nInserted, nLines);
+}
+
+
+void Fl_Text_Line_Index::remove(int start, int end)
+{
+  if (end <= start)
+    return;
+  int blockStart, linesBefore;
+  int b = find_block(start, &blockStart, &linesBefore);
+  int removedLines = 0;
+  // Large deletions touch many blocks; rebuilding the trees once is
+  // cheaper than updating them block by block.
+  bool bulk = (end - start) > 8 * BLOCK_SIZE;
+  while (start < end && b < mNBlocks) {
+    int blockEnd = blockStart + mBlocks[b].bytes;
+    int e = end < blockEnd ? end : blockEnd;
+    if (e > start) {
+      int dBytes = e - start;
+      int dLines = mBuffer->count_lines_(start, e);
+      mBlocks[b].bytes -= dBytes;
+      mBlocks[b].lines -= dLines;
+      removedLines += dLines;
+      if (mBlocks[b].bytes == 0)
+        mNEmpty++;
+      if (!bulk)
+        tree_add(b, -dBytes, -dLines);
+      start = e;
+    }
+    blockStart = blockEnd;
+    b++;
+  }
+  mTotalLines -= removedLines;
+  if (mNEmpty > 16 && mNEmpty > mNBlocks / 2)
+    compact();
+  else if (bulk)
+    rebuild_tree();
+}
+
+
+int Fl_Text_Line_Index::lines_before(int pos) const
+{
+  int blockStart, linesBefore;
+  find_block(pos, &blockStart, &linesBefore);
+  return linesBefore + mBuffer->count_lines_(blockStart, pos);
+}
+
+
+int Fl_Text_Line_Index::newline_position(int n) const
+{
+  if (n <= 0 || n > mTotalLines)
+    return -1;
+  int idx = 0, bytes = 0, lines = 0;
+  for (int step = mTopBit; step; step >>= 1) {
+    int next = idx + step;
+    if (next <= mNBlocks && lines + mTreeLines[next] < n) {
+      idx = next;
+      bytes += mTreeBytes[idx];
+      lines += mTreeLines[idx];
+    }
+  }
+  // the n-th newline is the (n-lines)-th newline of block idx
+  return mBuffer->skip_lines_(bytes, n - lines) - 1;
+}
+
+//
+// End of "$Id$".
+//
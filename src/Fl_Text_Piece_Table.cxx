@@ -0,0 +1,567 @@
+//
+// "$Id$"
+//
+// Piece table text storage for the Fl_Text_Buffer class.
+//
+// Copyright 2001-2016 by Bill Spitzak and others.
+//
+// This library is free software. Distribution and use rights are outlined in
+// the file "COPYING" which should have been included with this file.  If this
+// file is missing or damaged, see the license at:
+//
+//     http://www.fltk.org/COPYING.php
+//
+// Please report all bugs and problems on the following page:
+//
+//     http://www.fltk.org/str.php
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <FL/fl_utf8.h>
+#include "Fl_Text_Piece_Table.H"
+
+#if !defined(WIN32) || defined(__CYGWIN__)
+#  include <sys/types.h>
+#  include <sys/stat.h>
+#  include <sys/mman.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#  define USE_MMAP 1
+#else
+#  define USE_MMAP 0
+#endif
+
+/*
+ Small insertions are collected in chunks of CHUNK_SIZE bytes, so that
+ text typed at one place ends up in a single growing piece. Larger blocks
+ of text get a chunk of their own.
+ */
+#define CHUNK_SIZE 65536
+
+/*
+ Mapped files are checked for valid UTF-8 in blocks of CHECK_BLOCK bytes
+ when they are accessed for the first time.
+ */
+#define CHECK_BLOCK 65536
+
+/* returned for positions at the end of the text */
+static char empty_text[1] = { 0 };
+
+
+Fl_Text_Piece_Table::Fl_Text_Piece_Table()
+{
+  mRoot = 0;
+  mChunks = 0;
+  mCurrent = 0;
+  mMapped = 0;
+  mMappedDev = mMappedIno = 0;
+  mNPieces = 0;
+  mSeed = 2463534242U;
+  mCache = 0;
+  mCacheStart = 0;
+}
+
+
+Fl_Text_Piece_Table::~Fl_Text_Piece_Table()
+{
+  clear();
+}
+
+
+void Fl_Text_Piece_Table::clear()
+{
+  free_tree(mRoot);
+  mRoot = 0;
+  mCache = 0;
+  while (mChunks) {
+    Chunk *next = mChunks->next;
+    free(mChunks);
+    mChunks = next;
+  }
+  mCurrent = 0;
+  release_mapping();
+}
+
+
+char *Fl_Text_Piece_Table::reserve(int len)
+{
+  Chunk *c = mCurrent;
+  if (!c || c->size - c->used < len) {
+    int size = len > CHUNK_SIZE / 2 ? len : CHUNK_SIZE;
+    c = (Chunk*)malloc(sizeof(Chunk) + size);
+    c->size = size;
+    c->used = 0;
+    c->data = (char*)(c + 1);
+    c->checked = 0;
+    c->copies = 0;
+    c->next = mChunks;
+    mChunks = c;
+    // a chunk that was made for a single large block is full already
+    if (size == CHUNK_SIZE)
+      mCurrent = c;
+  }
+  char *p = c->data + c->used;
+  c->used += len;
+  return p;
+}
+
+
+Fl_Text_Piece_Table::Piece *Fl_Text_Piece_Table::new_piece(char *text, int length)
+{
+  Piece *n = new Piece;
+  n->text = text;
+  n->length = n->total = length;
+  // xorshift32, good enough to keep the tree balanced
+  mSeed ^= mSeed << 13;
+  mSeed ^= mSeed >> 17;
+  mSeed ^= mSeed << 5;
+  n->priority = mSeed;
+  n->left = n->right = 0;
+  mNPieces++;
+  return n;
+}
+
+
+void Fl_Text_Piece_Table::free_tree(Piece *t)
+{
+  if (!t)
+    return;
+  free_tree(t->left);
+  free_tree(t->right);
+  delete t;
+  mNPieces--;
+}
+
+
+/* subtree size of t, and recalculation of it from the children of t */
+#define TOTAL(t) ((t) ? (t)->total : 0)
+#define UPDATE(t) ((t)->total = (t)->length + TOTAL((t)->left) + TOTAL((t)->right))
+
+
+/*
+ Split the tree t into the pieces before pos (*l) and the pieces from pos
+ on (*r). A piece that straddles pos is cut in two.
+ */
+void Fl_Text_Piece_Table::split(Piece *t, int pos, Piece **l, Piece **r)
+{
+  if (!t) {
+    *l = *r = 0;
+    return;
+  }
+  int lt = TOTAL(t->left);
+  if (pos <= lt) {
+    split(t->left, pos, l, &t->left);
+    UPDATE(t);
+    *r = t;
+  } else if (pos >= lt + t->length) {
+    split(t->right, pos - lt - t->length, &t->right, r);
+    UPDATE(t);
+    *l = t;
+  } else {
+    int k = pos - lt;
+    Piece *tail = new_piece(t->text + k, t->length - k);
+    t->length = k;
+    *r = merge(tail, t->right);
+    t->right = 0;
+    UPDATE(t);
+    *l = t;
+  }
+}
+
+
+/*
+ Concatenate two trees. All pieces of l come before all pieces of r.
+ */
+Fl_Text_Piece_Table::Piece *Fl_Text_Piece_Table::merge(Piece *l, Piece *r)
+{
+  if (!l) return r;
+  if (!r) return l;
+  if (l->priority > r->priority) {
+    l->right = merge(l->right, r);
+    UPDATE(l);
+    return l;
+  }
+  r->left = merge(l, r->left);
+  UPDATE(r);
+  return r;
+}
+
+
+/*
+ Return the piece containing position pos and the offset of pos within
+ it, or NULL if pos is outside of the text. Sequential accesses are
+ answered from the cache without walking the tree.
+ */
+Fl_Text_Piece_Table::Piece *Fl_Text_Piece_Table::find(int pos, int *offset) const
+{
+  if (mCache && pos >= mCacheStart && pos < mCacheStart + mCache->length) {
+    *offset = pos - mCacheStart;
+    return mCache;
+  }
+  if (pos < 0 || pos >= length())
+    return 0;
+  Piece *t = mRoot;
+  int start = 0;
+  for (;;) {
+    int lt = TOTAL(t->left);
+    if (pos < start + lt) {
+      t = t->left;
+    } else if (pos < start + lt + t->length) {
+      start += lt;
+      break;
+    } else {
+      start += lt + t->length;
+      t = t->right;
+    }
+  }
+  mCache = t;
+  mCacheStart = start;
+  *offset = pos - start;
+  return t;
+}
+
+
+/*
+ Add delta bytes to the piece containing pos and to all its ancestors.
+ */
+void Fl_Text_Piece_Table::grow(int pos, int delta)
+{
+  Piece *t = mRoot;
+  while (t) {
+    int lt = TOTAL(t->left);
+    t->total += delta;
+    if (pos < lt) {
+      t = t->left;
+    } else if (pos < lt + t->length) {
+      t->length += delta;
+      return;
+    } else {
+      pos -= lt + t->length;
+      t = t->right;
+    }
+  }
+}
+
+
+void Fl_Text_Piece_Table::insert(int pos, char *text, int len)
+{
+  if (len <= 0)
+    return;
+  mCache = 0;
+  // Typing appends to the chunk right behind the previous keystroke.
+  // In that case the piece before pos simply grows.
+  if (pos > 0) {
+    int offset;
+    Piece *t = find(pos - 1, &offset);
+    mCache = 0;
+    if (t && offset == t->length - 1 && t->text + t->length == text) {
+      grow(pos - 1, len);
+      return;
+    }
+  }
+  Piece *l, *r;
+  split(mRoot, pos, &l, &r);
+  mRoot = merge(merge(l, new_piece(text, len)), r);
+}
+
+
+void Fl_Text_Piece_Table::remove(int start, int end)
+{
+  if (end <= start)
+    return;
+  mCache = 0;
+  Piece *l, *m, *r;
+  split(mRoot, start, &l, &m);
+  split(m, end - start, &m, &r);
+  free_tree(m);
+  mRoot = merge(l, r);
+}
+
+
+int Fl_Text_Piece_Table::segment(int pos, const char **p, int raw) const
+{
+  int offset;
+  Piece *t = find(pos, &offset);
+  if (!t) {
+    *p = empty_text;
+    return 0;
+  }
+  *p = t->text + offset;
+  int n = t->length - offset;
+  if (!raw && mapped(t)) {
+    int m = check(*p);
+    if (m < n) n = m;
+    *p = fixed(*p);
+  }
+  return n;
+}
+
+
+int Fl_Text_Piece_Table::segment_before(int pos, const char **p, int raw) const
+{
+  int offset;
+  Piece *t = pos > 0 ? find(pos - 1, &offset) : 0;
+  if (!t) {
+    *p = empty_text;
+    return 0;
+  }
+  *p = t->text;
+  if (!raw && mapped(t)) {
+    const char *last = t->text + offset;
+    check(last);
+    const char *block = mMapped->data + (last - mMapped->data) / CHECK_BLOCK * CHECK_BLOCK;
+    if (*p < block) {
+      offset -= (int)(block - *p);
+      *p = block;
+    }
+    *p = fixed(*p);
+  }
+  return offset + 1;
+}
+
+
+char *Fl_Text_Piece_Table::address(int pos) const
+{
+  int offset;
+  Piece *t = find(pos, &offset);
+  if (!t)
+    return empty_text;
+  if (mapped(t)) {
+    check(t->text + offset);
+    return fixed(t->text + offset);
+  }
+  return t->text + offset;
+}
+
+
+/*
+ Return the length of the UTF-8 sequence at p if it is valid, 0 if not.
+ This is the same test that Fl_Text_Buffer::insertfile() applies.
+ */
+static int utf8_valid(const char *p, const char *end)
+{
+  if (!(*p & 0x80))
+    return 1;
+  int l = fl_utf8len1(*p);
+  if (l < 2 || p + l > end)
+    return 0;
+  int lp;
+  char buf[5];
+  unsigned u = fl_utf8decode(p, p + l, &lp);
+  if (lp != l || fl_utf8encode(u, buf) != l)
+    return 0;
+  return l;
+}
+
+
+/*
+ Make sure that the block of the mapped file that contains p was checked,
+ and return the number of bytes from p to the end of that block.
+ */
+int Fl_Text_Piece_Table::check(const char *p) const
+{
+  int b = (int)((p - mMapped->data) / CHECK_BLOCK);
+  if (!mMapped->checked[b])
+    check_block(b);
+  int end = (b + 1) * CHECK_BLOCK;
+  if (end > mMapped->size)
+    end = mMapped->size;
+  return end - (int)(p - mMapped->data);
+}
+
+
+/*
+ Return the address of the byte p of the mapped file after its block was
+ checked. This is p itself unless the block had to be fixed in a copy.
+ */
+char *Fl_Text_Piece_Table::fixed(const char *p) const
+{
+  int b = (int)((p - mMapped->data) / CHECK_BLOCK);
+  if (mMapped->copies && mMapped->copies[b])
+    return mMapped->copies[b] + (p - mMapped->data - b * CHECK_BLOCK);
+  return (char*)p;
+}
+
+
+/*
+ Replace every byte in block b of the mapped file that is not part of a
+ valid UTF-8 sequence by '?'. A character that starts in the previous
+ block belongs to that block, and one that starts in this block is
+ checked completely, even if it extends into the next block.
+
+ If a page of the mapping can not be made writable, the block is copied
+ to the heap and fixed there; fixed() then returns addresses in the copy.
+ The copy includes the first bytes of the next block, so that the last
+ character of the block is stored contiguously. The block is marked as
+ checked only when all of it was fixed.
+ */
+void Fl_Text_Piece_Table::check_block(int b) const
+{
+  Chunk *c = mMapped;
+  char *data = c->data, *last = data + c->size;
+  char *start = data + b * CHECK_BLOCK, *p = start;
+  char *end = p + CHECK_BLOCK;
+  if (end > last) end = last;
+  for (char *q = p - 1; q >= data && q >= p - 3; q--) {
+    if ((*q & 0xc0) != 0x80) {
+      int l = utf8_valid(q, last);
+      if (q + l > p) p = q + l;
+      break;
+    }
+  }
+  char *writable = 0, *copy = 0;
+  while (p < end) {
+    // skip plain ASCII quickly
+    while (p + 8 <= end && !((p[0]|p[1]|p[2]|p[3]|p[4]|p[5]|p[6]|p[7]) & 0x80))
+      p += 8;
+    if (p >= end)
+      break;
+    int l = utf8_valid(p, last);
+    if (l) {
+      p += l;
+      continue;
+    }
+#if USE_MMAP
+    // the mapping is read-only, let the kernel copy the page on write
+    if (!copy && p >= writable) {
+      long pagesize = sysconf(_SC_PAGESIZE);
+      char *page = data + (p - data) / pagesize * pagesize;
+      if (!mprotect(page, pagesize, PROT_READ | PROT_WRITE)) {
+        writable = page + pagesize;
+      } else {
+        int n = (int)(last - start);
+        if (n > CHECK_BLOCK + 3)
+          n = CHECK_BLOCK + 3;
+        if (!c->copies)
+          c->copies = (char**)calloc((c->size + CHECK_BLOCK - 1) / CHECK_BLOCK,
+                                     sizeof(char*));
+        copy = c->copies[b] = (char*)malloc(n);
+        memcpy(copy, start, n);
+      }
+    }
+#endif
+    if (copy)
+      copy[p - start] = '?';
+    else
+      *p = '?';
+    p++;
+  }
+  c->checked[b] = 1;
+}
+
+
+int Fl_Text_Piece_Table::map(const char *file)
+{
+#if USE_MMAP
+  int fd = fl_open(file, O_RDONLY);
+  if (fd < 0)
+    return 1;
+  struct stat st;
+  if (fstat(fd, &st) || st.st_size > 0x7fffffff) {
+    close(fd);
+    return 2;
+  }
+  int size = (int)st.st_size;
+  char *data = 0;
+  if (size > 0) {
+    // MAP_PRIVATE: pages that check_block() modifies are private copies
+    data = (char*)mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == (char*)MAP_FAILED) {
+      close(fd);
+      return 2;
+    }
+  }
+  close(fd);
+  clear();
+  if (size > 0) {
+    int nBlocks = (size + CHECK_BLOCK - 1) / CHECK_BLOCK;
+    mMapped = (Chunk*)malloc(sizeof(Chunk));
+    mMapped->next = 0;
+    mMapped->size = mMapped->used = size;
+    mMapped->data = data;
+    mMapped->checked = (unsigned char*)calloc(nBlocks, 1);
+    mMapped->copies = 0;
+    mMappedDev = (unsigned long)st.st_dev;
+    mMappedIno = (unsigned long)st.st_ino;
+    mRoot = new_piece(data, size);
+  }
+  return 0;
+#else
+  (void)file;
+  return 2;
+#endif
+}
+
+
+int Fl_Text_Piece_Table::is_mapped(const char *file) const
+{
+#if USE_MMAP
+  struct stat st;
+  return mMapped && !fl_stat(file, &st) &&
+         (unsigned long)st.st_dev == mMappedDev &&
+         (unsigned long)st.st_ino == mMappedIno;
+#else
+  (void)file;
+  return 0;
+#endif
+}
+
+
+/*
+ Move the text of all pieces in t that refer to the mapped file into
+ memory of our own.
+ */
+void Fl_Text_Piece_Table::copy_mapped(Piece *t)
+{
+  if (!t)
+    return;
+  copy_mapped(t->left);
+  if (mapped(t)) {
+    // copy the checked text block by block
+    char *s = reserve(t->length), *d = s;
+    for (const char *p = t->text, *e = t->text + t->length; p < e; ) {
+      int n = check(p);
+      if (n > e - p)
+        n = (int)(e - p);
+      memcpy(d, fixed(p), n);
+      d += n;
+      p += n;
+    }
+    t->text = s;
+  }
+  copy_mapped(t->right);
+}
+
+
+void Fl_Text_Piece_Table::unmap()
+{
+  if (!mMapped)
+    return;
+  copy_mapped(mRoot);
+  mCache = 0;
+  release_mapping();
+}
+
+
+void Fl_Text_Piece_Table::release_mapping()
+{
+  if (!mMapped)
+    return;
+#if USE_MMAP
+  munmap(mMapped->data, mMapped->size);
+#endif
+  if (mMapped->copies) {
+    int nBlocks = (mMapped->size + CHECK_BLOCK - 1) / CHECK_BLOCK;
+    for (int b = 0; b < nBlocks; b++)
+      free(mMapped->copies[b]);
+    free(mMapped->copies);
+  }
+  free(mMapped->checked);
+  free(mMapped);
+  mMapped = 0;
+}
+
+//
+// End of "$Id$".
+//
@@ -0,0 +1,898 @@
+//
+// "$Id$"
+//
+// Fast string and regular expression search for Fl_Text_Buffer.
+//
+// Copyright 2001-2016 by Bill Spitzak and others.
+//
+// This library is free software. Distribution and use rights are outlined in
+// the file "COPYING" which should have been included with this file.  If this
+// file is missing or damaged, see the license at:
+//
+//     http://www.fltk.org/COPYING.php
+//
+// Please report all bugs and problems on the following page:
+//
+//     http://www.fltk.org/str.php
+//
+
+#include <stdlib.h>
+#include <ctype.h>
+#include <FL/fl_utf8.h>
+#include "flstring.h"
+#include <FL/Fl_Text_Buffer.H>
+#include <FL/Fl_Text_Search.H>
+
+/*
+ Plain strings are searched with the Boyer-Moore-Horspool algorithm on
+ the raw UTF-8 bytes. The skip tables are built over folded bytes: without
+ MATCH_CASE, ASCII letters fold to lower case and all non-ASCII bytes fold
+ to 0x80. Every real match then also matches byte by byte after folding,
+ so the shifts never skip a match, and each candidate is verified with a
+ full comparison.
+
+ Regular expressions are parsed into a tree and compiled into a program
+ for a Pike virtual machine, which runs all possible matches in parallel
+ one character at a time. Its run time is linear in the length of the text.
+ */
+
+/* Parse tree node types */
+enum {
+  N_EMPTY, N_CHAR, N_ANY, N_CLASS, N_BOL, N_EOL, N_WORDB, N_NWORDB,
+  N_CAT, N_ALT, N_STAR, N_PLUS, N_QUEST
+};
+
+/* Program instructions */
+enum {
+  I_CHAR, I_ANY, I_CLASS, I_BOL, I_EOL, I_WORDB, I_NWORDB,
+  I_SPLIT, I_JMP, I_MATCH
+};
+
+struct Fl_Text_Search::Node {
+  int type;
+  unsigned c;           // character or class index
+  Node *left, *right;
+};
+
+struct Fl_Text_Search::Inst {
+  int op;
+  unsigned c;           // character or class index
+  int x, y;             // jump targets
+};
+
+struct Fl_Text_Search::Class {
+  int negate;
+  int nRanges;
+  unsigned *ranges;     // pairs of first and last character
+};
+
+/* Nesting limit for groups, protects the stack from silly patterns */
+#define MAX_DEPTH 200
+
+static int is_word(unsigned c)
+{
+  return c < 128 && (isalnum(c) || c == '_');
+}
+
+
+/**
+ Creates a search pattern.
+ \param pattern UTF-8 encoded search string or regular expression
+ \param flags MATCH_CASE and/or REGEX
+ \see pattern(const char*, int)
+ */
+Fl_Text_Search::Fl_Text_Search(const char *pattern, int flags)
+{
+  mFlags = 0;
+  mError = 0;
+  mNeedle = 0;
+  mLength = 0;
+  mProg = 0;
+  mNProg = 0;
+  mClasses = 0;
+  mNClasses = 0;
+  mNodes = 0;
+  mNNodes = mNAllocNodes = 0;
+  Fl_Text_Search::pattern(pattern, flags);
+}
+
+
+Fl_Text_Search::~Fl_Text_Search()
+{
+  clear();
+}
+
+
+void Fl_Text_Search::clear()
+{
+  free(mNeedle);
+  mNeedle = 0;
+  mLength = 0;
+  free(mProg);
+  mProg = 0;
+  mNProg = 0;
+  for (int i = 0; i < mNClasses; i++)
+    free(mClasses[i].ranges);
+  free(mClasses);
+  mClasses = 0;
+  mNClasses = 0;
+  mError = 0;
+}
+
+
+/**
+ Sets and prepares a new search pattern.
+
+ Plain strings are prepared in O(n) time. Regular expressions are
+ compiled; if the expression contains a syntax error, error() describes
+ it and all searches fail until a valid pattern is set.
+
+ \param pattern UTF-8 encoded search string or regular expression,
+    NULL is the same as an empty string
+ \param flags MATCH_CASE to distinguish upper and lower case, REGEX if
+    \p pattern is a regular expression
+ \return 0 on success, -1 if the regular expression is invalid
+ */
+int Fl_Text_Search::pattern(const char *pattern, int flags)
+{
+  clear();
+  mFlags = flags;
+  if (!pattern)
+    pattern = "";
+
+  if (!(flags & REGEX)) {
+    int i, m = (int) strlen(pattern);
+    mNeedle = strdup(pattern);
+    mLength = m;
+    for (i = 0; i < 256; i++) {
+      if (flags & MATCH_CASE)
+        mFold[i] = (unsigned char)i;
+      else if (i >= 0x80)
+        mFold[i] = 0x80;
+      else
+        mFold[i] = (unsigned char)tolower(i);
+    }
+    const unsigned char *n = (const unsigned char *)mNeedle;
+    for (i = 0; i < 256; i++)
+      mSkip[i] = mSkipBack[i] = m ? m : 1;
+    for (i = 0; i < m - 1; i++)
+      mSkip[mFold[n[i]]] = m - 1 - i;
+    for (i = m - 1; i > 0; i--)
+      mSkipBack[mFold[n[i]]] = i;
+    return 0;
+  }
+
+  // Every character of the pattern creates at most four tree nodes
+  mNAllocNodes = 4 * (int) strlen(pattern) + 4;
+  mNodes = (Node *) malloc(mNAllocNodes * sizeof(Node));
+  mNNodes = 0;
+  const char *p = pattern;
+  Node *tree = parse_alt(p, 0);
+  if (!mError && *p)
+    mError = "unmatched )";
+  if (!mError) {
+    mNProg = count(tree) + 1;
+    mProg = (Inst *) malloc(mNProg * sizeof(Inst));
+    int pc = emit(tree, 0);
+    mProg[pc].op = I_MATCH;
+  }
+  free(mNodes);
+  mNodes = 0;
+  if (mError) {
+    const char *e = mError;
+    clear();
+    mError = e;
+    return -1;
+  }
+  return 0;
+}
+
+
+/*
+ Compare the window w of mLength bytes against the search string.
+ */
+int Fl_Text_Search::verify(const unsigned char *w) const
+{
+  const unsigned char *n = (const unsigned char *)mNeedle;
+  int m = mLength;
+  if (mFlags & MATCH_CASE)
+    return memcmp(w, n, m) == 0;
+  for (int i = 0; i < m; ) {
+    unsigned char a = w[i], b = n[i];
+    if (a < 0x80 && b < 0x80) {
+      if (mFold[a] != mFold[b])
+        return 0;
+      i++;
+      continue;
+    }
+    if (a < 0x80 || b < 0x80)
+      return 0;
+    int la, lb;
+    unsigned ca = fl_utf8decode((const char *)w + i, (const char *)w + m, &la);
+    unsigned cb = fl_utf8decode((const char *)n + i, (const char *)n + m, &lb);
+    if (la != lb || fl_tolower(ca) != fl_tolower(cb))
+      return 0;
+    i += la;
+  }
+  return 1;
+}
+
+
+/*
+ Find the first occurrence of the search string that starts at or after
+ pos and ends at or before end.
+ */
+int Fl_Text_Search::literal_forward(const Fl_Text_Buffer *buf, int pos, int end,
+                                    int *found) const
+{
+  int m = mLength;
+  unsigned char last = mFold[(unsigned char)mNeedle[m - 1]];
+  unsigned char small[256], *tmp = m <= 256 ? small : 0;
+
+  while (pos + m <= end) {
+    const char *seg;
+    int n = buf->segment_(pos, &seg);
+    if (n >= m) {
+      // all windows that start at s..e lie inside this segment
+      const unsigned char *s = (const unsigned char *)seg;
+      const unsigned char *e = s + (end - pos < n ? end - pos : n) - m;
+      while (s <= e) {
+        unsigned char c = mFold[s[m - 1]];
+        if (c == last && verify(s)) {
+          *found = pos + (int)(s - (const unsigned char *)seg);
+          if (tmp != small) free(tmp);
+          return 1;
+        }
+        s += mSkip[c];
+      }
+      pos += (int)(s - (const unsigned char *)seg);
+      continue;
+    }
+    // the window crosses a segment boundary, look at a copy
+    if (!tmp)
+      tmp = (unsigned char *) malloc(m);
+    buf->copy_range_(pos, pos + m, (char *)tmp);
+    unsigned char c = mFold[tmp[m - 1]];
+    if (c == last && verify(tmp)) {
+      *found = pos;
+      if (tmp != small) free(tmp);
+      return 1;
+    }
+    pos += mSkip[c];
+  }
+  if (tmp != small) free(tmp);
+  return 0;
+}
+
+
+/*
+ Find the last occurrence of the search string that starts at or before pos.
+ */
+int Fl_Text_Search::literal_backward(const Fl_Text_Buffer *buf, int pos,
+                                     int *found) const
+{
+  int m = mLength;
+  unsigned char first = mFold[(unsigned char)mNeedle[0]];
+  unsigned char small[256], *tmp = m <= 256 ? small : 0;
+
+  if (pos > buf->length() - m)
+    pos = buf->length() - m;
+  while (pos >= 0) {
+    const char *seg;
+    int n = buf->segment_before_(pos + m, &seg);
+    if (n >= m) {
+      // all windows that start at b..s lie inside this segment
+      const unsigned char *b = (const unsigned char *)seg;
+      const unsigned char *s = b + n - m;
+      while (s >= b) {
+        unsigned char c = mFold[*s];
+        if (c == first && verify(s)) {
+          *found = pos - (int)(b + n - m - s);
+          if (tmp != small) free(tmp);
+          return 1;
+        }
+        s -= mSkipBack[c];
+      }
+      pos -= (int)(b + n - m - s);
+      continue;
+    }
+    if (!tmp)
+      tmp = (unsigned char *) malloc(m);
+    buf->copy_range_(pos, pos + m, (char *)tmp);
+    unsigned char c = mFold[tmp[0]];
+    if (c == first && verify(tmp)) {
+      *found = pos;
+      if (tmp != small) free(tmp);
+      return 1;
+    }
+    pos -= mSkipBack[c];
+  }
+  if (tmp != small) free(tmp);
+  return 0;
+}
+
+
+/**
+ Finds the first match that starts at or after \p startPos.
+ \param buf the buffer to search
+ \param startPos byte offset where the search starts
+ \param[out] foundPos byte offset of the match
+ \param[out] foundEnd byte offset after the match, may be NULL
+ \return 1 if found, 0 if not
+ */
+int Fl_Text_Search::find_forward(const Fl_Text_Buffer *buf, int startPos,
+                                 int *foundPos, int *foundEnd) const
+{
+  int end, len = buf->length();
+  if (startPos < 0)
+    startPos = 0;
+  if (mFlags & REGEX) {
+    if (!mProg || startPos > len ||
+        !regex_forward(buf, startPos, len, len, foundPos, &end))
+      return 0;
+  } else if (mLength == 0) {
+    if (startPos >= len)
+      return 0;
+    *foundPos = end = startPos;
+  } else {
+    if (!literal_forward(buf, startPos, len, foundPos))
+      return 0;
+    end = *foundPos + mLength;
+  }
+  if (foundEnd)
+    *foundEnd = end;
+  return 1;
+}
+
+
+/**
+ Finds the last match that starts at or before \p startPos.
+
+ Plain strings are searched backwards from \p startPos. Regular
+ expressions are matched forward from the start of the line that contains
+ \p startPos, and of the lines before it if needed, and the last match
+ that starts at or before \p startPos is returned.
+ \param buf the buffer to search
+ \param startPos byte offset where the search starts
+ \param[out] foundPos byte offset of the match
+ \param[out] foundEnd byte offset after the match, may be NULL
+ \return 1 if found, 0 if not
+ */
+int Fl_Text_Search::find_backward(const Fl_Text_Buffer *buf, int startPos,
+                                  int *foundPos, int *foundEnd) const
+{
+  int end, len = buf->length();
+  if (startPos < 0)
+    return 0;
+  if (mFlags & REGEX) {
+    if (!mProg)
+      return 0;
+    if (startPos > len)
+      startPos = len;
+    int lineStart = buf->line_start(startPos);
+    for (;;) {
+      int pos = lineStart, s, e, found = 0;
+      while (pos <= startPos && regex_forward(buf, pos, startPos, len, &s, &e)) {
+        *foundPos = s;
+        end = e;
+        found = 1;
+        pos = e > s ? e : buf->next_char(s);
+        if (s >= len)
+          break;
+      }
+      if (found)
+        break;
+      if (lineStart == 0)
+        return 0;
+      startPos = lineStart - 1;
+      lineStart = buf->line_start(startPos);
+    }
+  } else if (mLength == 0) {
+    *foundPos = end = startPos;
+  } else {
+    if (!literal_backward(buf, startPos, foundPos))
+      return 0;
+    end = *foundPos + mLength;
+  }
+  if (foundEnd)
+    *foundEnd = end;
+  return 1;
+}
+
+
+/**
+ Finds all non-overlapping matches between \p start and \p end in one pass.
+
+ This is much faster than calling find_forward() repeatedly, in particular
+ for regular expressions. The callback is called for every match in
+ ascending order. It must not modify the buffer.
+ \param buf the buffer to search
+ \param start, end range of the buffer to search, matches must lie
+    completely inside it
+ \param cb function called for every match, or NULL to just count them
+ \param data user data passed to \p cb
+ \return number of matches
+ */
+int Fl_Text_Search::find_all(const Fl_Text_Buffer *buf, int start, int end,
+                             Fl_Text_Match_Cb cb, void *data) const
+{
+  int len = buf->length(), n = 0, s, e;
+  if (start < 0)
+    start = 0;
+  if (end > len)
+    end = len;
+  if (mFlags & REGEX) {
+    if (!mProg)
+      return 0;
+    while (start <= end && regex_forward(buf, start, end, end, &s, &e)) {
+      if (cb) cb(s, e - s, data);
+      n++;
+      if (e > s)
+        start = e;
+      else if (s < end)
+        start = buf->next_char(s);
+      else
+        break;
+    }
+  } else if (mLength > 0) {
+    while (literal_forward(buf, start, end, &s)) {
+      if (cb) cb(s, mLength, data);
+      n++;
+      start = s + mLength;
+    }
+  }
+  return n;
+}
+
+
+//
+// Regular expression parser
+//
+
+Fl_Text_Search::Node *Fl_Text_Search::new_node(int type, Node *left, Node *right)
+{
+  Node *n = mNodes + mNNodes++;
+  n->type = type;
+  n->c = 0;
+  n->left = left;
+  n->right = right;
+  return n;
+}
+
+
+Fl_Text_Search::Node *Fl_Text_Search::parse_alt(const char *&p, int depth)
+{
+  Node *l = parse_concat(p, depth);
+  while (!mError && *p == '|') {
+    p++;
+    Node *r = parse_concat(p, depth);
+    l = new_node(N_ALT, l, r);
+  }
+  return l;
+}
+
+
+Fl_Text_Search::Node *Fl_Text_Search::parse_concat(const char *&p, int depth)
+{
+  Node *l = 0;
+  while (!mError && *p && *p != '|' && *p != ')') {
+    Node *r = parse_repeat(p, depth);
+    l = l ? new_node(N_CAT, l, r) : r;
+  }
+  return l ? l : new_node(N_EMPTY);
+}
+
+
+Fl_Text_Search::Node *Fl_Text_Search::parse_repeat(const char *&p, int depth)
+{
+  Node *a = parse_atom(p, depth);
+  while (!mError && (*p == '*' || *p == '+' || *p == '?')) {
+    a = new_node(*p == '*' ? N_STAR : *p == '+' ? N_PLUS : N_QUEST, a);
+    p++;
+  }
+  return a;
+}
+
+
+Fl_Text_Search::Node *Fl_Text_Search::parse_atom(const char *&p, int depth)
+{
+  Node *n;
+  int l;
+  switch (*p) {
+    case '(':
+      if (depth >= MAX_DEPTH) {
+        mError = "too many nested groups";
+        return new_node(N_EMPTY);
+      }
+      p++;
+      n = parse_alt(p, depth + 1);
+      if (!mError && *p != ')')
+        mError = "missing )";
+      else
+        p++;
+      return n;
+    case '*': case '+': case '?':
+      mError = "nothing to repeat";
+      return new_node(N_EMPTY);
+    case '[':
+      n = new_node(N_CLASS);
+      n->c = parse_class(p);
+      return n;
+    case '.':
+      p++;
+      return new_node(N_ANY);
+    case '^':
+      p++;
+      return new_node(N_BOL);
+    case '$':
+      p++;
+      return new_node(N_EOL);
+    case '\\':
+      p++;
+      switch (*p) {
+        case 0:
+          mError = "trailing \\";
+          return new_node(N_EMPTY);
+        case 'b': p++; return new_node(N_WORDB);
+        case 'B': p++; return new_node(N_NWORDB);
+        case 'd': case 'w': case 's': case 'D': case 'W': case 'S':
+          n = new_node(N_CLASS);
+          n->c = mNClasses;
+          mClasses = (Class *) realloc(mClasses, ++mNClasses * sizeof(Class));
+          mClasses[n->c].negate = isupper((unsigned char)*p) != 0;
+          mClasses[n->c].nRanges = 0;
+          mClasses[n->c].ranges = 0;
+          add_escape_class(mClasses[n->c], (char)tolower((unsigned char)*p));
+          p++;
+          return n;
+        case 'n': p++; n = new_node(N_CHAR); n->c = '\n'; return n;
+        case 't': p++; n = new_node(N_CHAR); n->c = '\t'; return n;
+      }
+      // any other escaped character stands for itself
+      // FALLTHROUGH
+    default:
+      n = new_node(N_CHAR);
+      n->c = fl_utf8decode(p, p + strlen(p), &l);
+      p += l;
+      return n;
+  }
+}
+
+
+void Fl_Text_Search::add_range(Class &c, unsigned lo, unsigned hi)
+{
+  c.ranges = (unsigned *) realloc(c.ranges, (c.nRanges + 1) * 2 * sizeof(unsigned));
+  c.ranges[2 * c.nRanges] = lo;
+  c.ranges[2 * c.nRanges + 1] = hi;
+  c.nRanges++;
+}
+
+
+void Fl_Text_Search::add_escape_class(Class &c, char e)
+{
+  switch (e) {
+    case 'd':
+      add_range(c, '0', '9');
+      break;
+    case 'w':
+      add_range(c, '0', '9');
+      add_range(c, 'A', 'Z');
+      add_range(c, 'a', 'z');
+      add_range(c, '_', '_');
+      break;
+    case 's':
+      add_range(c, ' ', ' ');
+      add_range(c, '\t', '\r');
+      break;
+  }
+}
+
+
+/*
+ Parse a bracket expression starting at the '[' and return its class index.
+ */
+int Fl_Text_Search::parse_class(const char *&p)
+{
+  int idx = mNClasses;
+  mClasses = (Class *) realloc(mClasses, ++mNClasses * sizeof(Class));
+  Class &c = mClasses[idx];
+  c.negate = 0;
+  c.nRanges = 0;
+  c.ranges = 0;
+  p++;
+  if (*p == '^') {
+    c.negate = 1;
+    p++;
+  }
+  int first = 1, l;
+  while (*p != ']' || first) {
+    first = 0;
+    if (!*p) {
+      mError = "missing ]";
+      return idx;
+    }
+    unsigned lo;
+    if (*p == '\\' && p[1]) {
+      p++;
+      if (*p == 'd' || *p == 'w' || *p == 's') {
+        add_escape_class(c, *p++);
+        continue;
+      }
+      if (*p == 'D' || *p == 'W' || *p == 'S') {
+        mError = "\\D, \\W and \\S are not supported inside []";
+        return idx;
+      }
+      lo = *p == 'n' ? '\n' : *p == 't' ? '\t' : fl_utf8decode(p, p + strlen(p), &l);
+      p += (*p == 'n' || *p == 't') ? 1 : l;
+    } else {
+      lo = fl_utf8decode(p, p + strlen(p), &l);
+      p += l;
+    }
+    unsigned hi = lo;
+    if (*p == '-' && p[1] && p[1] != ']') {
+      p++;
+      if (*p == '\\' && p[1])
+        p++;
+      hi = fl_utf8decode(p, p + strlen(p), &l);
+      p += l;
+      if (hi < lo) {
+        mError = "invalid range in []";
+        return idx;
+      }
+    }
+    add_range(c, lo, hi);
+  }
+  p++;
+  return idx;
+}
+
+
+//
+// Regular expression compiler
+//
+
+/*
+ Return the number of instructions needed for the tree n.
+ */
+int Fl_Text_Search::count(const Node *n) const
+{
+  switch (n->type) {
+    case N_EMPTY: return 0;
+    case N_CAT:   return count(n->left) + count(n->right);
+    case N_ALT:   return 2 + count(n->left) + count(n->right);
+    case N_STAR:  return 2 + count(n->left);
+    case N_PLUS:
+    case N_QUEST: return 1 + count(n->left);
+    default:      return 1;
+  }
+}
+
+
+/*
+ Write the instructions for tree n starting at pc, return the next pc.
+ */
+int Fl_Text_Search::emit(const Node *n, int pc)
+{
+  int start = pc, split;
+  switch (n->type) {
+    case N_EMPTY:
+      return pc;
+    case N_CAT:
+      pc = emit(n->left, pc);
+      return emit(n->right, pc);
+    case N_ALT:
+      mProg[pc].op = I_SPLIT;
+      mProg[pc].x = pc + 1;
+      pc = emit(n->left, pc + 1);
+      mProg[pc].op = I_JMP;
+      mProg[start].y = pc + 1;
+      split = pc;
+      pc = emit(n->right, pc + 1);
+      mProg[split].x = pc;
+      return pc;
+    case N_STAR:
+      mProg[pc].op = I_SPLIT;
+      mProg[pc].x = pc + 1;
+      pc = emit(n->left, pc + 1);
+      mProg[pc].op = I_JMP;
+      mProg[pc].x = start;
+      mProg[start].y = pc + 1;
+      return pc + 1;
+    case N_PLUS:
+      pc = emit(n->left, pc);
+      mProg[pc].op = I_SPLIT;
+      mProg[pc].x = start;
+      mProg[pc].y = pc + 1;
+      return pc + 1;
+    case N_QUEST:
+      mProg[pc].op = I_SPLIT;
+      mProg[pc].x = pc + 1;
+      pc = emit(n->left, pc + 1);
+      mProg[start].y = pc;
+      return pc;
+    case N_CHAR:   mProg[pc].op = I_CHAR; break;
+    case N_ANY:    mProg[pc].op = I_ANY; break;
+    case N_CLASS:  mProg[pc].op = I_CLASS; break;
+    case N_BOL:    mProg[pc].op = I_BOL; break;
+    case N_EOL:    mProg[pc].op = I_EOL; break;
+    case N_WORDB:  mProg[pc].op = I_WORDB; break;
+    case N_NWORDB: mProg[pc].op = I_NWORDB; break;
+  }
+  mProg[pc].c = n->c;
+  return pc + 1;
+}
+
+
+//
+// Regular expression matcher
+//
+
+int Fl_Text_Search::match_class(int cls, unsigned c) const
+{
+  const Class &k = mClasses[cls];
+  int in = 0;
+  for (int i = 0; i < k.nRanges && !in; i++) {
+    unsigned lo = k.ranges[2 * i], hi = k.ranges[2 * i + 1];
+    if (c >= lo && c <= hi)
+      in = 1;
+    else if (!(mFlags & MATCH_CASE)) {
+      unsigned l = fl_tolower(c), u = fl_toupper(c);
+      if ((l >= lo && l <= hi) || (u >= lo && u <= hi))
+        in = 1;
+    }
+  }
+  return in != k.negate;
+}
+
+
+/*
+ State of one run of the Pike VM. A thread is a program counter and the
+ position where its match started. Threads are kept in priority order,
+ and every program counter appears at most once in a list.
+ */
+struct Fl_Text_Search_Thread {
+  int pc, start;
+};
+
+struct Fl_Text_Search_Context {
+  unsigned prev, ch;    // characters before and at the current position
+  int bol, eol;         // current position is at start or end of a line
+};
+
+
+/*
+ Add a thread to list and follow all jumps and assertions that do not
+ consume a character. The closure is computed with an explicit stack so
+ that long patterns can not overflow the call stack.
+ */
+static void add_thread(const Fl_Text_Search_Context &cx, const int *ops,
+                       const int *xs, const int *ys, int *mark, int gen,
+                       int *stack, Fl_Text_Search_Thread *list, int &n,
+                       int pc, int start)
+{
+  int sp = 0;
+  stack[sp++] = pc;
+  while (sp) {
+    pc = stack[--sp];
+    if (mark[pc] == gen)
+      continue;
+    mark[pc] = gen;
+    switch (ops[pc]) {
+      case I_JMP:
+        stack[sp++] = xs[pc];
+        break;
+      case I_SPLIT:
+        stack[sp++] = ys[pc];
+        stack[sp++] = xs[pc];
+        break;
+      case I_BOL:
+        if (cx.bol) stack[sp++] = pc + 1;
+        break;
+      case I_EOL:
+        if (cx.eol) stack[sp++] = pc + 1;
+        break;
+      case I_WORDB:
+        if (is_word(cx.prev) != is_word(cx.ch)) stack[sp++] = pc + 1;
+        break;
+      case I_NWORDB:
+        if (is_word(cx.prev) == is_word(cx.ch)) stack[sp++] = pc + 1;
+        break;
+      default:
+        list[n].pc = pc;
+        list[n].start = start;
+        n++;
+        break;
+    }
+  }
+}
+
+
+/*
+ Find the leftmost match that starts between from and to, and that does
+ not consume any character at or after limit. Assertions look at the
+ whole buffer, so '$' does not match at limit unless a line ends there.
+ */
+int Fl_Text_Search::regex_forward(const Fl_Text_Buffer *buf, int from, int to,
+                                  int limit, int *foundPos, int *foundEnd) const
+{
+  int len = buf->length(), n = mNProg, i;
+  int *ops = (int *) malloc(n * 4 * sizeof(int) + (2 * n + 1) * sizeof(int));
+  int *xs = ops + n, *ys = xs + n, *mark = ys + n, *stack = mark + n;
+  Fl_Text_Search_Thread *clist = (Fl_Text_Search_Thread *)
+    malloc(2 * n * sizeof(Fl_Text_Search_Thread));
+  Fl_Text_Search_Thread *nlist = clist + n, *t;
+  for (i = 0; i < n; i++) {
+    ops[i] = mProg[i].op;
+    xs[i] = mProg[i].x;
+    ys[i] = mProg[i].y;
+    mark[i] = -1;
+  }
+
+  int pos = from, gen = 0, nc = 0, nn, matched = 0;
+  Fl_Text_Search_Context cx;
+  cx.prev = pos > 0 ? buf->char_at(buf->prev_char(pos)) : 0;
+  cx.ch = pos < len ? buf->char_at(pos) : 0;
+  cx.bol = pos == 0 || cx.prev == '\n';
+  cx.eol = pos >= len || cx.ch == '\n';
+
+  for (;;) {
+    // a new match can start here unless an earlier one was found
+    if (!matched && pos <= to)
+      add_thread(cx, ops, xs, ys, mark, gen, stack, clist, nc, 0, pos);
+    if (!nc && (matched || pos >= to))
+      break;
+
+    int npos = pos < len ? buf->next_char(pos) : len;
+    Fl_Text_Search_Context nx;
+    nx.prev = cx.ch;
+    nx.ch = npos < len ? buf->char_at(npos) : 0;
+    nx.bol = cx.ch == '\n';
+    nx.eol = npos >= len || nx.ch == '\n';
+
+    gen++;
+    nn = 0;
+    for (i = 0; i < nc; i++) {
+      t = clist + i;
+      const Inst &in = mProg[t->pc];
+      int ok = 0;
+      if (in.op == I_MATCH) {
+        // threads of lower priority can not win anymore
+        matched = 1;
+        *foundPos = t->start;
+        *foundEnd = pos;
+        break;
+      }
+      if (pos >= limit)
+        continue;
+      switch (in.op) {
+        case I_CHAR:
+          ok = cx.ch == in.c ||
+               (!(mFlags & MATCH_CASE) && fl_tolower(cx.ch) == fl_tolower(in.c));
+          break;
+        case I_ANY:
+          ok = cx.ch != '\n';
+          break;
+        case I_CLASS:
+          ok = match_class(in.c, cx.ch);
+          break;
+      }
+      if (ok)
+        add_thread(nx, ops, xs, ys, mark, gen, stack, nlist, nn, t->pc + 1, t->start);
+    }
+
+    t = clist; clist = nlist; nlist = t;
+    nc = nn;
+    if (pos >= limit)
+      break;
+    pos = npos;
+    cx = nx;
+  }
+
+  free(clist < nlist ? clist : nlist);
+  free(ops);
+  return matched;
+}
+
+//
+// End of "$Id$".
+//
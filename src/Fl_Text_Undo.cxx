@@ -0,0 +1,258 @@
+//
+// "$Id$"
+//
+// Undo and redo journal for the Fl_Text_Buffer class.
+//
+// Copyright 2001-2016 by Bill Spitzak and others.
+//
+// This library is free software. Distribution and use rights are outlined in
+// the file "COPYING" which should have been included with this file.  If this
+// file is missing or damaged, see the license at:
+//
+//     http://www.fltk.org/COPYING.php
+//
+// Please report all bugs and problems on the following page:
+//
+//     http://www.fltk.org/str.php
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <FL/Fl_Text_Buffer.H>
+#include "Fl_Text_Undo.H"
+
+/*
+ Default memory limit of a journal. The most recent group of edits is
+ always kept, even if it alone exceeds the limit.
+ */
+#define DEFAULT_LIMIT (16 * 1024 * 1024)
+
+
+Fl_Text_Undo::Fl_Text_Undo(Fl_Text_Buffer *buf)
+{
+  mBuffer = buf;
+  mUndo = mRedo = 0;
+  mNUndo = mNAllocUndo = 0;
+  mNRedo = mNAllocRedo = 0;
+  mGroup = 0;
+  mDepth = 0;
+  mSealed = 1;
+  mBusy = 0;
+  mLimit = DEFAULT_LIMIT;
+  mMemory = 0;
+}
+
+
+Fl_Text_Undo::~Fl_Text_Undo()
+{
+  clear();
+  free(mUndo);
+  free(mRedo);
+}
+
+
+void Fl_Text_Undo::free_records(Record *r, int n)
+{
+  for (int i = 0; i < n; i++) {
+    mMemory -= (int) sizeof(Record) + r[i].textLength;
+    free(r[i].text);
+  }
+}
+
+
+void Fl_Text_Undo::clear()
+{
+  free_records(mUndo, mNUndo);
+  free_records(mRedo, mNRedo);
+  mNUndo = mNRedo = 0;
+  mSealed = 1;
+}
+
+
+/*
+ Add an uninitialized record to the top of a stack.
+ */
+Fl_Text_Undo::Record *Fl_Text_Undo::push(Record *&stack, int &n, int &nAlloc)
+{
+  if (n == nAlloc) {
+    nAlloc = nAlloc ? 2 * nAlloc : 16;
+    stack = (Record *) realloc(stack, nAlloc * sizeof(Record));
+  }
+  mMemory += (int) sizeof(Record);
+  return stack + n++;
+}
+
+
+/*
+ Prepare for a new edit: the redo stack becomes invalid. Return the
+ record that the edit may be merged into, or NULL.
+ */
+Fl_Text_Undo::Record *Fl_Text_Undo::extendable()
+{
+  free_records(mRedo, mNRedo);
+  mNRedo = 0;
+  if (mSealed || !mNUndo)
+    return 0;
+  return mUndo + mNUndo - 1;
+}
+
+
+void Fl_Text_Undo::inserted(int pos, int nInserted)
+{
+  if (mBusy || nInserted <= 0)
+    return;
+  Record *r = extendable();
+  if (r && pos == r->pos + r->length) {
+    // typing: the range of the last record grows
+    r->length += nInserted;
+    return;
+  }
+  r = push(mUndo, mNUndo, mNAllocUndo);
+  r->pos = pos;
+  r->length = nInserted;
+  r->text = 0;
+  r->textLength = 0;
+  r->group = mDepth ? mGroup : ++mGroup;
+  mSealed = 0;
+  trim();
+}
+
+
+void Fl_Text_Undo::remove(int start, int end)
+{
+  if (mBusy || start >= end)
+    return;
+  int n = end - start;
+  Record *r = extendable();
+  if (r && start >= r->pos && end == r->pos + r->length) {
+    // backspacing over text that was just typed, nothing to save
+    r->length -= n;
+    if (!r->length && !r->text) {
+      mNUndo--;
+      mMemory -= (int) sizeof(Record);
+      mSealed = 1;
+    }
+    return;
+  }
+  if (r && !r->length && (end == r->pos || start == r->pos)) {
+    // more backspace or delete keys at the same position
+    r->text = (char *) realloc(r->text, r->textLength + n + 1);
+    if (end == r->pos) {
+      memmove(r->text + n, r->text, r->textLength);
+      mBuffer->copy_range_(start, end, r->text);
+      r->pos = start;
+    } else {
+      mBuffer->copy_range_(start, end, r->text + r->textLength);
+    }
+    r->textLength += n;
+    r->text[r->textLength] = 0;
+    mMemory += n;
+    trim();
+    return;
+  }
+  r = push(mUndo, mNUndo, mNAllocUndo);
+  r->pos = start;
+  r->length = 0;
+  r->text = (char *) malloc(n + 1);
+  mBuffer->copy_range_(start, end, r->text);
+  r->text[n] = 0;
+  r->textLength = n;
+  r->group = mDepth ? mGroup : ++mGroup;
+  mMemory += n;
+  mSealed = 0;
+  trim();
+}
+
+
+void Fl_Text_Undo::begin_group()
+{
+  if (mDepth++ == 0) {
+    mGroup++;
+    mSealed = 1;
+  }
+}
+
+
+void Fl_Text_Undo::end_group()
+{
+  if (mDepth > 0 && --mDepth == 0)
+    mSealed = 1;
+}
+
+
+void Fl_Text_Undo::limit(int bytes)
+{
+  mLimit = bytes;
+  trim();
+}
+
+
+/*
+ Drop the oldest groups until the journal fits into its memory limit.
+ The newest group always survives.
+ */
+void Fl_Text_Undo::trim()
+{
+  if (mMemory <= mLimit)
+    return;
+  int n = 0;
+  unsigned newest = mNUndo ? mUndo[mNUndo - 1].group : 0;
+  while (n < mNUndo && mMemory > mLimit && mUndo[n].group != newest) {
+    unsigned group = mUndo[n].group;
+    int first = n;
+    while (n < mNUndo && mUndo[n].group == group)
+      n++;
+    free_records(mUndo + first, n - first);
+  }
+  if (n) {
+    mNUndo -= n;
+    memmove(mUndo, mUndo + n, mNUndo * sizeof(Record));
+  }
+}
+
+
+/*
+ Pop the top group of records from one stack, swap their text with the
+ text in the buffer, and push them onto the other stack.
+ */
+int Fl_Text_Undo::apply(Record *&from, int &nFrom, Record *&to, int &nTo,
+                        int &nAllocTo, int *cursorPos)
+{
+  if (!nFrom)
+    return 0;
+  unsigned group = from[nFrom - 1].group;
+  mBusy = 1;
+  while (nFrom && from[nFrom - 1].group == group) {
+    Record r = from[--nFrom];
+    mMemory -= (int) sizeof(Record) + r.textLength;
+    int start = r.pos, end = r.pos + r.length;
+    mBuffer->call_predelete_callbacks(start, r.length);
+    char *current = mBuffer->text_range(start, end);
+    mBuffer->remove_(start, end);
+    int nInserted = r.text ? mBuffer->insert_(start, r.text) : 0;
+    mBuffer->mCursorPosHint = start + nInserted;
+    mBuffer->call_modify_callbacks(start, r.length, nInserted, 0, current);
+    free(r.text);
+    if (!r.length) {
+      free(current);
+      current = 0;
+    }
+    Record *t = push(to, nTo, nAllocTo);
+    t->pos = start;
+    t->length = nInserted;
+    t->text = current;
+    t->textLength = r.length;
+    t->group = group;
+    mMemory += r.length;
+  }
+  mBusy = 0;
+  mSealed = 1;
+  if (cursorPos)
+    *cursorPos = mBuffer->mCursorPosHint;
+  trim();
+  return 1;
+}
+
+//
+// End of "$Id$".
+//
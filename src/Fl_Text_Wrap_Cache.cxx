@@ -0,0 +1,141 @@
+//
+// "$Id$"
+//
+// Wrapped line cache for the Fl_Text_Display class.
+//
+// Copyright 2001-2016 by Bill Spitzak and others.
+//
+// This library is free software. Distribution and use rights are outlined in
+// the file "COPYING" which should have been included with this file.  If this
+// file is missing or damaged, see the license at:
+//
+//     http://www.fltk.org/COPYING.php
+//
+// Please report all bugs and problems on the following page:
+//
+//     http://www.fltk.org/str.php
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "Fl_Text_Wrap_Cache.H"
+
+
+Fl_Text_Wrap_Cache::Fl_Text_Wrap_Cache()
+{
+  mRows = 0;
+  mNLines = mNAlloc = 0;
+  mBlocks = 0;
+  mNAllocBlocks = 0;
+  memset(mLayout, 0, sizeof(mLayout));
+  mStyles = 0;
+}
+
+
+Fl_Text_Wrap_Cache::~Fl_Text_Wrap_Cache()
+{
+  free(mRows);
+  free(mBlocks);
+}
+
+
+/*
+ Change the number of lines, without initializing new lines or blocks.
+ */
+void Fl_Text_Wrap_Cache::resize(int nLines)
+{
+  if (nLines > mNAlloc) {
+    mNAlloc = nLines + nLines / 4 + BLOCK;
+    mRows = (int *) realloc(mRows, mNAlloc * sizeof(int));
+  }
+  int nBlocks = (mNAlloc + BLOCK - 1) / BLOCK;
+  if (nBlocks > mNAllocBlocks) {
+    mNAllocBlocks = nBlocks;
+    mBlocks = (Block *) realloc(mBlocks, nBlocks * sizeof(Block));
+  }
+  mNLines = nLines;
+}
+
+
+/*
+ Recalculate the sums of all blocks from the given block to the end.
+ */
+void Fl_Text_Wrap_Cache::rebuild_blocks(int first)
+{
+  int nBlocks = (mNLines + BLOCK - 1) / BLOCK;
+  for (int b = first; b < nBlocks; b++) {
+    int end = (b + 1) * BLOCK;
+    if (end > mNLines)
+      end = mNLines;
+    int rows = 0, unknown = 0;
+    for (int i = b * BLOCK; i < end; i++) {
+      rows += mRows[i];
+      if (!mRows[i])
+        unknown++;
+    }
+    mBlocks[b].rows = rows;
+    mBlocks[b].unknown = unknown;
+  }
+}
+
+
+void Fl_Text_Wrap_Cache::reset(int nLines)
+{
+  resize(nLines);
+  memset(mRows, 0, nLines * sizeof(int));
+  rebuild_blocks(0);
+}
+
+
+void Fl_Text_Wrap_Cache::layout(int font, int size, int margin,
+                                const void *styles, int nStyles, int tabDist)
+{
+  int l[5] = { font, size, margin, nStyles, tabDist };
+  if (styles == mStyles && !memcmp(l, mLayout, sizeof(l)))
+    return;
+  memcpy(mLayout, l, sizeof(l));
+  mStyles = styles;
+  reset(mNLines);
+}
+
+
+void Fl_Text_Wrap_Cache::rows(int line, int nRows)
+{
+  Block &b = mBlocks[line / BLOCK];
+  if (!mRows[line])
+    b.unknown--;
+  if (!nRows)
+    b.unknown++;
+  b.rows += nRows - mRows[line];
+  mRows[line] = nRows;
+}
+
+
+void Fl_Text_Wrap_Cache::replace(int line, int nDeleted, int nInserted)
+{
+  if (nDeleted == nInserted) {
+    invalidate(line, line + nInserted - 1);
+    return;
+  }
+  int tail = mNLines - line - nDeleted;
+  resize(mNLines + nInserted - nDeleted);
+  memmove(mRows + line + nInserted, mRows + line + nDeleted, tail * sizeof(int));
+  memset(mRows + line, 0, nInserted * sizeof(int));
+  rebuild_blocks(line / BLOCK);
+}
+
+
+void Fl_Text_Wrap_Cache::invalidate(int first, int last)
+{
+  if (first < 0)
+    first = 0;
+  if (last >= mNLines)
+    last = mNLines - 1;
+  for (int i = first; i <= last; i++)
+    if (mRows[i])
+      rows(i, 0);
+}
+
+//
+// End of "$Id$".
+//
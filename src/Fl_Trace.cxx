@@ -0,0 +1,184 @@
+//
+// "$Id$"
+//
+// Event loop tracing for the Fast Light Tool Kit (FLTK).
+//
+// Copyright 1998-2016 by Bill Spitzak and others.
+//
+// This library is free software. Distribution and use rights are outlined in
+// the file "COPYING" which should have been included with this file.  If this
+// file is missing or damaged, see the license at:
+//
+//     http://www.fltk.org/COPYING.php
+//
+// Please report all bugs and problems on the following page:
+//
+//     http://www.fltk.org/str.php
+//
+
+#include <FL/Fl.H>
+#include <FL/fl_utf8.h>
+#include "Fl_Trace.H"
+#include <stdio.h>
+#include <stdlib.h>
+#include "flstring.h"
+
+#if USE_EVENT_TRACE
+
+#  ifdef WIN32
+#    include <windows.h>
+#  endif
+
+// Trace events are stored in a ring buffer with a power of two size.
+// Every event gets its slot by atomically incrementing trace_count, so
+// events can be recorded from any thread without locking; when the ring
+// is full, the oldest events are overwritten.
+
+struct Trace_Event {
+  const char *name;
+  const void *arg;
+  long value;           // -1 if there is none
+  double start;         // seconds since Fl::trace_start()
+  double duration;      // seconds
+};
+
+int fl_trace_active;
+static Trace_Event *trace_ring;
+static unsigned trace_size;             // always a power of two
+static volatile unsigned trace_count;   // number of events recorded
+static double trace_origin;
+
+extern double fl_clock();
+
+double fl_trace_clock() {
+  return fl_clock() - trace_origin;
+}
+
+static unsigned trace_next() {
+#  if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 1))
+  return __sync_fetch_and_add(&trace_count, 1);
+#  elif defined(WIN32)
+  return (unsigned)InterlockedIncrement((LONG volatile *)&trace_count) - 1;
+#  else
+  return trace_count++;
+#  endif
+}
+
+void fl_trace_record(const char *name, const void *arg, long value,
+                     double start) {
+  double end = fl_trace_clock();
+  if (!fl_trace_active) return;         // stopped in the meantime
+  Trace_Event &e = trace_ring[trace_next() & (trace_size - 1)];
+  e.name = name;
+  e.arg = arg;
+  e.value = value;
+  e.start = start;
+  e.duration = end - start;
+}
+
+#endif // USE_EVENT_TRACE
+
+
+/**
+  Starts recording an event loop trace.
+
+  While a trace is running, FLTK records how long the parts of the event
+  loop take: calling timeouts, checks, idle callbacks, file descriptor
+  callbacks, and awake handlers, handling system events, redrawing
+  windows in Fl::flush(), and waiting for events. Each of the callbacks
+  is recorded separately, along with its address. Use Fl::trace_write()
+  to save the trace.
+
+  The events are kept in a ring buffer of \p size entries, so the trace
+  holds the most recent events of a long session. Any previous trace is
+  discarded.
+
+  Tracing must be enabled when FLTK is built, with the CMake option
+  OPTION_EVENT_TRACE or configure --enable-trace. Most of the event
+  loop is only traced on X11; on other platforms only Fl::flush() is.
+
+  \param size number of events to keep, rounded up to a power of two
+  \return 0 on success, -1 if tracing is not available
+  \see Fl::trace_stop(), Fl::trace_write()
+*/
+int Fl::trace_start(int size) {
+#if USE_EVENT_TRACE
+  unsigned n = 1024;
+  while (n < (unsigned)size && n < 0x40000000) n *= 2;
+  fl_trace_active = 0;
+  if (n != trace_size) {
+    free(trace_ring);
+    trace_ring = (Trace_Event *)malloc(n * sizeof(Trace_Event));
+    if (!trace_ring) {
+      trace_size = 0;
+      return -1;
+    }
+    trace_size = n;
+  }
+  trace_count = 0;
+  trace_origin = fl_clock();
+  fl_trace_active = 1;
+  return 0;
+#else
+  (void)size;
+  return -1;
+#endif // USE_EVENT_TRACE
+}
+
+/**
+  Stops recording the event loop trace. The recorded events are kept
+  until Fl::trace_start() is called again.
+*/
+void Fl::trace_stop() {
+#if USE_EVENT_TRACE
+  fl_trace_active = 0;
+#endif
+}
+
+/**
+  Writes the recorded event loop trace to a file.
+
+  The file uses the JSON format of the Chrome trace event profiler, so it
+  can be loaded into chrome://tracing or compatible viewers. Each event
+  is a complete ("X") event with its start time and duration in
+  microseconds; events that belong to a callback have the callback
+  address as the "arg" argument, and system events have their type as
+  the "value" argument.
+
+  The trace can be written while it is running.
+
+  \param filename the name of the file, in UTF-8
+  \return 0 on success, -1 if the file could not be written or tracing
+	  is not available
+*/
+int Fl::trace_write(const char *filename) {
+#if USE_EVENT_TRACE
+  if (!trace_ring) return -1;
+  FILE *fp = fl_fopen(filename, "w");
+  if (!fp) return -1;
+  int active = fl_trace_active;
+  fl_trace_active = 0;
+  unsigned count = trace_count;
+  unsigned first = count > trace_size ? count - trace_size : 0;
+  fputs("{\"traceEvents\":[\n", fp);
+  for (unsigned i = first; i < count; i++) {
+    const Trace_Event &e = trace_ring[i & (trace_size - 1)];
+    fprintf(fp, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+                "\"ts\":%.3f,\"dur\":%.3f",
+            e.name, e.start * 1e6, e.duration * 1e6);
+    if (e.arg) fprintf(fp, ",\"args\":{\"arg\":\"%p\"}", e.arg);
+    else if (e.value >= 0) fprintf(fp, ",\"args\":{\"value\":%ld}", e.value);
+    fputs(i + 1 < count ? "},\n" : "}\n", fp);
+  }
+  fputs("],\"displayTimeUnit\":\"ms\"}\n", fp);
+  fl_trace_active = active;
+  return fclose(fp) ? -1 : 0;
+#else
+  (void)filename;
+  return -1;
+#endif // USE_EVENT_TRACE
+}
+
+//
+// End of "$Id$".
+//
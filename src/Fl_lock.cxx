@@ -21,6 +21,8 @@
 #include <config.h>
 
 #include <stdlib.h>
+#include "flstring.h"
+#include "Fl_Trace.H"
 
 /*
    From Bill:
@@ -59,6 +61,7 @@
 */
 
 #ifndef FL_DOXYGEN
+// no longer used, kept for ABI compatibility:
 Fl_Awake_Handler *Fl::awake_ring_;
 void **Fl::awake_data_;
 int Fl::awake_ring_size_;
@@ -66,59 +69,120 @@ int Fl::awake_ring_head_;
 int Fl::awake_ring_tail_;
 #endif
 
-static const int AWAKE_RING_SIZE = 1024;
+/*
+   Awake handlers are queued without locking: any thread pushes items
+   onto a shared stack with compare-and-swap, and the main thread takes
+   the whole stack at once and reverses it into a private FIFO, which
+   it then works through without touching the shared stack again. As
+   the main thread never pops single items off the shared stack, the
+   usual ABA problem of lock-free stacks does not arise. The queue grows
+   as needed, so registering an awake handler does not fail unless the
+   system runs out of memory.
+
+   Only the first awake handler that is queued after the main thread
+   took the stack wakes up Fl::wait(); the following ones are picked up
+   with it, so a burst of Fl::awake() calls costs a single wakeup.
+
+   Compilers without atomic builtins use the ring mutex instead.
+*/
+
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 1))
+#  define FL_AWAKE_ATOMIC 1
+#elif defined(WIN32)
+#  include <windows.h>
+#  define FL_AWAKE_ATOMIC 1
+#else
+#  define FL_AWAKE_ATOMIC 0
 static void lock_ring();
 static void unlock_ring();
+#endif
+
+struct Fl_Awake_Item {
+  Fl_Awake_Handler func;
+  void *data;
+  Fl_Awake_Item *next;
+};
+
+static Fl_Awake_Item * volatile awake_stack;    // pushed by any thread
+static Fl_Awake_Item *awake_queue;              // main thread only
+static volatile long awake_pending;             // a wakeup was sent
+
+static void awake_send();                       // wake up the main thread
+
+// Set *p to n if it is o, return the previous value of *p.
+static Fl_Awake_Item *awake_cas(Fl_Awake_Item * volatile *p,
+                                Fl_Awake_Item *o, Fl_Awake_Item *n) {
+#if defined(__GNUC__) && FL_AWAKE_ATOMIC
+  return __sync_val_compare_and_swap(p, o, n);
+#elif FL_AWAKE_ATOMIC
+  return (Fl_Awake_Item*)InterlockedCompareExchangePointer((PVOID volatile*)p, n, o);
+#else
+  lock_ring();
+  Fl_Awake_Item *r = *p;
+  if (r == o) *p = n;
+  unlock_ring();
+  return r;
+#endif
+}
+
+// Set awake_pending to v and return its previous value.
+static long awake_pending_swap(long v) {
+#if defined(__GNUC__) && FL_AWAKE_ATOMIC
+  long r;
+  do r = awake_pending; while (__sync_val_compare_and_swap(&awake_pending, r, v) != r);
+  return r;
+#elif FL_AWAKE_ATOMIC
+  return InterlockedExchange((LONG volatile*)&awake_pending, v);
+#else
+  lock_ring();
+  long r = awake_pending;
+  awake_pending = v;
+  unlock_ring();
+  return r;
+#endif
+}
 
 /** Adds an awake handler for use in awake(). */
 int Fl::add_awake_handler_(Fl_Awake_Handler func, void *data)
 {
-  int ret = 0;
-  lock_ring();
-  if (!awake_ring_) {
-    awake_ring_size_ = AWAKE_RING_SIZE;
-    awake_ring_ = (Fl_Awake_Handler*)malloc(awake_ring_size_*sizeof(Fl_Awake_Handler));
-    awake_data_ = (void**)malloc(awake_ring_size_*sizeof(void*));
-    // explicitly initialize the head and tail indices
-    awake_ring_head_= awake_ring_tail_ = 0;
-  }
-  // The next head index we will want (not the current index):
-  // We use this to check if the ring-buffer is full or not
-  // (and to update awake_ring_head_ if we do use the current index.)
-  int next_head = awake_ring_head_ + 1;
-  if (next_head >= awake_ring_size_) {
-    next_head = 0;
-  }
-  // check that the ring buffer is not full, and that it exists
-  if ((!awake_ring_) || (next_head == awake_ring_tail_)) {
-    // ring is non-existent or full. Return -1 as an error indicator.
-    ret = -1;
-  } else {
-    awake_ring_[awake_ring_head_] = func;
-    awake_data_[awake_ring_head_] = data;
-    awake_ring_head_ = next_head;
-  }
-  unlock_ring();
-  return ret;
+  Fl_Awake_Item *item = (Fl_Awake_Item*)malloc(sizeof(Fl_Awake_Item));
+  if (!item) return -1;
+  item->func = func;
+  item->data = data;
+  Fl_Awake_Item *head;
+  do {
+    head = awake_stack;
+    item->next = head;
+  } while (awake_cas(&awake_stack, head, item) != head);
+  return 0;
 }
 
 /** Gets the last stored awake handler for use in awake(). */
 int Fl::get_awake_handler_(Fl_Awake_Handler &func, void *&data)
 {
-  int ret = 0;
-  lock_ring();
-  if ((!awake_ring_) || (awake_ring_head_ == awake_ring_tail_)) {
-    ret = -1;
-  } else {
-    func = awake_ring_[awake_ring_tail_];
-    data = awake_data_[awake_ring_tail_];
-    ++awake_ring_tail_;
-    if (awake_ring_tail_ >= awake_ring_size_) {
-      awake_ring_tail_ = 0;
+  if (!awake_queue) {
+    // handlers that are queued from now on need a new wakeup. Clear the
+    // flag even if the stack is empty: the wakeup that set it may have
+    // arrived after an earlier call already drained the stack, and a
+    // flag left set would suppress all later wakeups.
+    awake_pending_swap(0);
+    if (!awake_stack) return -1;
+    Fl_Awake_Item *head;
+    do head = awake_stack; while (awake_cas(&awake_stack, head, 0) != head);
+    // the stack is in LIFO order, reverse it:
+    while (head) {
+      Fl_Awake_Item *next = head->next;
+      head->next = awake_queue;
+      awake_queue = head;
+      head = next;
     }
   }
-  unlock_ring();
-  return ret;
+  Fl_Awake_Item *item = awake_queue;
+  awake_queue = item->next;
+  func = item->func;
+  data = item->data;
+  free(item);
+  return 0;
 }
 
 /**
@@ -126,14 +190,15 @@ int Fl::get_awake_handler_(Fl_Awake_Handler &func, void *&data)
  Registers a function that will be 
  called by the main thread during the next message handling cycle. 
  Returns 0 if the callback function was registered, 
- and -1 if registration failed. Over a thousand awake callbacks can be
- registered simultaneously.
+ and -1 if registration failed, which only happens if the system runs
+ out of memory. Any number of awake callbacks can be registered
+ simultaneously; they are called in the order they were registered.
  
  \see Fl::awake(void* message=0)
 */
 int Fl::awake(Fl_Awake_Handler func, void *data) {
   int ret = add_awake_handler_(func, data);
-  Fl::awake();
+  if (!awake_pending_swap(1)) awake_send();
   return ret;
 }
 
@@ -188,6 +253,40 @@ int Fl::awake(Fl_Awake_Handler func, void *data) {
     
     See also: \ref advanced_multithreading
 */
+/** \fn void Fl::lock_shared()
+    Gets shared access to FLTK widgets and data, for threads that only
+    read them, for instance to fetch data for a table model. Any number
+    of threads can hold the shared lock at the same time, while lock()
+    waits until all of them have called unlock_shared(). As the main
+    thread holds lock() except while Fl::wait() is waiting for events,
+    shared lockers mostly run concurrently with each other, not with
+    the main thread.
+
+    Threads that are waiting for lock() take precedence over new shared
+    lockers, so a thread must not call lock_shared() again while it
+    holds the shared lock. A thread that holds lock() may call
+    lock_shared(), which then just counts as another level of lock().
+
+    On platforms without reader-writer support, this is the same as
+    lock().
+
+    \see unlock_shared(), lock_stats()
+*/
+/** \fn void Fl::unlock_shared()
+    Releases the shared lock that was set using lock_shared().
+*/
+/** \fn void Fl::lock_stats(Fl_Lock_Stats *stats)
+    Copies the contention statistics of lock() and lock_shared()
+    into \p stats: how often the lock was taken, how often and how long
+    threads had to wait for it, and how long lock() held it.
+    The statistics are only collected for POSIX threads; on other
+    platforms they remain 0.
+    \see reset_lock_stats()
+*/
+/** \fn void Fl::reset_lock_stats()
+    Resets all lock statistics to 0.
+    \see lock_stats()
+*/
 #ifdef WIN32
 #  include <windows.h>
 #  include <process.h>
@@ -202,19 +301,6 @@ static DWORD main_thread;
 
 // Microsoft's version of a MUTEX...
 CRITICAL_SECTION cs;
-CRITICAL_SECTION *cs_ring;
-
-void unlock_ring() {
-  LeaveCriticalSection(cs_ring);
-}
-
-void lock_ring() {
-  if (!cs_ring) {
-    cs_ring = (CRITICAL_SECTION*)malloc(sizeof(CRITICAL_SECTION));
-    InitializeCriticalSection(cs_ring);
-  }
-  EnterCriticalSection(cs_ring);
-}
 
 //
 // 'unlock_function()' - Release the lock.
@@ -249,93 +335,198 @@ void Fl::unlock() {
   unlock_function();
 }
 
+void Fl::lock_shared() {
+  lock();
+}
+
+void Fl::unlock_shared() {
+  unlock();
+}
+
+void Fl::lock_stats(Fl_Lock_Stats *stats) {
+  memset(stats, 0, sizeof(*stats));
+}
+
+void Fl::reset_lock_stats() {
+}
+
 void Fl::awake(void* msg) {
   PostThreadMessage( main_thread, fl_wake_msg, (WPARAM)msg, 0);
 }
 
+static void awake_send() {
+  PostThreadMessage( main_thread, fl_wake_msg, 0, 0);
+}
+
 ////////////////////////////////////////////////////////////////
 // POSIX threading...
 #elif defined(HAVE_PTHREAD)
 #  include <unistd.h>
 #  include <fcntl.h>
 #  include <pthread.h>
+#  if HAVE_SYS_EVENTFD_H
+#    include <sys/eventfd.h>
+#  endif
 
-// Pipe for thread messaging via Fl::awake()...
+// Pipe for thread messaging via Fl::awake(void*), and an eventfd (if
+// available) to wake up the main thread for Fl::awake(Fl_Awake_Handler)...
 static int thread_filedes[2];
+static int thread_eventfd = -1;
+
+// Reader-writer lock for Fl::lock() and Fl::lock_shared(). Fl::lock() is
+// recursive and is held by one thread at a time, Fl::lock_shared() can be
+// held by any number of threads if nobody holds or waits for Fl::lock().
+static pthread_mutex_t lock_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lock_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t owner;         // the thread that holds Fl::lock()
+static int counter;             // how often owner called Fl::lock()
+static int readers;             // number of threads in Fl::lock_shared()
+static int writers_waiting, readers_waiting;
+static double hold_start;
+static Fl_Lock_Stats lock_stats_;
+
+extern double fl_clock();
+
+// Count a wait for the lock, called with lock_mutex locked.
+static void lock_waited(double start) {
+  double t = fl_clock() - start;
+  lock_stats_.contended++;
+  lock_stats_.wait_time += t;
+  if (t > lock_stats_.max_wait) lock_stats_.max_wait = t;
+}
 
-// Mutex and state information for Fl::lock() and Fl::unlock()...
-static pthread_mutex_t fltk_mutex;
-static pthread_t owner;
-static int counter;
-
-static void lock_function_init_std() {
-  pthread_mutex_init(&fltk_mutex, NULL);
+static void lock_function() {
+  pthread_t self = pthread_self();
+  pthread_mutex_lock(&lock_mutex);
+  if (counter && pthread_equal(owner, self)) {
+    counter++;
+  } else {
+    if (counter || readers) {
+      double start = fl_clock();
+      writers_waiting++;
+      while (counter || readers) pthread_cond_wait(&lock_cond, &lock_mutex);
+      writers_waiting--;
+      lock_waited(start);
+    }
+    owner = self;
+    counter = 1;
+    lock_stats_.exclusive++;
+    hold_start = fl_clock();
+  }
+  pthread_mutex_unlock(&lock_mutex);
 }
 
-static void lock_function_std() {
-  if (!counter || owner != pthread_self()) {
-    pthread_mutex_lock(&fltk_mutex);
-    owner = pthread_self();
+static void unlock_function() {
+  pthread_mutex_lock(&lock_mutex);
+  if (!--counter) {
+    double t = fl_clock() - hold_start;
+    lock_stats_.hold_time += t;
+    if (t > lock_stats_.max_hold) lock_stats_.max_hold = t;
+    if (writers_waiting || readers_waiting) pthread_cond_broadcast(&lock_cond);
   }
-  counter++;
+  pthread_mutex_unlock(&lock_mutex);
 }
 
-static void unlock_function_std() {
-  if (!--counter) pthread_mutex_unlock(&fltk_mutex);
+void Fl::lock_shared() {
+  pthread_t self = pthread_self();
+  pthread_mutex_lock(&lock_mutex);
+  if (counter && pthread_equal(owner, self)) {
+    pthread_mutex_unlock(&lock_mutex);
+    lock_function();
+    return;
+  }
+  if (counter || writers_waiting) {
+    double start = fl_clock();
+    readers_waiting++;
+    while (counter || writers_waiting) pthread_cond_wait(&lock_cond, &lock_mutex);
+    readers_waiting--;
+    lock_waited(start);
+  }
+  readers++;
+  lock_stats_.shared++;
+  pthread_mutex_unlock(&lock_mutex);
 }
 
-#  ifdef PTHREAD_MUTEX_RECURSIVE
-static bool lock_function_init_rec() {
-  pthread_mutexattr_t attrib;
-  pthread_mutexattr_init(&attrib);
-  if (pthread_mutexattr_settype(&attrib, PTHREAD_MUTEX_RECURSIVE)) {
-    pthread_mutexattr_destroy(&attrib);
-    return true;
+void Fl::unlock_shared() {
+  pthread_t self = pthread_self();
+  pthread_mutex_lock(&lock_mutex);
+  if (counter && pthread_equal(owner, self)) {
+    pthread_mutex_unlock(&lock_mutex);
+    unlock_function();
+    return;
   }
+  if (!--readers && writers_waiting) pthread_cond_broadcast(&lock_cond);
+  pthread_mutex_unlock(&lock_mutex);
+}
 
-  pthread_mutex_init(&fltk_mutex, &attrib);
-  return false;
+void Fl::lock_stats(Fl_Lock_Stats *stats) {
+  pthread_mutex_lock(&lock_mutex);
+  *stats = lock_stats_;
+  pthread_mutex_unlock(&lock_mutex);
 }
 
-static void lock_function_rec() {
-  pthread_mutex_lock(&fltk_mutex);
+void Fl::reset_lock_stats() {
+  pthread_mutex_lock(&lock_mutex);
+  memset(&lock_stats_, 0, sizeof(lock_stats_));
+  pthread_mutex_unlock(&lock_mutex);
 }
 
-static void unlock_function_rec() {
-  pthread_mutex_unlock(&fltk_mutex);
+// Only read and written by the main thread, in thread_awake_cb() and
+// Fl::thread_message():
+static void* thread_message_;
+
+static void awake_send() {
+#  if HAVE_SYS_EVENTFD_H
+  if (thread_eventfd >= 0) {
+    eventfd_write(thread_eventfd, 1);
+    return;
+  }
+#  endif // HAVE_SYS_EVENTFD_H
+  void* msg = 0;
+  if (write(thread_filedes[1], &msg, sizeof(void*))==0) { /* ignore */ }
 }
-#  endif // PTHREAD_MUTEX_RECURSIVE
 
 void Fl::awake(void* msg) {
   if (write(thread_filedes[1], &msg, sizeof(void*))==0) { /* ignore */ }
 }
 
-static void* thread_message_;
 void* Fl::thread_message() {
   void* r = thread_message_;
   thread_message_ = 0;
   return r;
 }
 
-static void thread_awake_cb(int fd, void*) {
-  if (read(fd, &thread_message_, sizeof(void*))==0) { 
-    /* This should never happen */
-  }
+static void thread_handlers() {
   Fl_Awake_Handler func;
   void *data;
   while (Fl::get_awake_handler_(func, data)==0) {
+    FL_TRACE("awake", func);
     (*func)(data);
   }
 }
 
+static void thread_awake_cb(int fd, void*) {
+  void* msg;
+  if (read(fd, &msg, sizeof(void*))==sizeof(void*)) thread_message_ = msg;
+  thread_handlers();
+}
+
+#  if HAVE_SYS_EVENTFD_H && defined(EFD_NONBLOCK)
+static void thread_eventfd_cb(int fd, void*) {
+  eventfd_t n;
+  eventfd_read(fd, &n);
+  thread_handlers();
+}
+#  endif // HAVE_SYS_EVENTFD_H && EFD_NONBLOCK
+
 // These pointers are in Fl_x.cxx:
 extern void (*fl_lock_function)();
 extern void (*fl_unlock_function)();
 
 int Fl::lock() {
   if (!thread_filedes[1]) {
-    // Initialize thread communication pipe to let threads awake FLTK
-    // from Fl::wait()
+    // Initialize thread communication to let threads awake FLTK
+    // from Fl::wait()...
     if (pipe(thread_filedes)==-1) {
       /* this should not happen */
     }
@@ -350,20 +541,17 @@ int Fl::lock() {
     // Fl::wait().
     Fl::add_fd(thread_filedes[0], FL_READ, thread_awake_cb);
 
-    // Set lock/unlock functions for this system, using a system-supplied
-    // recursive mutex if supported...
-#  ifdef PTHREAD_MUTEX_RECURSIVE
-    if (!lock_function_init_rec()) {
-      fl_lock_function   = lock_function_rec;
-      fl_unlock_function = unlock_function_rec;
-    } else {
-#  endif // PTHREAD_MUTEX_RECURSIVE
-      lock_function_init_std();
-      fl_lock_function   = lock_function_std;
-      fl_unlock_function = unlock_function_std;
-#  ifdef PTHREAD_MUTEX_RECURSIVE
-    }
-#  endif // PTHREAD_MUTEX_RECURSIVE
+#  if HAVE_SYS_EVENTFD_H && defined(EFD_NONBLOCK)
+    // Awake handlers only need a wakeup, not a message, and are sent
+    // through an eventfd if possible. Messages stay in the pipe, so that
+    // each one reaches Fl::thread_message().
+    thread_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (thread_eventfd >= 0)
+      Fl::add_fd(thread_eventfd, FL_READ, thread_eventfd_cb);
+#  endif // HAVE_SYS_EVENTFD_H && EFD_NONBLOCK
+
+    fl_lock_function   = lock_function;
+    fl_unlock_function = unlock_function;
   }
 
   fl_lock_function();
@@ -374,7 +562,8 @@ void Fl::unlock() {
   fl_unlock_function();
 }
 
-// Mutex code for the awake ring buffer
+#  if !FL_AWAKE_ATOMIC
+// Mutex code for the awake queue
 static pthread_mutex_t *ring_mutex;
 
 void unlock_ring() {
@@ -388,14 +577,20 @@ void lock_ring() {
   }
   pthread_mutex_lock(ring_mutex);
 }
+#  endif // !FL_AWAKE_ATOMIC
 
 #else
 
+#  if !FL_AWAKE_ATOMIC
 void unlock_ring() {
 }
 
 void lock_ring() {
 }
+#  endif // !FL_AWAKE_ATOMIC
+
+static void awake_send() {
+}
 
 void Fl::awake(void*) {
 }
@@ -407,6 +602,19 @@ int Fl::lock() {
 void Fl::unlock() {
 }
 
+void Fl::lock_shared() {
+}
+
+void Fl::unlock_shared() {
+}
+
+void Fl::lock_stats(Fl_Lock_Stats *stats) {
+  memset(stats, 0, sizeof(*stats));
+}
+
+void Fl::reset_lock_stats() {
+}
+
 void* Fl::thread_message() {
   return NULL;
 }
@@ -0,0 +1,433 @@
+//
+// "$Id$"
+//
+// Thread pool for the Fast Light Tool Kit (FLTK).
+//
+// Copyright 1998-2016 by Bill Spitzak and others.
+//
+// This library is free software. Distribution and use rights are outlined in
+// the file "COPYING" which should have been included with this file.  If this
+// file is missing or damaged, see the license at:
+//
+//     http://www.fltk.org/COPYING.php
+//
+// Please report all bugs and problems on the following page:
+//
+//     http://www.fltk.org/str.php
+//
+
+#include <FL/Fl.H>
+#include <config.h>
+#include <stdlib.h>
+#include "Fl_Trace.H"
+
+/*
+   Every worker thread of the pool has its own task queue, which is a
+   double ended queue with its own mutex. Fl::post_task() hands out the
+   tasks to the queues in turn. A worker takes the newest task off its
+   own queue, and when that is empty it steals the oldest task from the
+   queue of another worker, so the work spreads evenly over the threads
+   without a single queue that all threads fight over.
+
+   task_queued counts the tasks in all queues. A worker that finds no
+   task goes to sleep until a task is posted; the sleep lock makes sure
+   that it cannot miss the wakeup between looking at task_queued and
+   going to sleep.
+*/
+
+#if defined(WIN32) || defined(HAVE_PTHREAD)
+
+#  ifdef WIN32
+#    include <windows.h>
+#    include <process.h>
+#  else
+#    include <pthread.h>
+#    include <sched.h>
+#    include <unistd.h>
+#  endif // WIN32
+
+#  ifdef WIN32
+typedef CRITICAL_SECTION Task_Mutex;
+static void task_mutex_init(Task_Mutex *m) { InitializeCriticalSection(m); }
+static void task_lock(Task_Mutex *m) { EnterCriticalSection(m); }
+static void task_unlock(Task_Mutex *m) { LeaveCriticalSection(m); }
+#  else
+typedef pthread_mutex_t Task_Mutex;
+static void task_mutex_init(Task_Mutex *m) { pthread_mutex_init(m, NULL); }
+static void task_lock(Task_Mutex *m) { pthread_mutex_lock(m); }
+static void task_unlock(Task_Mutex *m) { pthread_mutex_unlock(m); }
+#  endif // WIN32
+
+struct Fl_Task {
+  Fl_Task_Handler func;
+  Fl_Awake_Handler done;
+  void *data;
+};
+
+struct Task_Queue {
+  Task_Mutex mutex;
+  Fl_Task *tasks;       // ring buffer
+  int alloc;            // size of tasks[]
+  int head;             // index of the oldest task
+  int count;            // number of tasks
+};
+
+static Task_Queue *task_queues;         // one queue per worker
+static int task_nthreads;               // number of running workers
+static int task_threads_;               // as set by Fl::task_threads()
+static volatile long task_queued;       // tasks in all queues
+static volatile unsigned long task_next;// queue for the next posted task
+
+static Task_Mutex task_start_mutex;     // serializes starting the pool
+static volatile int task_state;         // 0 = not started, 1 = running, -1 = failed
+
+#  ifdef WIN32
+static CRITICAL_SECTION task_sleep_mutex;
+static HANDLE task_sleep_sem;
+static int task_sleepers;
+#  else
+static pthread_mutex_t task_sleep_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t task_sleep_cond = PTHREAD_COND_INITIALIZER;
+#  endif // WIN32
+
+static long task_add(volatile long *p, long n) {
+#  if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 1))
+  return __sync_add_and_fetch(p, n);
+#  elif defined(WIN32)
+  return InterlockedExchangeAdd((LONG volatile *)p, n) + n;
+#  else
+  task_lock(&task_start_mutex);
+  long r = *p += n;
+  task_unlock(&task_start_mutex);
+  return r;
+#  endif
+}
+
+static void task_push(Task_Queue *q, const Fl_Task &t) {
+  task_lock(&q->mutex);
+  if (q->count == q->alloc) {
+    // grow the ring and move the tasks that wrapped around behind the old end
+    int n = q->alloc ? 2 * q->alloc : 64;
+    q->tasks = (Fl_Task *)realloc(q->tasks, n * sizeof(Fl_Task));
+    for (int i = 0; i < q->head; i++) q->tasks[q->alloc + i] = q->tasks[i];
+    q->alloc = n;
+  }
+  q->tasks[(q->head + q->count) % q->alloc] = t;
+  q->count++;
+  task_unlock(&q->mutex);
+}
+
+// Take the newest task off the worker's own queue (it is most likely
+// still in the cache), or the oldest one off another worker's queue.
+static int task_pop(Task_Queue *q, Fl_Task &t, int steal) {
+  int r = 0;
+  task_lock(&q->mutex);
+  if (q->count) {
+    if (steal) {
+      t = q->tasks[q->head];
+      q->head = (q->head + 1) % q->alloc;
+    } else {
+      t = q->tasks[(q->head + q->count - 1) % q->alloc];
+    }
+    q->count--;
+    r = 1;
+  }
+  task_unlock(&q->mutex);
+  return r;
+}
+
+static void task_sleep() {
+#  ifdef WIN32
+  EnterCriticalSection(&task_sleep_mutex);
+  if (task_queued > 0) {
+    LeaveCriticalSection(&task_sleep_mutex);
+    return;
+  }
+  task_sleepers++;
+  LeaveCriticalSection(&task_sleep_mutex);
+  WaitForSingleObject(task_sleep_sem, INFINITE);
+#  else
+  pthread_mutex_lock(&task_sleep_mutex);
+  while (task_queued <= 0) pthread_cond_wait(&task_sleep_cond, &task_sleep_mutex);
+  pthread_mutex_unlock(&task_sleep_mutex);
+#  endif // WIN32
+}
+
+static void task_wakeup() {
+#  ifdef WIN32
+  EnterCriticalSection(&task_sleep_mutex);
+  if (task_sleepers) {
+    task_sleepers--;
+    ReleaseSemaphore(task_sleep_sem, 1, NULL);
+  }
+  LeaveCriticalSection(&task_sleep_mutex);
+#  else
+  pthread_mutex_lock(&task_sleep_mutex);
+  pthread_cond_signal(&task_sleep_cond);
+  pthread_mutex_unlock(&task_sleep_mutex);
+#  endif // WIN32
+}
+
+static void task_run(int self) {
+  for (;;) {
+    Fl_Task t;
+    int found = task_pop(task_queues + self, t, 0);
+    for (int i = 1; !found && i < task_nthreads; i++)
+      found = task_pop(task_queues + (self + i) % task_nthreads, t, 1);
+    if (!found) {
+      task_sleep();
+      continue;
+    }
+    task_add(&task_queued, -1);
+    {
+      FL_TRACE("task", t.func);
+      t.func(t.data);
+    }
+    if (t.done) Fl::awake(t.done, t.data);
+  }
+}
+
+#  ifdef WIN32
+static unsigned __stdcall task_thread(void *arg) {
+  task_run((int)(size_t)arg);
+  return 0;
+}
+#  else
+static void *task_thread(void *arg) {
+  task_run((int)(size_t)arg);
+  return NULL;
+}
+#  endif // WIN32
+
+static int task_cpus() {
+#  ifdef WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return (int)info.dwNumberOfProcessors;
+#  elif defined(_SC_NPROCESSORS_ONLN)
+  return (int)sysconf(_SC_NPROCESSORS_ONLN);
+#  else
+  return 1;
+#  endif
+}
+
+// Start the workers. Returns 1 if the pool is running.
+static int task_start() {
+  if (task_state) return task_state > 0;
+#  ifdef WIN32
+  // CRITICAL_SECTIONs need to be initialized, so the first call to
+  // Fl::post_task() must not race with another one on WIN32.
+  static int initialized;
+  if (!initialized) {
+    initialized = 1;
+    task_mutex_init(&task_start_mutex);
+    InitializeCriticalSection(&task_sleep_mutex);
+    task_sleep_sem = CreateSemaphore(NULL, 0, 0x7fffffff, NULL);
+  }
+#  else
+  static pthread_mutex_t start_mutex = PTHREAD_MUTEX_INITIALIZER;
+  static int initialized;
+  pthread_mutex_lock(&start_mutex);
+  if (!initialized) {
+    initialized = 1;
+    task_mutex_init(&task_start_mutex);
+  }
+  pthread_mutex_unlock(&start_mutex);
+#  endif // WIN32
+  task_lock(&task_start_mutex);
+  if (!task_state) {
+    int n = task_threads_ > 0 ? task_threads_ : task_cpus();
+    if (n < 1) n = 1;
+    task_queues = (Task_Queue *)calloc(n, sizeof(Task_Queue));
+    for (int i = 0; task_queues && i < n; i++) task_mutex_init(&task_queues[i].mutex);
+    // Workers only look at the queues of started workers, so the count is
+    // raised before each thread is started.
+    for (int i = 0; task_queues && i < n; i++) {
+      task_nthreads = i + 1;
+#  ifdef WIN32
+      uintptr_t h = _beginthreadex(NULL, 0, task_thread, (void *)(size_t)i, 0, NULL);
+      if (!h) { task_nthreads = i; break; }
+      CloseHandle((HANDLE)h);
+#  else
+      pthread_t thread;
+      if (pthread_create(&thread, NULL, task_thread, (void *)(size_t)i)) {
+        task_nthreads = i;
+        break;
+      }
+      pthread_detach(thread);
+#  endif // WIN32
+    }
+    task_state = task_nthreads > 0 ? 1 : -1;
+  }
+  task_unlock(&task_start_mutex);
+  return task_state > 0;
+}
+
+/*
+   fl_parallel_for() hands out the indices of a job to the caller and to
+   pool tasks, which all take the next index until none is left. The
+   caller waits until the last index is done; tasks that start after
+   that find nothing to do. Whoever leaves the job last frees it, as the
+   caller may have returned long before a task gets to run.
+*/
+
+struct Parallel_Job {
+  void (*func)(void *data, int i);
+  void *data;
+  long n;
+  volatile long next;   // next index to run
+  volatile long done;   // indices done
+  volatile long users;  // caller and tasks that still use the job
+};
+
+static void parallel_run(Parallel_Job *job) {
+  long i;
+  while ((i = task_add(&job->next, 1) - 1) < job->n) {
+    job->func(job->data, (int)i);
+    task_add(&job->done, 1);
+  }
+}
+
+static void parallel_leave(Parallel_Job *job) {
+  if (task_add(&job->users, -1) == 0) delete job;
+}
+
+static void parallel_task(void *data) {
+  Parallel_Job *job = (Parallel_Job *)data;
+  parallel_run(job);
+  parallel_leave(job);
+}
+
+#endif // WIN32 || HAVE_PTHREAD
+
+/*
+  Internal: call func(data, i) for i = 0 ... n-1 in the calling thread and
+  in the thread pool, and return when all calls are done. The calls may
+  run in any order and in parallel, so each one must work on its own
+  part of the data.
+*/
+void fl_parallel_for(int n, void (*func)(void *data, int i), void *data) {
+#if defined(WIN32) || defined(HAVE_PTHREAD)
+  if (n > 1 && task_start() && task_nthreads > 1) {
+    int helpers = n - 1 < task_nthreads ? n - 1 : task_nthreads;
+    Parallel_Job *job = new Parallel_Job;
+    job->func = func;
+    job->data = data;
+    job->n = n;
+    job->next = 0;
+    job->done = 0;
+    job->users = helpers + 1;
+    for (int i = 0; i < helpers; i++) Fl::post_task(parallel_task, 0, job);
+    parallel_run(job);
+    // the calls still running take less time than one call, so just
+    // give their threads the processor until they are done:
+    while (task_add(&job->done, 0) < n) {
+#  ifdef WIN32
+      Sleep(0);
+#  else
+      sched_yield();
+#  endif // WIN32
+    }
+    parallel_leave(job);
+    return;
+  }
+#endif // WIN32 || HAVE_PTHREAD
+  for (int i = 0; i < n; i++) func(data, i);
+}
+
+/**
+  Runs a function in a thread of the FLTK thread pool.
+
+  The task \p func is called with \p data in one of the worker threads
+  of the pool. When it returns, the continuation \p done, if given, is
+  called with the same \p data in the main thread with Fl::awake(), so
+  that it can use the result of the task to update the user interface.
+  \p data is the only link between the task and its continuation; it
+  usually points to a structure that holds both the input and the
+  result of the task, which the continuation then frees.
+
+  Posting a task does not block. The pool is started by the first call,
+  with one worker per processor unless Fl::task_threads() says
+  otherwise. Tasks are spread over the workers, and a worker that runs
+  out of tasks steals them from the others, so many small tasks keep
+  all processors busy. Tasks may post further tasks.
+
+  Tasks run in parallel with each other and with the main thread, so
+  they must not use FLTK widgets or draw, and must protect shared data
+  themselves (or use Fl::lock()). The order in which tasks run and
+  complete is not defined.
+
+  As with Fl::awake(), the main thread must have called Fl::lock()
+  before a task with a continuation is posted.
+
+  If FLTK was built without thread support, or the worker threads could
+  not be started, \p func and \p done are called right away in the
+  calling thread.
+
+  \param func the task
+  \param done the continuation, or NULL
+  \param data passed to \p func and \p done
+  \return 0 if the task was queued, 1 if it was run in the calling thread
+  \see Fl::task_threads(), Fl::awake(Fl_Awake_Handler, void*)
+*/
+int Fl::post_task(Fl_Task_Handler func, Fl_Awake_Handler done, void *data) {
+#if defined(WIN32) || defined(HAVE_PTHREAD)
+  if (task_start()) {
+    Fl_Task t;
+    t.func = func;
+    t.done = done;
+    t.data = data;
+    unsigned long i;
+#  if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 1))
+    i = __sync_fetch_and_add(&task_next, 1);
+#  else
+    i = task_next++;    // a race only makes two tasks share a queue
+#  endif
+    task_push(task_queues + i % task_nthreads, t);
+    task_add(&task_queued, 1);
+    task_wakeup();
+    return 0;
+  }
+#endif // WIN32 || HAVE_PTHREAD
+  func(data);
+  if (done) done(data);
+  return 1;
+}
+
+/**
+  Sets the number of worker threads of the thread pool.
+
+  By default Fl::post_task() starts one worker per processor. This must
+  be called before the first task is posted; the pool does not change
+  its size once it runs.
+
+  \param n number of threads, or 0 for one per processor
+  \see Fl::post_task()
+*/
+void Fl::task_threads(int n) {
+#if defined(WIN32) || defined(HAVE_PTHREAD)
+  task_threads_ = n > 0 ? n : 0;
+#else
+  (void)n;
+#endif
+}
+
+/**
+  Returns the number of worker threads of the thread pool.
+
+  This is 0 until the first task is posted, and stays 0 if the pool
+  could not be started.
+
+  \see Fl::post_task()
+*/
+int Fl::task_threads() {
+#if defined(WIN32) || defined(HAVE_PTHREAD)
+  return task_state > 0 ? task_nthreads : 0;
+#else
+  return 0;
+#endif
+}
+
+//
+// End of "$Id$".
+//
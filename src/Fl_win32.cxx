@@ -436,29 +436,21 @@ int fl_wait(double time_to_wait) {
     DispatchMessageW(&fl_msg);
   }
 
-  // The following conditional test:
-  //    (Fl::awake_ring_head_ != Fl::awake_ring_tail_)
-  // is a workaround / fix for STR #3143. This works, but a better solution
+  // The following call to process_awake_handler_requests() is a
+  // workaround / fix for STR #3143. This works, but a better solution
   // would be to understand why the PostThreadMessage() messages are not
   // seen by the main window if it is being dragged/ resized at the time.
-  // If a worker thread posts an awake callback to the ring buffer
+  // If a worker thread posts an awake callback to the awake queue
   // whilst the main window is unresponsive (if a drag or resize operation
   // is in progress) we may miss the PostThreadMessage(). So here, we check if
-  // there is anything pending in the awake ring buffer and if so process
-  // it. This is not strictly thread safe (for speed it compares the head
-  // and tail indices without first locking the ring buffer) but is intended
-  // only as a fall-back recovery mechanism if the awake processing stalls.
-  // If the test erroneously returns true (may happen if we test the indices
-  // whilst they are being modified) we will call process_awake_handler_requests()
-  // unnecessarily, but this has no harmful consequences so is safe to do.
+  // there is anything pending in the awake queue and if so process it.
+  // Checking the queue is cheap (a single read if it is empty), and
+  // processing it also re-enables the wakeups that Fl::awake() sends for
+  // the next awake callback.
   // Note also that if we miss the PostThreadMessage(), then thread_message_
   // will not be updated, so this is not a perfect solution, but it does
-  // recover and process any pending awake callbacks.
-  // Normally the ring buffer head and tail indices will match and this
-  // comparison will do nothing. Addresses STR #3143
-  if (Fl::awake_ring_head_ != Fl::awake_ring_tail_) {
-    process_awake_handler_requests();
-  }
+  // recover and process any pending awake callbacks. Addresses STR #3143
+  process_awake_handler_requests();
 
   Fl::flush();
 
@@ -40,6 +40,7 @@
 #  include <stdio.h>
 #  include <stdlib.h>
 #  include "flstring.h"
+#  include "Fl_Trace.H"
 #  include <unistd.h>
 #  include <time.h>
 #  include <sys/time.h>
@@ -73,6 +74,202 @@ static bool have_xfixes = false;
 #    include <X11/extensions/Xrender.h>
 #  endif
 
+////////////////////////////////////////////////////////////////
+// interface to epoll calls:
+
+#  if USE_EPOLL
+
+// File descriptors are watched with epoll if the kernel supports it.
+// Their handlers are kept in a table indexed by the file descriptor, so
+// add_fd() and remove_fd() take constant time, and fl_wait() only looks
+// at the file descriptors that epoll_wait() reports.
+// epoll refuses regular files, which poll() and select() report as always
+// ready; those are kept in a short list and called on every fl_wait().
+
+#    include <sys/epoll.h>
+#    include <poll.h>
+#    include <fcntl.h>
+#    include <errno.h>
+
+struct FD_Handler {
+  short events;                 // FL_READ, FL_WRITE, FL_EXCEPT, FL_EDGE_TRIGGERED
+  void (*cb)(int, void*);
+  void* arg;
+};
+struct FD_Slot {
+  int nhandlers;                // at most one per FL_READ, FL_WRITE, FL_EXCEPT
+  unsigned registered;          // epoll events the fd is registered with
+  char always_ready;            // epoll refused the fd
+  FD_Handler handler[3];
+};
+
+extern void (*fl_lock_function)();
+extern void (*fl_unlock_function)();
+
+static int epoll_fd = -2;       // -2 if not tried yet, -1 if not available
+static FD_Slot *fd_slots = 0;
+static int fd_slots_size = 0;
+static int epoll_nfds = 0;      // number of fds with handlers
+static int *always_ready = 0;
+static int always_ready_count = 0, always_ready_size = 0;
+
+static int epoll_available() {
+  if (epoll_fd == -2) {
+    epoll_fd = epoll_create(64);
+    if (epoll_fd >= 0) fcntl(epoll_fd, F_SETFD, FD_CLOEXEC);
+  }
+  return epoll_fd >= 0;
+}
+
+// Tell epoll about the current events of a file descriptor.
+static void epoll_update(int n) {
+  FD_Slot &s = fd_slots[n];
+  int events = 0;
+  for (int i = 0; i < s.nhandlers; i++) events |= s.handler[i].events;
+  unsigned mask = 0;
+  if (events & FL_READ) mask |= EPOLLIN;
+  if (events & FL_WRITE) mask |= EPOLLOUT;
+  if (events & FL_EXCEPT) mask |= EPOLLPRI;
+  if (mask && (events & FL_EDGE_TRIGGERED)) mask |= EPOLLET;
+
+  if (s.always_ready) {
+    if (mask) return;
+    int i = 0;
+    while (always_ready[i] != n) i++;
+    always_ready[i] = always_ready[--always_ready_count];
+    s.always_ready = 0;
+    return;
+  }
+  if (mask == s.registered) return;
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = mask;
+  ev.data.fd = n;
+  if (!mask) {
+    // fails harmlessly if the fd was closed already
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, n, &ev);
+    s.registered = 0;
+    return;
+  }
+  int ret = epoll_ctl(epoll_fd, s.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, n, &ev);
+  // the fd may have been closed and reused without calling remove_fd():
+  if (ret < 0 && errno == ENOENT) ret = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, n, &ev);
+  else if (ret < 0 && errno == EEXIST) ret = epoll_ctl(epoll_fd, EPOLL_CTL_MOD, n, &ev);
+  if (ret < 0 && errno == EPERM) {
+    if (always_ready_count == always_ready_size) {
+      always_ready_size = always_ready_size ? 2 * always_ready_size : 8;
+      always_ready = (int*)realloc(always_ready, always_ready_size * sizeof(int));
+    }
+    always_ready[always_ready_count++] = n;
+    s.always_ready = 1;
+    mask = 0;
+  }
+  s.registered = ret < 0 ? 0 : mask;
+}
+
+static void epoll_remove_handlers(int n, int events) {
+  if (n < 0 || n >= fd_slots_size) return;
+  FD_Slot &s = fd_slots[n];
+  if (!s.nhandlers) return;
+  int j = 0;
+  for (int i = 0; i < s.nhandlers; i++) {
+    int e = s.handler[i].events & ~events;
+    if (!(e & (FL_READ | FL_WRITE | FL_EXCEPT))) continue; // delete this handler
+    s.handler[j] = s.handler[i];
+    s.handler[j].events = e;
+    j++;
+  }
+  s.nhandlers = j;
+  if (!j) epoll_nfds--;
+}
+
+static void epoll_add_fd(int n, int events, void (*cb)(int, void*), void *v) {
+  if (n < 0) return;
+  if (n >= fd_slots_size) {
+    int size = fd_slots_size ? 2 * fd_slots_size : 64;
+    while (size <= n) size *= 2;
+    FD_Slot *temp = (FD_Slot*)realloc(fd_slots, size * sizeof(FD_Slot));
+    if (!temp) return;
+    memset(temp + fd_slots_size, 0, (size - fd_slots_size) * sizeof(FD_Slot));
+    fd_slots = temp;
+    fd_slots_size = size;
+  }
+  epoll_remove_handlers(n, events & ~FL_EDGE_TRIGGERED);
+  FD_Slot &s = fd_slots[n];
+  if (!s.nhandlers) epoll_nfds++;
+  FD_Handler &h = s.handler[s.nhandlers++];
+  h.events = events;
+  h.cb = cb;
+  h.arg = v;
+  epoll_update(n);
+}
+
+// Call the handlers of a file descriptor that match the ready events.
+// The handlers may add or remove handlers, so check that each one is
+// still there before calling it.
+static void epoll_dispatch(int n, int revents) {
+  if (n >= fd_slots_size) return;
+  FD_Handler h[3];
+  int nh = fd_slots[n].nhandlers;
+  memcpy(h, fd_slots[n].handler, nh * sizeof(FD_Handler));
+  for (int i = 0; i < nh; i++) {
+    if (!(h[i].events & revents)) continue;
+    FD_Slot &s = fd_slots[n];
+    int j;
+    for (j = 0; j < s.nhandlers; j++)
+      if (s.handler[j].cb == h[i].cb && s.handler[j].arg == h[i].arg) break;
+    if (j < s.nhandlers) {
+      FL_TRACE("fd", h[i].cb);
+      h[i].cb(n, h[i].arg);
+    }
+  }
+}
+
+static int epoll_wait_(double time_to_wait) {
+  struct epoll_event ev[256];
+  int timeout = time_to_wait < 2147483.648 ? int(time_to_wait*1000 + .5) : -1;
+  if (always_ready_count) timeout = 0;
+
+  fl_unlock_function();
+  int n;
+  {
+    FL_TRACE("sleep", 0);
+    n = ::epoll_wait(epoll_fd, ev, sizeof(ev) / sizeof(ev[0]), timeout);
+  }
+  fl_lock_function();
+
+  if (n < 0) return n;
+  for (int i = 0; i < n; i++) {
+    unsigned e = ev[i].events;
+    int revents = 0;
+    if (e & (EPOLLIN | EPOLLHUP | EPOLLERR)) revents |= FL_READ;
+    if (e & (EPOLLOUT | EPOLLHUP | EPOLLERR)) revents |= FL_WRITE;
+    if (e & (EPOLLPRI | EPOLLERR)) revents |= FL_EXCEPT;
+    epoll_dispatch(ev[i].data.fd, revents);
+  }
+  for (int i = always_ready_count - 1; i >= 0; i--) {
+    if (i >= always_ready_count) continue; // removed by a callback
+    epoll_dispatch(always_ready[i], FL_READ | FL_WRITE);
+    n++;
+  }
+  return n;
+}
+
+static int epoll_ready() {
+  if (!epoll_nfds) return 0;
+  if (always_ready_count) return 1;
+  // the epoll fd is readable when any fd is ready; this does not consume
+  // edge triggered events like epoll_wait() would:
+  pollfd p;
+  p.fd = epoll_fd;
+  p.events = POLLIN;
+  p.revents = 0;
+  return ::poll(&p, 1, 0);
+}
+
+#  endif /* USE_EPOLL */
+
 ////////////////////////////////////////////////////////////////
 // interface to poll/select call:
 
@@ -91,9 +288,11 @@ static pollfd *pollfds = 0;
 
 static fd_set fdsets[3];
 static int maxfd;
-#    define POLLIN 1
-#    define POLLOUT 4
-#    define POLLERR 8
+#    ifndef POLLIN
+#      define POLLIN 1
+#      define POLLOUT 4
+#      define POLLERR 8
+#    endif
 
 #  endif /* USE_POLL */
 
@@ -111,6 +310,13 @@ struct FD {
 static FD *fd = 0;
 
 void Fl::add_fd(int n, int events, void (*cb)(int, void*), void *v) {
+#  if USE_EPOLL
+  if (epoll_available()) {
+    epoll_add_fd(n, events, cb, v);
+    return;
+  }
+#  endif
+  events &= ~FL_EDGE_TRIGGERED;
   remove_fd(n,events);
   int i = nfds++;
   if (i >= fd_array_size) {
@@ -153,6 +359,13 @@ void Fl::add_fd(int n, void (*cb)(int, void*), void* v) {
 }
 
 void Fl::remove_fd(int n, int events) {
+#  if USE_EPOLL
+  if (epoll_fd >= 0) {
+    epoll_remove_handlers(n, events);
+    if (n >= 0 && n < fd_slots_size) epoll_update(n);
+    return;
+  }
+#  endif
   int i,j;
 # if !USE_POLL
   maxfd = -1; // recalculate maxfd on the fly
@@ -200,14 +413,90 @@ static Fl_Window* send_motion;
 extern Fl_Window* fl_xmousewin;
 #endif
 static bool in_a_window; // true if in any of our windows, even destroyed ones
+
+// Events that only matter in their sum are merged before they are
+// handled: a run of motion events of the same window (with the same
+// buttons and modifiers) is handled as its last event, and a run of
+// Expose events of a window is merged into one damage region. Only
+// events that follow each other in the queue are merged, so the order
+// of the other events, button and key events in particular, is kept.
+// System handlers still see every event.
+
+// Take the events of the run that the next queued event continues off
+// the queue; returns 0 if there is no such event.
+static int next_in_run(const XEvent &xevent, XEvent &next) {
+  while (XEventsQueued(fl_display, QueuedAlready)) {
+    XPeekEvent(fl_display, &next);
+    if (next.type != xevent.type || next.xany.window != xevent.xany.window)
+      return 0;
+    if (next.type == MotionNotify && next.xmotion.state != xevent.xmotion.state)
+      return 0;
+    XNextEvent(fl_display, &next);
+    if (!fl_send_system_handlers(&next)) return 1;
+  }
+  return 0;
+}
+
+#  define FL_EXPOSE_RUN 32
+
+// Expose events come in runs, one event for each rectangle of the exposed
+// area. If the rectangles cover their bounding box, which is what mapping
+// or resizing a window mostly gives, the window is damaged by the box at
+// once, otherwise by each rectangle.
+static void handle_expose_run(XEvent &xevent) {
+  XRectangle r[FL_EXPOSE_RUN];
+  int n = 0;
+  XEvent next = xevent;
+  do {
+    r[n].x = next.xexpose.x;
+    r[n].y = next.xexpose.y;
+    r[n].width = next.xexpose.width;
+    r[n].height = next.xexpose.height;
+    n++;
+  } while (n < FL_EXPOSE_RUN && next_in_run(xevent, next));
+  if (n > 1) {
+    Region region = XCreateRegion();
+    for (int i = 0; i < n; i++) XUnionRectWithRegion(r + i, region, region);
+    XRectangle box;
+    XClipBox(region, &box);
+    if (XRectInRegion(region, box.x, box.y, box.width, box.height) == RectangleIn) {
+      r[0] = box;
+      n = 1;
+    }
+    XDestroyRegion(region);
+  }
+  for (int i = 0; i < n; i++) {
+    xevent.xexpose.x = r[i].x;
+    xevent.xexpose.y = r[i].y;
+    xevent.xexpose.width = r[i].width;
+    xevent.xexpose.height = r[i].height;
+    fl_handle(xevent);
+  }
+}
+
 static void do_queued_events() {
+  FL_TRACE("events", 0);
   in_a_window = true;
   while (XEventsQueued(fl_display,QueuedAfterReading)) {
     XEvent xevent;
     XNextEvent(fl_display, &xevent);
+    FL_TRACE_VALUE("event", xevent.type);
     if (fl_send_system_handlers(&xevent))
       continue;
-    fl_handle(xevent);
+    switch (xevent.type) {
+    case MotionNotify: {
+      XEvent next;
+      while (next_in_run(xevent, next)) xevent = next;
+      fl_handle(xevent);
+      break;}
+    case Expose:
+    case GraphicsExpose:
+      handle_expose_run(xevent);
+      break;
+    default:
+      fl_handle(xevent);
+      break;
+    }
   }
   // we send FL_LEAVE only if the mouse did not enter some other window:
   if (!in_a_window) Fl::handle(FL_LEAVE, 0);
@@ -234,6 +523,10 @@ int fl_wait(double time_to_wait) {
   // so we must check for already-read events:
   if (fl_display && XQLength(fl_display)) {do_queued_events(); return 1;}
 
+#  if USE_EPOLL
+  if (epoll_fd >= 0) return epoll_wait_(time_to_wait);
+#  endif
+
 #  if !USE_POLL
   fd_set fdt[3];
   fdt[0] = fdsets[0];
@@ -244,21 +537,24 @@ int fl_wait(double time_to_wait) {
 
   fl_unlock_function();
 
-  if (time_to_wait < 2147483.648) {
+  {
+    FL_TRACE("sleep", 0);
+    if (time_to_wait < 2147483.648) {
 #  if USE_POLL
-    n = ::poll(pollfds, nfds, int(time_to_wait*1000 + .5));
+      n = ::poll(pollfds, nfds, int(time_to_wait*1000 + .5));
 #  else
-    timeval t;
-    t.tv_sec = int(time_to_wait);
-    t.tv_usec = int(1000000 * (time_to_wait-t.tv_sec));
-    n = ::select(maxfd+1,&fdt[0],&fdt[1],&fdt[2],&t);
+      timeval t;
+      t.tv_sec = int(time_to_wait);
+      t.tv_usec = int(1000000 * (time_to_wait-t.tv_sec));
+      n = ::select(maxfd+1,&fdt[0],&fdt[1],&fdt[2],&t);
 #  endif
-  } else {
+    } else {
 #  if USE_POLL
-    n = ::poll(pollfds, nfds, -1);
+      n = ::poll(pollfds, nfds, -1);
 #  else
-    n = ::select(maxfd+1,&fdt[0],&fdt[1],&fdt[2],0);
+      n = ::select(maxfd+1,&fdt[0],&fdt[1],&fdt[2],0);
 #  endif
+    }
   }
 
   fl_lock_function();
@@ -266,14 +562,20 @@ int fl_wait(double time_to_wait) {
   if (n > 0) {
     for (int i=0; i<nfds; i++) {
 #  if USE_POLL
-      if (pollfds[i].revents) fd[i].cb(pollfds[i].fd, fd[i].arg);
+      if (pollfds[i].revents) {
+        FL_TRACE("fd", fd[i].cb);
+        fd[i].cb(pollfds[i].fd, fd[i].arg);
+      }
 #  else
       int f = fd[i].fd;
       short revents = 0;
       if (FD_ISSET(f,&fdt[0])) revents |= POLLIN;
       if (FD_ISSET(f,&fdt[1])) revents |= POLLOUT;
       if (FD_ISSET(f,&fdt[2])) revents |= POLLERR;
-      if (fd[i].events & revents) fd[i].cb(f, fd[i].arg);
+      if (fd[i].events & revents) {
+        FL_TRACE("fd", fd[i].cb);
+        fd[i].cb(f, fd[i].arg);
+      }
 #  endif
     }
   }
@@ -283,6 +585,9 @@ int fl_wait(double time_to_wait) {
 // fl_ready() is just like fl_wait(0.0) except no callbacks are done:
 int fl_ready() {
   if (XQLength(fl_display)) return 1;
+#  if USE_EPOLL
+  if (epoll_fd >= 0) return epoll_ready();
+#  endif
   if (!nfds) return 0; // nothing to select or poll
 #  if USE_POLL
   return ::poll(pollfds, nfds, 0);
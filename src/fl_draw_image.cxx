@@ -54,7 +54,9 @@
 #  include <FL/fl_draw.H>
 #  include <FL/x.H>
 #  include "Fl_XColor.H"
+#  include "fl_pixel_convert.h"
 #  include "flstring.h"
+#  include <stdlib.h>
 
 static XImage xi;	// template used to pass info to X
 static int bytes_per_pixel;
@@ -254,6 +256,7 @@ static void m565_converter(const uchar *from,uchar *to,int w, int delta) {
 // 24bit TrueColor converters:
 
 static void rgb_converter(const uchar *from, uchar *to, int w, int delta) {
+  if (delta == 3) {memcpy(to, from, 3*w); return;}
   int d = delta-3;
   for (; w--; from += d) {
     *to++ = *from++;
@@ -347,6 +350,24 @@ mono32_converter(const uchar *from,uchar *to,int w, int delta) {
     (*from << fl_redshift)+(*from << fl_greenshift)+(*from << fl_blueshift));
 }
 
+static void (*premul_converter)(const uchar *from, uchar *to, int w, int delta)
+  = argb_premul_converter;
+
+////////////////////////////////////////////////////////////////
+// The 32bit converters above in SSE2, SSSE3 or AVX2, see fl_pixel_convert.cxx.
+// The 16bit converters cannot be vectorized like this, as the error
+// diffusion carries from one pixel to the next.
+
+static const signed char *pixel_order;	// byte order of 32bit pixels, or NULL
+
+static void simd_converter(const uchar *from, uchar *to, int w, int delta) {
+  fl_pixel_shuffle32(from, to, w, delta, pixel_order);
+}
+
+static void simd_premul_converter(const uchar *from, uchar *to, int w, int delta) {
+  fl_pixel_premul32(from, to, w, delta);
+}
+
 ////////////////////////////////////////////////////////////////
 
 static void figure_out_visual() {
@@ -446,6 +467,16 @@ static void figure_out_visual() {
       converter = color32_converter;
       mono_converter = mono32_converter;
     }
+#  if !WORDS_BIGENDIAN
+    if (converter == xrgb_converter) pixel_order = fl_pixel_xrgb;
+    else if (converter == xbgr_converter) pixel_order = fl_pixel_xbgr;
+    else if (converter == rgbx_converter) pixel_order = fl_pixel_rgbx;
+    else if (converter == bgrx_converter) pixel_order = fl_pixel_bgrx;
+    if (fl_pixel_simd_level() >= FL_PIXEL_SSE2)
+      premul_converter = simd_premul_converter;
+    if (pixel_order && fl_pixel_simd_level() >= FL_PIXEL_SSSE3)
+      converter = simd_converter;
+#  endif // !WORDS_BIGENDIAN
     break;
 
   default:
@@ -456,6 +487,164 @@ static void figure_out_visual() {
 
 #  define MAXBUFFER 0x40000 // 256k
 
+// The converted image is sent to the server in strips, which are put
+// into the memory returned by begin_strip(), and drawn by end_strip().
+
+static STORETYPE *buffer;	// our storage, always word aligned
+static long buffer_size;
+
+#  if USE_XSHM
+
+#    include <sys/ipc.h>
+#    include <sys/shm.h>
+#    include <X11/extensions/XShm.h>
+
+// With the MIT-SHM extension the strips are converted into shared memory
+// segments, which the X server reads directly, instead of sending them
+// through the connection with XPutImage(). A segment is busy from its
+// XShmPutImage() until the server sends the XShmCompletion event for it,
+// which a system handler picks up. The segments are used in turn, so that
+// a strip can be converted while the server is still drawing the last
+// one; only when all of them are busy does begin_strip() wait for the
+// server. Displays on other hosts cannot attach our segments, so they
+// get XPutImage().
+
+#    define FL_SHM_SEGMENTS 4
+#    define FL_SHM_MAX 0x400000 // largest segment: 4M
+
+struct Shm_Segment {
+  XShmSegmentInfo info;
+  long size;		// 0 if not allocated
+  int busy;		// waiting for the XShmCompletion event
+};
+
+static Shm_Segment shm_segments[FL_SHM_SEGMENTS];
+static Shm_Segment *shm_strip;	// segment of the current strip, or NULL
+static int shm_next;		// index of the segment to use next
+static int shm_state;		// 0 = not tried yet, 1 = usable, -1 = not usable
+static int shm_completion;	// event type of XShmCompletion events
+static int shm_error;		// set by shm_error_handler()
+
+static int shm_error_handler(Display *, XErrorEvent *) {
+  shm_error = 1;
+  return 0;
+}
+
+static int shm_handler(void *event, void *) {
+  XEvent *e = (XEvent *)event;
+  if (e->type != shm_completion) return 0;
+  ShmSeg seg = ((XShmCompletionEvent *)e)->shmseg;
+  for (int i = 0; i < FL_SHM_SEGMENTS; i++)
+    if (shm_segments[i].size && shm_segments[i].info.shmseg == seg)
+      shm_segments[i].busy = 0;
+  return 1;
+}
+
+static Bool shm_is_completion(Display *, XEvent *e, XPointer seg) {
+  return e->type == shm_completion &&
+         ((XShmCompletionEvent *)e)->shmseg == *(ShmSeg *)seg;
+}
+
+static int shm_available() {
+  if (!shm_state) {
+    shm_state = -1;
+    // only a server on this host can attach our segments:
+    const char *name = DisplayString(fl_display);
+    if ((name[0] == ':' || !strncmp(name, "unix:", 5)) &&
+        XShmQueryExtension(fl_display)) {
+      shm_completion = XShmGetEventBase(fl_display) + ShmCompletion;
+      Fl::add_system_handler(shm_handler, 0);
+      shm_state = 1;
+    }
+  }
+  return shm_state > 0;
+}
+
+static void shm_free(Shm_Segment *s) {
+  if (!s->size) return;
+  XShmDetach(fl_display, &s->info);
+  shmdt(s->info.shmaddr);
+  s->size = 0;
+  s->busy = 0;
+}
+
+static int shm_alloc(Shm_Segment *s, long size, int readonly) {
+  s->info.shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+  if (s->info.shmid < 0) return 0;
+  s->info.shmaddr = (char *)shmat(s->info.shmid, 0, 0);
+  if (s->info.shmaddr == (char *)-1) {
+    shmctl(s->info.shmid, IPC_RMID, 0);
+    return 0;
+  }
+  s->info.readOnly = readonly ? True : False;
+  // attach synchronously, so that a failure can be caught:
+  XSync(fl_display, False);
+  shm_error = 0;
+  XErrorHandler old_handler = XSetErrorHandler(shm_error_handler);
+  XShmAttach(fl_display, &s->info);
+  XSync(fl_display, False);
+  XSetErrorHandler(old_handler);
+  // the segment is removed when both the server and we detached it:
+  shmctl(s->info.shmid, IPC_RMID, 0);
+  if (shm_error) {
+    shmdt(s->info.shmaddr);
+    return 0;
+  }
+  s->size = size;
+  return 1;
+}
+
+// Get the next segment with at least size bytes, or NULL:
+static Shm_Segment *shm_get(long size) {
+  Shm_Segment *s = shm_segments + shm_next;
+  shm_next = (shm_next + 1) % FL_SHM_SEGMENTS;
+  if (s->busy) {
+    XEvent e;
+    XIfEvent(fl_display, &e, shm_is_completion, (XPointer)&s->info.shmseg);
+    s->busy = 0;
+  }
+  if (s->size < size) {
+    shm_free(s);
+    // allocate in steps of 64k, so that segments are not replaced as often:
+    if (!shm_alloc(s, (size + 0xffff) & ~0xffffL, 1)) {
+      // don't try again, XPutImage() works as well
+      shm_state = -1;
+      return 0;
+    }
+  }
+  return s;
+}
+
+#  endif // USE_XSHM
+
+// Return memory for a strip of size STORETYPEs:
+static STORETYPE *begin_strip(long size) {
+#  if USE_XSHM
+  shm_strip = 0;
+  if (shm_state > 0 && (shm_strip = shm_get(size * sizeof(STORETYPE))))
+    return (STORETYPE *)shm_strip->info.shmaddr;
+#  endif // USE_XSHM
+  if (size > buffer_size) {
+    delete[] buffer;
+    buffer_size = size;
+    buffer = new STORETYPE[size];
+  }
+  return buffer;
+}
+
+// Draw the strip of k lines that begins at xi.data:
+static void end_strip(int X, int Y, int w, int k) {
+#  if USE_XSHM
+  if (shm_strip) {
+    xi.obdata = (char *)&shm_strip->info;
+    XShmPutImage(fl_display, fl_window, fl_gc, &xi, 0, 0, X, Y, w, k, True);
+    shm_strip->busy = 1;
+    return;
+  }
+#  endif // USE_XSHM
+  XPutImage(fl_display, fl_window, fl_gc, &xi, 0, 0, X, Y, w, k);
+}
+
 static void innards(const uchar *buf, int X, int Y, int W, int H,
 		    int delta, int linedelta, int mono,
 		    Fl_Draw_Image_Cb cb, void* userdata,
@@ -481,7 +670,7 @@ static void innards(const uchar *buf, int X, int Y, int W, int H,
   if (alpha) {
     // This flag states the destination format is ARGB32 (big-endian), pre-multiplied.
     bytes_per_pixel = 4;
-    conv = argb_premul_converter;
+    conv = premul_converter;
     xi.depth = 32;
     xi.bits_per_pixel = 32;
 
@@ -493,13 +682,20 @@ static void innards(const uchar *buf, int X, int Y, int W, int H,
     }
   }
 
+#  if USE_XSHM
+  // shared memory beats any shortcut:
+  const int shm = shm_available();
+#  else
+  const int shm = 0;
+#  endif // USE_XSHM
+
   // See if the data is already in the right format.  Unfortunately
   // some 32-bit x servers (XFree86) care about the unknown 8 bits
   // and they must be zero.  I can't confirm this for user-supplied
   // data, so the 32-bit shortcut is disabled...
   // This can set bytes_per_line negative if image is bottom-to-top
   // I tested it on Linux, but it may fail on other Xlib implementations:
-  if (buf && (
+  if (buf && !shm && (
 #  if 0	// set this to 1 to allow 32-bit shortcut
       delta == 4 &&
 #    if WORDS_BIGENDIAN
@@ -513,51 +709,38 @@ static void innards(const uchar *buf, int X, int Y, int W, int H,
       ) && !(linedelta&scanline_add)) {
     xi.data = (char *)(buf+delta*dx+linedelta*dy);
     xi.bytes_per_line = linedelta;
+    XPutImage(fl_display,fl_window,fl_gc, &xi, 0, 0, X+dx, Y+dy, w, h);
 
   } else {
     int linesize = ((w*bytes_per_pixel+scanline_add)&scanline_mask)/sizeof(STORETYPE);
     int blocking = h;
-    static STORETYPE *buffer;	// our storage, always word aligned
-    static long buffer_size;
-    {int size = linesize*h;
-    if (size > MAXBUFFER) {
-      size = MAXBUFFER;
-      blocking = MAXBUFFER/linesize;
-    }
-    if (size > buffer_size) {
-      delete[] buffer;
-      buffer_size = size;
-      buffer = new STORETYPE[size];
-    }}
-    xi.data = (char *)buffer;
+#  if USE_XSHM
+    int maxsize = shm ? FL_SHM_MAX/sizeof(STORETYPE) : MAXBUFFER;
+#  else
+    int maxsize = MAXBUFFER;
+#  endif // USE_XSHM
+    if (linesize*h > maxsize) blocking = maxsize/linesize > 1 ? maxsize/linesize : 1;
     xi.bytes_per_line = linesize*sizeof(STORETYPE);
-    if (buf) {
-      buf += delta*dx+linedelta*dy;
-      for (int j=0; j<h; ) {
-	STORETYPE *to = buffer;
-	int k;
-	for (k = 0; j<h && k<blocking; k++, j++) {
+    STORETYPE* linebuf = 0;
+    if (buf) buf += delta*dx+linedelta*dy;
+    else linebuf = new STORETYPE[(W*delta+(sizeof(STORETYPE)-1))/sizeof(STORETYPE)];
+    for (int j=0; j<h; ) {
+      int k = h-j < blocking ? h-j : blocking;
+      STORETYPE *to = begin_strip(linesize*k);
+      xi.data = (char *)to;
+      for (int l = 0; l < k; l++, j++) {
+	if (buf) {
 	  conv(buf, (uchar*)to, w, delta);
 	  buf += linedelta;
-	  to += linesize;
-	}
-	XPutImage(fl_display,fl_window,fl_gc, &xi, 0, 0, X+dx, Y+dy+j-k, w, k);
-      }
-    } else {
-      STORETYPE* linebuf = new STORETYPE[(W*delta+(sizeof(STORETYPE)-1))/sizeof(STORETYPE)];
-      for (int j=0; j<h; ) {
-	STORETYPE *to = buffer;
-	int k;
-	for (k = 0; j<h && k<blocking; k++, j++) {
+	} else {
 	  cb(userdata, dx, dy+j, w, (uchar*)linebuf);
 	  conv((uchar*)linebuf, (uchar*)to, w, delta);
-	  to += linesize;
 	}
-	XPutImage(fl_display,fl_window,fl_gc, &xi, 0, 0, X+dx, Y+dy+j-k, w, k);
+	to += linesize;
       }
-
-      delete[] linebuf;
+      end_strip(X+dx, Y+dy+j-k, w, k);
     }
+    delete[] linebuf;
   }
 
   if (alpha) {
@@ -599,6 +782,106 @@ void Fl_Xlib_Graphics_Driver::draw_image_mono(Fl_Draw_Image_Cb cb, void* data,
   innards(0,x,y,w,h,d,0,1,cb,data,0);
 }
 
+////////////////////////////////////////////////////////////////
+// Alpha compositing of Fl_RGB_Image when the server cannot do it, see
+// alpha_blend() in Fl_Image.cxx. The window pixels are read into an
+// image that is kept from one call to the next (a shared memory segment
+// on a local display), the premultiplied image pixels are composited
+// over them without converting them to RGB and back, and the result is
+// drawn again.
+
+static XImage *blend_image;	// the window pixels without MIT-SHM
+#  if USE_XSHM
+static Shm_Segment shm_blend;	// the window pixels with MIT-SHM
+#  endif // USE_XSHM
+static int blend_error;		// set by blend_error_handler()
+
+static int blend_error_handler(Display *, XErrorEvent *) {
+  blend_error = 1;
+  return 0;
+}
+
+/*
+ Return the byte order of the window pixels for fl_blend_image(), or
+ NULL if fl_blend_image() cannot be used with this visual.
+ */
+const signed char *fl_blend_order() {
+  if (!bytes_per_pixel) figure_out_visual();
+  return pixel_order;
+}
+
+/*
+ Composite W*H premultiplied pixels with the byte order fl_blend_order(),
+ ld bytes apart per line, over the window at X,Y. Returns 0 if nothing
+ was drawn because the window pixels could not be read, e.g. because a
+ part of the window is off screen.
+ */
+int fl_blend_image(const uchar *pixels, int ld, int X, int Y, int W, int H) {
+  if (!fl_blend_order()) return 0;
+  const int alpha = pixel_order[0] < 0 ? 0 : 3;
+  XImage *image = 0;
+  int shm = 0;
+  blend_error = 0;
+  XErrorHandler old_handler = XSetErrorHandler(blend_error_handler);
+#  if USE_XSHM
+  if (shm_available() && (long)W * H * 4 <= FL_SHM_MAX) {
+    image = XShmCreateImage(fl_display, fl_visual->visual, fl_visual->depth,
+                            ZPixmap, 0, &shm_blend.info, W, H);
+    long size = image ? (long)image->bytes_per_line * H : 0;
+    if (size && shm_blend.size < size) {
+      shm_free(&shm_blend);
+      if (!shm_alloc(&shm_blend, (size + 0xffff) & ~0xffffL, 0)) size = 0;
+    }
+    if (size) {
+      // the server is done with the last XShmPutImage() when this returns:
+      image->data = shm_blend.info.shmaddr;
+      shm = XShmGetImage(fl_display, fl_window, image, X, Y, AllPlanes) &&
+            !blend_error;
+    }
+    if (!shm && image) {
+      image->data = 0;
+      XDestroyImage(image);
+      image = 0;
+    }
+  }
+#  endif // USE_XSHM
+  if (!shm) {
+    blend_error = 0;
+    if (!blend_image || blend_image->width < W || blend_image->height < H) {
+      int w = W, h = H;
+      if (blend_image) {
+        if (blend_image->width > w) w = blend_image->width;
+        if (blend_image->height > h) h = blend_image->height;
+        XDestroyImage(blend_image);
+      }
+      blend_image = XCreateImage(fl_display, fl_visual->visual, fl_visual->depth,
+                                 ZPixmap, 0, 0, w, h, 32, 0);
+      if (blend_image)
+        blend_image->data = (char *)malloc(blend_image->bytes_per_line * h);
+    }
+    if (blend_image && blend_image->data &&
+        XGetSubImage(fl_display, fl_window, X, Y, W, H, AllPlanes, ZPixmap,
+                     blend_image, 0, 0) && !blend_error)
+      image = blend_image;
+  }
+  XSetErrorHandler(old_handler);
+  if (!image) return 0;
+
+  for (int y = 0; y < H; y++)
+    fl_pixel_blend32(pixels + y * ld,
+                     (uchar *)image->data + y * image->bytes_per_line, W, alpha);
+#  if USE_XSHM
+  if (shm) {
+    XShmPutImage(fl_display, fl_window, fl_gc, image, 0, 0, X, Y, W, H, False);
+    image->data = 0;
+    XDestroyImage(image);
+    return 1;
+  }
+#  endif // USE_XSHM
+  XPutImage(fl_display, fl_window, fl_gc, image, 0, 0, X, Y, W, H);
+  return 1;
+}
+
 void fl_rectf(int x, int y, int w, int h, uchar r, uchar g, uchar b) {
   if (fl_visual->depth > 16) {
     fl_color(r,g,b);
@@ -0,0 +1,374 @@
+//
+// "$Id$"
+//
+// Pixel conversion kernels for the Fast Light Tool Kit (FLTK).
+//
+// Copyright 1998-2016 by Bill Spitzak and others.
+//
+// This library is free software. Distribution and use rights are outlined in
+// the file "COPYING" which should have been included with this file.  If this
+// file is missing or damaged, see the license at:
+//
+//     http://www.fltk.org/COPYING.php
+//
+// Please report all bugs and problems on the following page:
+//
+//     http://www.fltk.org/str.php
+//
+
+#include <config.h>
+#include "fl_pixel_convert.h"
+
+// The vector kernels need GCC or Clang style target attributes so that
+// they can be compiled without raising the baseline of the whole library.
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__)) && !WORDS_BIGENDIAN
+#  define FL_PIXEL_X86 1
+#  include <immintrin.h>
+#else
+#  define FL_PIXEL_X86 0
+#endif
+
+const signed char fl_pixel_xrgb[4] = {2, 1, 0, -1};
+const signed char fl_pixel_xbgr[4] = {0, 1, 2, -1};
+const signed char fl_pixel_rgbx[4] = {-1, 2, 1, 0};
+const signed char fl_pixel_bgrx[4] = {-1, 0, 1, 2};
+
+
+//
+// Portable kernels
+//
+
+static void shuffle32_c(const uchar *from, uchar *to, int w, int delta,
+                        const signed char *order) {
+  int o0 = order[0], o1 = order[1], o2 = order[2], o3 = order[3];
+  for (; w--; from += delta, to += 4) {
+    to[0] = o0 < 0 ? 0 : from[o0];
+    to[1] = o1 < 0 ? 0 : from[o1];
+    to[2] = o2 < 0 ? 0 : from[o2];
+    to[3] = o3 < 0 ? 0 : from[o3];
+  }
+}
+
+static void premul32_c(const uchar *from, uchar *to, int w, int delta) {
+  unsigned *t = (unsigned *)to;
+  for (; w--; from += delta)
+    *t++ = (unsigned(from[3]) << 24) +
+           (((from[0] * from[3]) / 255) << 16) +
+           (((from[1] * from[3]) / 255) << 8) +
+           ((from[2] * from[3]) / 255);
+}
+
+// Rounded t / 255 for 0 <= t <= 255*255:
+static inline unsigned div255(unsigned t) {
+  t += 128;
+  return (t + (t >> 8)) >> 8;
+}
+
+static void blend32_c(const uchar *from, uchar *to, int w, int alpha) {
+  for (; w--; from += 4, to += 4) {
+    unsigned ia = 255 - from[alpha];
+    for (int i = 0; i < 4; i++)
+      if (i != alpha) to[i] = (uchar)(from[i] + div255(to[i] * ia));
+  }
+}
+
+static void vfilter_tail(const short *const *rows, const short *weights,
+                         int n, int i, int len, uchar *to) {
+  for (; i < len; i++) {
+    int t = 1 << 13;
+    for (int k = 0; k < n; k++) t += weights[k] * rows[k][i];
+    t >>= 14;
+    to[i] = (uchar)(t < 0 ? 0 : t > 255 ? 255 : t);
+  }
+}
+
+static void vfilter_c(const short *const *rows, const short *weights,
+                      int n, int len, uchar *to) {
+  vfilter_tail(rows, weights, n, 0, len, to);
+}
+
+
+#if FL_PIXEL_X86
+
+// The shuffle control for 4 pixels of 3 or 4 bytes each; bytes with the
+// high bit set become 0.
+static void shuffle_mask(char *m, int delta, const signed char *order) {
+  for (int i = 0; i < 16; i++) {
+    int o = order[i & 3];
+    m[i] = o < 0 ? (char)0x80 : (char)((i >> 2) * delta + o);
+  }
+}
+
+
+//
+// SSE2 kernel: premultiply 4 pixels per step in 16 bit lanes. For
+// 0 <= t <= 255*255, t/255 == (t + 1 + (t >> 8)) >> 8.
+//
+
+__attribute__((target("sse2")))
+static void premul32_sse2(const uchar *from, uchar *to, int w, int delta) {
+  if (delta == 4) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i alpha = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+    for (; w >= 4; w -= 4, from += 16, to += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i*)from);
+      __m128i p[2];
+      p[0] = _mm_unpacklo_epi8(v, zero);
+      p[1] = _mm_unpackhi_epi8(v, zero);
+      for (int i = 0; i < 2; i++) {
+        __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(p[i], 0xff), 0xff);
+        __m128i t = _mm_mullo_epi16(p[i], a);
+        t = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(t, one),
+                                         _mm_srli_epi16(t, 8)), 8);
+        t = _mm_or_si128(_mm_andnot_si128(alpha, t), _mm_and_si128(alpha, p[i]));
+        // RGBA to BGRA, which is ARGB in a little endian word:
+        p[i] = _mm_shufflehi_epi16(_mm_shufflelo_epi16(t, 0xc6), 0xc6);
+      }
+      _mm_storeu_si128((__m128i*)to, _mm_packus_epi16(p[0], p[1]));
+    }
+  }
+  premul32_c(from, to, w, delta);
+}
+
+// Composite 4 pixels per step in 16 bit lanes. The shuffle that copies
+// the alpha value to all lanes of its pixel must be a constant, so the
+// alpha byte is a template argument.
+template <int ALPHA>
+__attribute__((target("sse2")))
+static void blend32_sse2(const uchar *from, uchar *to, int w) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16(255);
+  const __m128i half = _mm_set1_epi16(128);
+  const __m128i keep = _mm_set1_epi32((int)(0xffU << (ALPHA * 8)));
+  for (; w >= 4; w -= 4, from += 16, to += 16) {
+    __m128i s = _mm_loadu_si128((const __m128i*)from);
+    __m128i d = _mm_loadu_si128((const __m128i*)to);
+    __m128i p[2];
+    p[0] = _mm_unpacklo_epi8(d, zero);
+    p[1] = _mm_unpackhi_epi8(d, zero);
+    __m128i a[2];
+    a[0] = _mm_unpacklo_epi8(s, zero);
+    a[1] = _mm_unpackhi_epi8(s, zero);
+    for (int i = 0; i < 2; i++) {
+      a[i] = _mm_shufflehi_epi16(_mm_shufflelo_epi16(a[i], ALPHA * 0x55), ALPHA * 0x55);
+      __m128i t = _mm_add_epi16(_mm_mullo_epi16(p[i], _mm_sub_epi16(ones, a[i])), half);
+      p[i] = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+    }
+    __m128i r = _mm_adds_epu8(s, _mm_packus_epi16(p[0], p[1]));
+    r = _mm_or_si128(_mm_andnot_si128(keep, r), _mm_and_si128(keep, d));
+    _mm_storeu_si128((__m128i*)to, r);
+  }
+  blend32_c(from, to, w, ALPHA);
+}
+
+__attribute__((target("sse2")))
+static void blend32_sse2(const uchar *from, uchar *to, int w, int alpha) {
+  if (alpha) blend32_sse2<3>(from, to, w);
+  else blend32_sse2<0>(from, to, w);
+}
+
+// Filter 16 values per step: the rows are taken in pairs, so that
+// _mm_madd_epi16() multiplies and adds two of them at once.
+__attribute__((target("sse2")))
+static void vfilter_sse2(const short *const *rows, const short *weights,
+                         int n, int len, uchar *to) {
+  const __m128i half = _mm_set1_epi32(1 << 13);
+  int i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i acc[4] = { half, half, half, half };
+    for (int k = 0; k < n; k += 2) {
+      const short *r0 = rows[k] + i;
+      const short *r1 = k + 1 < n ? rows[k + 1] + i : r0;
+      int w1 = k + 1 < n ? weights[k + 1] : 0;
+      const __m128i w = _mm_set1_epi32((w1 << 16) | (weights[k] & 0xffff));
+      for (int j = 0; j < 2; j++) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(r0 + 8 * j));
+        __m128i b = _mm_loadu_si128((const __m128i*)(r1 + 8 * j));
+        acc[2 * j] = _mm_add_epi32(acc[2 * j], _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+        acc[2 * j + 1] = _mm_add_epi32(acc[2 * j + 1], _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+      }
+    }
+    for (int j = 0; j < 4; j++) acc[j] = _mm_srai_epi32(acc[j], 14);
+    _mm_storeu_si128((__m128i*)(to + i),
+                     _mm_packus_epi16(_mm_packs_epi32(acc[0], acc[1]),
+                                      _mm_packs_epi32(acc[2], acc[3])));
+  }
+  vfilter_tail(rows, weights, n, i, len, to);
+}
+
+
+//
+// SSSE3 kernel, 4 pixels per step
+//
+
+__attribute__((target("ssse3")))
+static void shuffle32_ssse3(const uchar *from, uchar *to, int w, int delta,
+                            const signed char *order) {
+  if (delta == 3 || delta == 4) {
+    char m[16];
+    shuffle_mask(m, delta, order);
+    const __m128i mask = _mm_loadu_si128((const __m128i*)m);
+    // 16 bytes are read for 4 pixels of 3 bytes, so 2 more must be left:
+    int n = delta == 3 ? 6 : 4;
+    for (; w >= n; w -= 4, from += 4 * delta, to += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i*)from);
+      _mm_storeu_si128((__m128i*)to, _mm_shuffle_epi8(v, mask));
+    }
+  }
+  shuffle32_c(from, to, w, delta, order);
+}
+
+
+//
+// AVX2 kernel, 8 pixels per step: each 128 bit lane gets 4 of them
+//
+
+__attribute__((target("avx2")))
+static void shuffle32_avx2(const uchar *from, uchar *to, int w, int delta,
+                           const signed char *order) {
+  if (delta == 3 || delta == 4) {
+    char m[16];
+    shuffle_mask(m, delta, order);
+    const __m128i m128 = _mm_loadu_si128((const __m128i*)m);
+    const __m256i mask = _mm256_inserti128_si256(_mm256_castsi128_si256(m128), m128, 1);
+    // the second lane is read from 4 * delta, 16 bytes:
+    int n = delta == 3 ? 10 : 8;
+    for (; w >= n; w -= 8, from += 8 * delta, to += 32) {
+      __m256i v = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)from)),
+        _mm_loadu_si128((const __m128i*)(from + 4 * delta)), 1);
+      _mm256_storeu_si256((__m256i*)to, _mm256_shuffle_epi8(v, mask));
+    }
+    // avoid the AVX to SSE transition penalty in the tail:
+    _mm256_zeroupper();
+  }
+  shuffle32_ssse3(from, to, w, delta, order);
+}
+
+
+// Filter 32 values per step like vfilter_sse2(). The unpacking and
+// packing work within the 128 bit lanes, so the 8 byte quarters of the
+// result need to be put in order at the end.
+__attribute__((target("avx2")))
+static void vfilter_avx2(const short *const *rows, const short *weights,
+                         int n, int len, uchar *to) {
+  const __m256i half = _mm256_set1_epi32(1 << 13);
+  int i = 0;
+  if (len >= 32) {
+    for (; i + 32 <= len; i += 32) {
+      __m256i acc[4] = { half, half, half, half };
+      for (int k = 0; k < n; k += 2) {
+        const short *r0 = rows[k] + i;
+        const short *r1 = k + 1 < n ? rows[k + 1] + i : r0;
+        int w1 = k + 1 < n ? weights[k + 1] : 0;
+        const __m256i w = _mm256_set1_epi32((w1 << 16) | (weights[k] & 0xffff));
+        for (int j = 0; j < 2; j++) {
+          __m256i a = _mm256_loadu_si256((const __m256i*)(r0 + 16 * j));
+          __m256i b = _mm256_loadu_si256((const __m256i*)(r1 + 16 * j));
+          acc[2 * j] = _mm256_add_epi32(acc[2 * j], _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), w));
+          acc[2 * j + 1] = _mm256_add_epi32(acc[2 * j + 1], _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), w));
+        }
+      }
+      for (int j = 0; j < 4; j++) acc[j] = _mm256_srai_epi32(acc[j], 14);
+      __m256i r = _mm256_packus_epi16(_mm256_packs_epi32(acc[0], acc[1]),
+                                      _mm256_packs_epi32(acc[2], acc[3]));
+      _mm256_storeu_si256((__m256i*)(to + i), _mm256_permute4x64_epi64(r, 0xd8));
+    }
+    _mm256_zeroupper();
+  }
+  vfilter_tail(rows, weights, n, i, len, to);
+}
+
+#endif // FL_PIXEL_X86
+
+
+//
+// Runtime dispatch
+//
+
+typedef void (*Shuffle_Fn)(const uchar*, uchar*, int, int, const signed char*);
+typedef void (*Premul_Fn)(const uchar*, uchar*, int, int);
+typedef void (*Vfilter_Fn)(const short *const*, const short*, int, int, uchar*);
+
+static Shuffle_Fn shuffle_fn = 0;
+static Premul_Fn premul_fn = 0;
+static Premul_Fn blend_fn = 0;
+static Vfilter_Fn vfilter_fn = 0;
+static int level_in_use;
+
+/*
+ Choose the best kernels for this processor, but none better than max.
+ Running this more than once is harmless because every run stores the
+ same values.
+ */
+static void init_kernels(int max) {
+  Shuffle_Fn sf = shuffle32_c;
+  Premul_Fn pf = premul32_c;
+  Premul_Fn bf = blend32_c;
+  Vfilter_Fn vf = vfilter_c;
+  int level = FL_PIXEL_C;
+#if FL_PIXEL_X86
+  __builtin_cpu_init();
+  if (max >= FL_PIXEL_AVX2 && __builtin_cpu_supports("avx2"))
+    level = FL_PIXEL_AVX2;
+  else if (max >= FL_PIXEL_SSSE3 && __builtin_cpu_supports("ssse3"))
+    level = FL_PIXEL_SSSE3;
+  else if (max >= FL_PIXEL_SSE2 && __builtin_cpu_supports("sse2"))
+    level = FL_PIXEL_SSE2;
+  if (level >= FL_PIXEL_SSE2) {
+    pf = premul32_sse2;
+    bf = blend32_sse2;
+    vf = vfilter_sse2;
+  }
+  if (level == FL_PIXEL_SSSE3) sf = shuffle32_ssse3;
+  if (level == FL_PIXEL_AVX2) {
+    sf = shuffle32_avx2;
+    vf = vfilter_avx2;
+  }
+#else
+  (void)max;
+#endif
+  level_in_use = level;
+  shuffle_fn = sf;
+  premul_fn = pf;
+  blend_fn = bf;
+  vfilter_fn = vf;
+}
+
+void fl_pixel_shuffle32(const uchar *from, uchar *to, int w, int delta,
+                        const signed char *order) {
+  if (!shuffle_fn) init_kernels(FL_PIXEL_AVX2);
+  shuffle_fn(from, to, w, delta, order);
+}
+
+void fl_pixel_premul32(const uchar *from, uchar *to, int w, int delta) {
+  if (!premul_fn) init_kernels(FL_PIXEL_AVX2);
+  premul_fn(from, to, w, delta);
+}
+
+void fl_pixel_blend32(const uchar *from, uchar *to, int w, int alpha) {
+  if (!blend_fn) init_kernels(FL_PIXEL_AVX2);
+  blend_fn(from, to, w, alpha);
+}
+
+void fl_pixel_vfilter(const short *const *rows, const short *weights,
+                      int n, int len, uchar *to) {
+  if (!vfilter_fn) init_kernels(FL_PIXEL_AVX2);
+  vfilter_fn(rows, weights, n, len, to);
+}
+
+int fl_pixel_simd_level() {
+  if (!shuffle_fn) init_kernels(FL_PIXEL_AVX2);
+  return level_in_use;
+}
+
+int fl_pixel_simd_level(int max) {
+  init_kernels(max);
+  return level_in_use;
+}
+
+//
+// End of "$Id$".
+//
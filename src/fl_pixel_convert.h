@@ -0,0 +1,78 @@
+//
+// "$Id$"
+//
+// Pixel conversion kernels for the Fast Light Tool Kit (FLTK).
+//
+// Copyright 1998-2016 by Bill Spitzak and others.
+//
+// This library is free software. Distribution and use rights are outlined in
+// the file "COPYING" which should have been included with this file.  If this
+// file is missing or damaged, see the license at:
+//
+//     http://www.fltk.org/COPYING.php
+//
+// Please report all bugs and problems on the following page:
+//
+//     http://www.fltk.org/str.php
+//
+
+// Internal header, not part of the public API.
+//
+// These functions convert rows of 8 bit RGB(A) image data into 32 bit
+// TrueColor pixels for fl_draw_image() on X11, and filter rows for the
+// scaling of Fl_RGB_Image. On x86 processors SSE2,
+// SSSE3 or AVX2 versions are chosen at runtime, other platforms use plain
+// C loops. The output is written in memory order, so the SIMD versions are
+// only used on little endian machines.
+
+#ifndef fl_pixel_convert_h
+#define fl_pixel_convert_h
+
+#include <FL/fl_types.h>
+
+// Byte orders of 32 bit pixels for fl_pixel_shuffle32(): for each byte of
+// an output pixel, in memory order, the input byte (0 = red, 1 = green,
+// 2 = blue) or -1 for a 0 byte. The names give the pixel value from the
+// most to the least significant byte on a little endian machine.
+extern const signed char fl_pixel_xrgb[4];
+extern const signed char fl_pixel_xbgr[4];
+extern const signed char fl_pixel_rgbx[4];
+extern const signed char fl_pixel_bgrx[4];
+
+// Convert w pixels that are delta bytes apart into 32 bit pixels with the
+// given byte order.
+extern void fl_pixel_shuffle32(const uchar *from, uchar *to, int w, int delta,
+                               const signed char *order);
+
+// Convert w RGBA pixels that are delta bytes apart into premultiplied
+// 32 bit ARGB pixels (alpha in the most significant byte).
+extern void fl_pixel_premul32(const uchar *from, uchar *to, int w, int delta);
+
+// Composite w premultiplied 32 bit pixels over the 32 bit pixels at to,
+// which have the same byte order. Byte alpha (0 or 3) of each pixel is
+// its alpha value; that byte of the pixels at to is left alone.
+extern void fl_pixel_blend32(const uchar *from, uchar *to, int w, int alpha);
+
+// Filter len values of n rows: to[i] is the sum of weights[k] * rows[k][i]
+// for all rows, divided by 1 << 14, rounded and limited to 0..255.
+extern void fl_pixel_vfilter(const short *const *rows, const short *weights,
+                             int n, int len, uchar *to);
+
+// Levels of the kernels that are used:
+enum {
+  FL_PIXEL_C = 0,
+  FL_PIXEL_SSE2,
+  FL_PIXEL_SSSE3,
+  FL_PIXEL_AVX2
+};
+
+// Return the level of the kernels in use. fl_pixel_simd_level(max) uses
+// no better kernels than max, for testing; returns the level in use.
+extern int fl_pixel_simd_level();
+extern int fl_pixel_simd_level(int max);
+
+#endif // !fl_pixel_convert_h
+
+//
+// End of "$Id$".
+//
@@ -0,0 +1,264 @@
+//
+// "$Id$"
+//
+// Byte scanning kernels for the Fast Light Tool Kit (FLTK).
+//
+// Copyright 1998-2016 by Bill Spitzak and others.
+//
+// This library is free software. Distribution and use rights are outlined in
+// the file "COPYING" which should have been included with this file.  If this
+// file is missing or damaged, see the license at:
+//
+//     http://www.fltk.org/COPYING.php
+//
+// Please report all bugs and problems on the following page:
+//
+//     http://www.fltk.org/str.php
+//
+
+#include <string.h>
+#include "fl_text_scan.h"
+
+// The vector kernels need GCC or Clang style target attributes so that
+// they can be compiled without raising the baseline of the whole library.
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#  define FL_TEXT_SCAN_X86 1
+#  include <immintrin.h>
+#else
+#  define FL_TEXT_SCAN_X86 0
+#endif
+
+
+//
+// Portable kernels
+//
+
+static int count_scalar(const char *p, int len, char c) {
+  int n = 0;
+  const char *e = p + len;
+  while (p < e) {
+    if (*p++ == c) n++;
+  }
+  return n;
+}
+
+static const char *find_scalar(const char *p, int len, char c, int *n) {
+  const char *e = p + len;
+  while (p < e) {
+    const char *m = (const char*)memchr(p, c, e - p);
+    if (!m) return 0;
+    if (--(*n) == 0) return m;
+    p = m + 1;
+  }
+  return 0;
+}
+
+static const char *rfind_scalar(const char *p, int len, char c, int *n) {
+  for (const char *q = p + len - 1; q >= p; q--) {
+    if (*q == c && --(*n) == 0) return q;
+  }
+  return 0;
+}
+
+
+#if FL_TEXT_SCAN_X86
+
+//
+// Bit helpers for the match masks returned by movemask
+//
+
+// index of the n-th set bit (n >= 1) counting from the lowest bit
+static inline int nth_low_bit(unsigned mask, int n) {
+  while (--n) mask &= mask - 1;
+  return __builtin_ctz(mask);
+}
+
+// index of the n-th set bit (n >= 1) counting from the highest bit
+static inline int nth_high_bit(unsigned mask, int n) {
+  int bit = 31 - __builtin_clz(mask);
+  while (--n) {
+    mask &= ~(1u << bit);
+    bit = 31 - __builtin_clz(mask);
+  }
+  return bit;
+}
+
+
+//
+// SSE2 kernels, 16 bytes per step
+//
+
+__attribute__((target("sse2")))
+static int count_sse2(const char *p, int len, char c) {
+  const __m128i needle = _mm_set1_epi8(c);
+  const __m128i zero = _mm_setzero_si128();
+  int n = 0;
+  while (len >= 16) {
+    // the byte counters in acc may overflow after 255 rounds
+    int rounds = len / 16;
+    if (rounds > 255) rounds = 255;
+    __m128i acc = zero;
+    for (int i = 0; i < rounds; i++, p += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i*)p);
+      acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, needle));
+    }
+    __m128i sum = _mm_sad_epu8(acc, zero);
+    n += _mm_cvtsi128_si32(sum) + _mm_extract_epi16(sum, 4);
+    len -= rounds * 16;
+  }
+  return n + count_scalar(p, len, c);
+}
+
+__attribute__((target("sse2")))
+static const char *find_sse2(const char *p, int len, char c, int *n) {
+  const __m128i needle = _mm_set1_epi8(c);
+  for (; len >= 16; len -= 16, p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+    if (!mask) continue;
+    int k = __builtin_popcount(mask);
+    if (k < *n) { *n -= k; continue; }
+    const char *m = p + nth_low_bit(mask, *n);
+    *n = 0;
+    return m;
+  }
+  return find_scalar(p, len, c, n);
+}
+
+__attribute__((target("sse2")))
+static const char *rfind_sse2(const char *p, int len, char c, int *n) {
+  const __m128i needle = _mm_set1_epi8(c);
+  for (; len >= 16; len -= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(p + len - 16));
+    unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+    if (!mask) continue;
+    int k = __builtin_popcount(mask);
+    if (k < *n) { *n -= k; continue; }
+    const char *m = p + len - 16 + nth_high_bit(mask, *n);
+    *n = 0;
+    return m;
+  }
+  return rfind_scalar(p, len, c, n);
+}
+
+
+//
+// AVX2 kernels, 32 bytes per step
+//
+
+__attribute__((target("avx2")))
+static int count_avx2(const char *p, int len, char c) {
+  const __m256i needle = _mm256_set1_epi8(c);
+  const __m256i zero = _mm256_setzero_si256();
+  int n = 0;
+  while (len >= 32) {
+    int rounds = len / 32;
+    if (rounds > 255) rounds = 255;
+    __m256i acc = zero;
+    for (int i = 0; i < rounds; i++, p += 32) {
+      __m256i v = _mm256_loadu_si256((const __m256i*)p);
+      acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(v, needle));
+    }
+    __m256i sum = _mm256_sad_epu8(acc, zero);
+    __m128i sum2 = _mm_add_epi64(_mm256_castsi256_si128(sum),
+                                 _mm256_extracti128_si256(sum, 1));
+    n += _mm_cvtsi128_si32(sum2) + _mm_extract_epi16(sum2, 4);
+    len -= rounds * 32;
+  }
+  _mm256_zeroupper();
+  return n + count_sse2(p, len, c);
+}
+
+__attribute__((target("avx2")))
+static const char *find_avx2(const char *p, int len, char c, int *n) {
+  const __m256i needle = _mm256_set1_epi8(c);
+  for (; len >= 32; len -= 32, p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)p);
+    unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+    if (!mask) continue;
+    int k = __builtin_popcount(mask);
+    if (k < *n) { *n -= k; continue; }
+    const char *m = p + nth_low_bit(mask, *n);
+    *n = 0;
+    _mm256_zeroupper();
+    return m;
+  }
+  _mm256_zeroupper();
+  return find_sse2(p, len, c, n);
+}
+
+__attribute__((target("avx2")))
+static const char *rfind_avx2(const char *p, int len, char c, int *n) {
+  const __m256i needle = _mm256_set1_epi8(c);
+  for (; len >= 32; len -= 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(p + len - 32));
+    unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+    if (!mask) continue;
+    int k = __builtin_popcount(mask);
+    if (k < *n) { *n -= k; continue; }
+    const char *m = p + len - 32 + nth_high_bit(mask, *n);
+    *n = 0;
+    _mm256_zeroupper();
+    return m;
+  }
+  _mm256_zeroupper();
+  return rfind_sse2(p, len, c, n);
+}
+
+#endif // FL_TEXT_SCAN_X86
+
+
+//
+// Runtime dispatch
+//
+
+typedef int (*Count_Fn)(const char*, int, char);
+typedef const char *(*Find_Fn)(const char*, int, char, int*);
+
+static Count_Fn count_fn = 0;
+static Find_Fn find_fn = 0;
+static Find_Fn rfind_fn = 0;
+
+/*
+ Choose the best kernels for this processor. Running this more than once
+ (e.g. from two threads at the same time) is harmless because every run
+ stores the same values.
+ */
+static void init_kernels() {
+  Count_Fn cf = count_scalar;
+  Find_Fn ff = find_scalar, rf = rfind_scalar;
+#if FL_TEXT_SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    cf = count_avx2; ff = find_avx2; rf = rfind_avx2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    cf = count_sse2; ff = find_sse2; rf = rfind_sse2;
+  }
+#endif
+  count_fn = cf;
+  find_fn = ff;
+  rfind_fn = rf;
+}
+
+int fl_text_count_byte(const char *p, int len, char c) {
+  if (len <= 0) return 0;
+  if (!count_fn) init_kernels();
+  return count_fn(p, len, c);
+}
+
+const char *fl_text_find_byte(const char *p, int len, char c, int *n) {
+  if (len <= 0 || *n <= 0) return 0;
+  if (!find_fn) init_kernels();
+  return find_fn(p, len, c, n);
+}
+
+const char *fl_text_rfind_byte(const char *p, int len, char c, int *n) {
+  if (len <= 0 || *n <= 0) return 0;
+  if (!rfind_fn) init_kernels();
+  return rfind_fn(p, len, c, n);
+}
+
+//
+// End of "$Id$".
+//
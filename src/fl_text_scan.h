@@ -0,0 +1,44 @@
+//
+// "$Id$"
+//
+// Byte scanning kernels for the Fast Light Tool Kit (FLTK).
+//
+// Copyright 1998-2016 by Bill Spitzak and others.
+//
+// This library is free software. Distribution and use rights are outlined in
+// the file "COPYING" which should have been included with this file.  If this
+// file is missing or damaged, see the license at:
+//
+//     http://www.fltk.org/COPYING.php
+//
+// Please report all bugs and problems on the following page:
+//
+//     http://www.fltk.org/str.php
+//
+
+// Internal header, not part of the public API.
+//
+// These functions count and locate a single byte value in a contiguous
+// block of memory. Fl_Text_Buffer uses them to count and find newlines
+// on either side of its gap. On x86 processors SSE2 or AVX2 versions are
+// chosen at runtime, other platforms use plain C loops.
+
+#ifndef fl_text_scan_h
+#define fl_text_scan_h
+
+// Return the number of bytes equal to c in p[0..len-1].
+extern int fl_text_count_byte(const char *p, int len, char c);
+
+// Find the n-th byte equal to c in p[0..len-1], scanning forward.
+// Returns a pointer to the match and sets *n to 0 on success. Otherwise
+// returns NULL and decrements *n by the number of matches seen.
+extern const char *fl_text_find_byte(const char *p, int len, char c, int *n);
+
+// Same as fl_text_find_byte(), but scans backwards from p[len-1].
+extern const char *fl_text_rfind_byte(const char *p, int len, char c, int *n);
+
+#endif // !fl_text_scan_h
+
+//
+// End of "$Id$".
+//
@@ -44,6 +44,7 @@
 #include <FL/Fl_Return_Button.H>
 #include <FL/Fl_Text_Buffer.H>
 #include <FL/Fl_Text_Editor.H>
+#include <FL/Fl_Text_Highlighter.H>
 #include <FL/filename.H>
 
 int                changed = 0;
@@ -60,7 +61,6 @@ const int line_num_width = 75;
 
 // Syntax highlighting stuff...
 #define TS 14 // default editor textsize
-Fl_Text_Buffer     *stylebuf = 0;
 Fl_Text_Display::Style_Table_Entry
                    styletable[] = {	// Style table
 		     { FL_BLACK,      FL_COURIER,           TS }, // A - Plain
@@ -160,19 +160,31 @@ extern "C" {
 }
 
 //
-// 'style_parse()' - Parse text and produce style data.
+// 'CodeHighlighter' - Syntax highlighting of C and C++ code...
 //
+// Fl_Text_Highlighter keeps the style buffer up to date and calls
+// highlight_line() for every line that must be restyled. The lexer
+// state at the start of a line is 0 for plain code, 1 inside a block
+// comment, and 2 inside a string.
+//
+
+class CodeHighlighter : public Fl_Text_Highlighter {
+  protected:
+    int highlight_line(const char *text, int length, int state, char *style);
+};
 
-void
-style_parse(const char *text,
-            char       *style,
-	    int        length) {
+int
+CodeHighlighter::highlight_line(const char *text,
+                                int        length,
+                                int        state,
+                                char       *style) {
   char	     current;
   int	     col;
   int	     last;
   char	     buf[255],
              *bufptr;
-  const char *temp;
+  const char *temp,
+             *end = text + length;
 
   // Style letters:
   //
@@ -184,21 +196,23 @@ style_parse(const char *text,
   // F - Types
   // G - Keywords
 
-  for (current = *style, col = 0, last = 0; length > 0; length --, text ++) {
+  current = state == 1 ? 'C' : state == 2 ? 'D' : 'A';
+
+  for (col = 0, last = 0; length > 0; length --, text ++) {
     if (current == 'B' || current == 'F' || current == 'G') current = 'A';
     if (current == 'A') {
       // Check for directives, comments, strings, and keywords...
       if (col == 0 && *text == '#') {
         // Set style to directive
         current = 'E';
-      } else if (strncmp(text, "//", 2) == 0) {
+      } else if (length > 1 && strncmp(text, "//", 2) == 0) {
         current = 'B';
 	for (; length > 0 && *text != '\n'; length --, text ++) *style++ = 'B';
 
         if (length == 0) break;
-      } else if (strncmp(text, "/*", 2) == 0) {
+      } else if (length > 1 && strncmp(text, "/*", 2) == 0) {
         current = 'C';
-      } else if (strncmp(text, "\\\"", 2) == 0) {
+      } else if (length > 1 && strncmp(text, "\\\"", 2) == 0) {
         // Quoted quote...
 	*style++ = current;
 	*style++ = current;
@@ -211,12 +225,13 @@ style_parse(const char *text,
       } else if (!last && (islower((*text)&255) || *text == '_')) {
         // Might be a keyword...
 	for (temp = text, bufptr = buf;
-	     (islower((*temp)&255) || *temp == '_') && bufptr < (buf + sizeof(buf) - 1);
+	     temp < end && (islower((*temp)&255) || *temp == '_') &&
+	     bufptr < (buf + sizeof(buf) - 1);
 	     *bufptr++ = *temp++) {
 	  // nothing
         }
 
-        if (!islower((*temp)&255) && *temp != '_') {
+        if (temp == end || (!islower((*temp)&255) && *temp != '_')) {
 	  *bufptr = '\0';
 
           bufptr = buf;
@@ -252,7 +267,7 @@ style_parse(const char *text,
 	  }
 	}
       }
-    } else if (current == 'C' && strncmp(text, "*/", 2) == 0) {
+    } else if (current == 'C' && length > 1 && strncmp(text, "*/", 2) == 0) {
       // Close a C comment...
       *style++ = current;
       *style++ = current;
@@ -263,7 +278,7 @@ style_parse(const char *text,
       continue;
     } else if (current == 'D') {
       // Continuing in string...
-      if (strncmp(text, "\\\"", 2) == 0) {
+      if (length > 1 && strncmp(text, "\\\"", 2) == 0) {
         // Quoted end quote...
 	*style++ = current;
 	*style++ = current;
@@ -286,137 +301,13 @@ style_parse(const char *text,
     col ++;
 
     last = isalnum((*text)&255) || *text == '_' || *text == '.';
-
-    if (*text == '\n') {
-      // Reset column and possibly reset the style
-      col = 0;
-      if (current == 'B' || current == 'E') current = 'A';
-    }
   }
-}
-
-
-//
-// 'style_init()' - Initialize the style buffer...
-//
 
-void
-style_init(void) {
-  char *style = new char[textbuf->length() + 1];
-  char *text = textbuf->text();
-
-  memset(style, 'A', textbuf->length());
-  style[textbuf->length()] = '\0';
-
-  if (!stylebuf) stylebuf = new Fl_Text_Buffer(textbuf->length());
-
-  style_parse(text, style, textbuf->length());
-
-  stylebuf->text(style);
-  delete[] style;
-  free(text);
+  // Line comments and directives end with the line...
+  return current == 'C' ? 1 : current == 'D' ? 2 : 0;
 }
 
 
-//
-// 'style_unfinished_cb()' - Update unfinished styles.
-//
-
-void
-style_unfinished_cb(int, void*) {
-}
-
-
-//
-// 'style_update()' - Update the style buffer...
-//
-
-void
-style_update(int        pos,		// I - Position of update
-             int        nInserted,	// I - Number of inserted chars
-	     int        nDeleted,	// I - Number of deleted chars
-             int        /*nRestyled*/,	// I - Number of restyled chars
-	     const char * /*deletedText*/,// I - Text that was deleted
-             void       *cbArg) {	// I - Callback data
-  int	start,				// Start of text
-	end;				// End of text
-  char	last,				// Last style on line
-	*style,				// Style data
-	*text;				// Text data
-
-
-  // If this is just a selection change, just unselect the style buffer...
-  if (nInserted == 0 && nDeleted == 0) {
-    stylebuf->unselect();
-    return;
-  }
-
-  // Track changes in the text buffer...
-  if (nInserted > 0) {
-    // Insert characters into the style buffer...
-    style = new char[nInserted + 1];
-    memset(style, 'A', nInserted);
-    style[nInserted] = '\0';
-
-    stylebuf->replace(pos, pos + nDeleted, style);
-    delete[] style;
-  } else {
-    // Just delete characters in the style buffer...
-    stylebuf->remove(pos, pos + nDeleted);
-  }
-
-  // Select the area that was just updated to avoid unnecessary
-  // callbacks...
-  stylebuf->select(pos, pos + nInserted - nDeleted);
-
-  // Re-parse the changed region; we do this by parsing from the
-  // beginning of the previous line of the changed region to the end of
-  // the line of the changed region...  Then we check the last
-  // style character and keep updating if we have a multi-line
-  // comment character...
-  start = textbuf->line_start(pos);
-//  if (start > 0) start = textbuf->line_start(start - 1);
-  end   = textbuf->line_end(pos + nInserted);
-  text  = textbuf->text_range(start, end);
-  style = stylebuf->text_range(start, end);
-  if (start==end)
-    last = 0;
-  else
-    last  = style[end - start - 1];
-
-//  printf("start = %d, end = %d, text = \"%s\", style = \"%s\", last='%c'...\n",
-//         start, end, text, style, last);
-
-  style_parse(text, style, end - start);
-
-//  printf("new style = \"%s\", new last='%c'...\n",
-//         style, style[end - start - 1]);
-
-  stylebuf->replace(start, end, style);
-  ((Fl_Text_Editor *)cbArg)->redisplay_range(start, end);
-
-  if (start==end || last != style[end - start - 1]) {
-//    printf("Recalculate the rest of the buffer style\n");
-    // Either the user deleted some text, or the last character
-    // on the line changed styles, so reparse the
-    // remainder of the buffer...
-    free(text);
-    free(style);
-
-    end   = textbuf->length();
-    text  = textbuf->text_range(start, end);
-    style = stylebuf->text_range(start, end);
-
-    style_parse(text, style, end - start);
-
-    stylebuf->replace(start, end, style);
-    ((Fl_Text_Editor *)cbArg)->redisplay_range(start, end);
-  }
-
-  free(text);
-  free(style);
-}
-
 // Editor window functions and class...
 void save_cb();
 void saveas_cb();
@@ -452,6 +343,7 @@ class EditorWindow : public Fl_Double_Window {
     int			line_numbers;
 
     Fl_Text_Editor     *editor;
+    CodeHighlighter    *highlighter;
     char               search[256];
 };
 
@@ -474,12 +366,14 @@ EditorWindow::EditorWindow(int w, int h, const char* t) : Fl_Double_Window(w, h,
   replace_dlg->end();
   replace_dlg->set_non_modal();
   editor = 0;
+  highlighter = 0;
   *search = (char)0;
   wrap_mode = 0;
   line_numbers = 0;
 }
 
 EditorWindow::~EditorWindow() {
+  delete highlighter;
   delete replace_dlg;
 }
 
@@ -740,8 +634,8 @@ void close_cb(Fl_Widget*, void* v) {
   }
 
   w->hide();
+  w->highlighter->detach();
   w->editor->buffer(0);
-  textbuf->remove_modify_callback(style_update, w->editor);
   textbuf->remove_modify_callback(changed_cb, w);
   Fl::delete_widget(w);
 
@@ -907,9 +801,9 @@ Fl_Window* new_view() {
     w->editor->textsize(TS);
   //w->editor->wrap_mode(Fl_Text_Editor::WRAP_AT_BOUNDS, 250);
     w->editor->buffer(textbuf);
-    w->editor->highlight_data(stylebuf, styletable,
-                              sizeof(styletable) / sizeof(styletable[0]),
-			      'A', style_unfinished_cb, 0);
+    w->highlighter = new CodeHighlighter;
+    w->highlighter->attach(w->editor, styletable,
+                           sizeof(styletable) / sizeof(styletable[0]));
 
 #ifdef DEV_TEST
 
@@ -946,7 +840,6 @@ Fl_Window* new_view() {
   w->size_range(300,200);
   w->callback((Fl_Callback *)close_cb, w);
 
-  textbuf->add_modify_callback(style_update, w->editor);
   textbuf->add_modify_callback(changed_cb, w);
   textbuf->call_modify_callbacks();
   num_windows++;
@@ -960,7 +853,6 @@ void cb(const char *fname) {
 int main(int argc, char **argv) {
   textbuf = new Fl_Text_Buffer;
 //textbuf->transcoding_warning_action = NULL;
-  style_init();
   fl_open_callback(cb);
 
   Fl_Window* window = new_view();
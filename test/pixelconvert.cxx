@@ -0,0 +1,303 @@
+//
+// "$Id$"
+//
+// fl_draw_image() pixel conversion benchmark for the Fast Light Tool Kit (FLTK).
+//
+// Copyright 1998-2016 by Bill Spitzak and others.
+//
+// This library is free software. Distribution and use rights are outlined in
+// the file "COPYING" which should have been included with this file.  If this
+// file is missing or damaged, see the license at:
+//
+//     http://www.fltk.org/COPYING.php
+//
+// Please report all bugs and problems on the following page:
+//
+//     http://www.fltk.org/str.php
+//
+
+// Converts a 1920x1080 image into each of the 32 bit TrueColor pixel
+// formats that fl_draw_image() supports on X11, with the plain C kernels
+// and with every SIMD level the processor has, and shows the throughput
+// in megapixels per second. The compositing of premultiplied pixels and
+// the column filter of Fl_RGB_Image::copy() are measured the same way,
+// the filter in millions of values per second. The SIMD results are checked against the C
+// kernels. Finally the image is drawn with fl_draw_image() into an
+// offscreen buffer, which includes the conversion for the visual of the
+// display and sending the image to the server. The results are shown in
+// the browser and also printed to stdout.
+//
+// The kernels are internal to FLTK, so src/fl_pixel_convert.cxx is
+// compiled into this program rather than called in the library.
+
+#include <FL/Fl.H>
+#include <FL/Fl_Double_Window.H>
+#include <FL/Fl_Browser.H>
+#include <FL/Fl_Button.H>
+#include <FL/fl_draw.H>
+#include <FL/x.H>
+#include "../src/fl_pixel_convert.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef WIN32
+#  include <windows.h>
+#else
+#  include <sys/time.h>
+#endif
+
+#define IMAGE_W 1920
+#define IMAGE_H 1080
+
+Fl_Browser *results;
+Fl_Double_Window *window;
+
+static double now() {
+#ifdef WIN32
+  return GetTickCount() / 1000.0;
+#else
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+#endif
+}
+
+static void report(const char *line) {
+  results->add(line);
+  puts(line);
+  results->bottomline(results->size());
+  Fl::check();
+}
+
+// Convert the image a few times with the kernels of the given level,
+// return the throughput in megapixels per second:
+static double convert(int level, const uchar *image, uchar *out, int delta,
+                      const signed char *order) {
+  fl_pixel_simd_level(level);
+  int rounds = 0;
+  double t0 = now(), t;
+  do {
+    for (int y = 0; y < IMAGE_H; y++) {
+      const uchar *from = image + y * IMAGE_W * delta;
+      uchar *to = out + y * IMAGE_W * 4;
+      if (order) fl_pixel_shuffle32(from, to, IMAGE_W, delta, order);
+      else fl_pixel_premul32(from, to, IMAGE_W, delta);
+    }
+    rounds++;
+    t = now() - t0;
+  } while (t < 0.25);
+  return rounds * (IMAGE_W * IMAGE_H / 1e6) / t;
+}
+
+static void run_format(const char *name, int delta, const signed char *order,
+                       const uchar *image, uchar *ref, uchar *out, int best) {
+  char line[256];
+  int l = snprintf(line, sizeof(line), "%s", name);
+  convert(FL_PIXEL_C, image, ref, delta, order);
+  for (int level = FL_PIXEL_C; level <= FL_PIXEL_AVX2; level++) {
+    if (level > best || (order && level == FL_PIXEL_SSE2)) {
+      l += snprintf(line + l, sizeof(line) - l, "\t-");
+      continue;
+    }
+    memset(out, 0, IMAGE_W * IMAGE_H * 4);
+    double mps = convert(level, image, out, delta, order);
+    int ok = !memcmp(out, ref, IMAGE_W * IMAGE_H * 4);
+    l += snprintf(line + l, sizeof(line) - l, "\t%.0f%s", mps, ok ? "" : " (MISMATCH)");
+  }
+  report(line);
+}
+
+// Composite premultiplied pixels with alpha in byte alpha over out a few
+// times, return the throughput in megapixels per second:
+static double blend(int level, const uchar *image, uchar *out, int alpha) {
+  fl_pixel_simd_level(level);
+  int rounds = 0;
+  double t0 = now(), t;
+  do {
+    for (int y = 0; y < IMAGE_H; y++)
+      fl_pixel_blend32(image + y * IMAGE_W * 4, out + y * IMAGE_W * 4,
+                       IMAGE_W, alpha);
+    rounds++;
+    t = now() - t0;
+  } while (t < 0.25);
+  return rounds * (IMAGE_W * IMAGE_H / 1e6) / t;
+}
+
+// The first round of blend() is checked, so each level starts from the
+// same background:
+static void run_blend(const char *name, int alpha, const uchar *image,
+                      uchar *ref, uchar *out, int best) {
+  char line[256];
+  int l = snprintf(line, sizeof(line), "%s", name);
+  uchar *premul = new uchar[IMAGE_W * IMAGE_H * 4];
+  uchar *check = new uchar[IMAGE_W * IMAGE_H * 4];
+  for (int i = 0; i < IMAGE_W * IMAGE_H * 4; i += 4) {
+    int a = image[i + 3];
+    for (int c = 0; c < 4; c++)
+      premul[i + c] = (uchar)(c == alpha ? a : image[i + c] % (a + 1));
+  }
+  fl_pixel_simd_level(FL_PIXEL_C);
+  memcpy(ref, image, IMAGE_W * IMAGE_H * 4);
+  for (int y = 0; y < IMAGE_H; y++)
+    fl_pixel_blend32(premul + y * IMAGE_W * 4, ref + y * IMAGE_W * 4,
+                     IMAGE_W, alpha);
+  for (int level = FL_PIXEL_C; level <= FL_PIXEL_AVX2; level++) {
+    if (level > best) {
+      l += snprintf(line + l, sizeof(line) - l, "\t-");
+      continue;
+    }
+    fl_pixel_simd_level(level);
+    memcpy(check, image, IMAGE_W * IMAGE_H * 4);
+    for (int y = 0; y < IMAGE_H; y++)
+      fl_pixel_blend32(premul + y * IMAGE_W * 4, check + y * IMAGE_W * 4,
+                       IMAGE_W, alpha);
+    int ok = !memcmp(check, ref, IMAGE_W * IMAGE_H * 4);
+    memcpy(out, image, IMAGE_W * IMAGE_H * 4);
+    double mps = blend(level, premul, out, alpha);
+    l += snprintf(line + l, sizeof(line) - l, "\t%.0f%s", mps, ok ? "" : " (MISMATCH)");
+  }
+  report(line);
+  delete[] premul;
+  delete[] check;
+}
+
+// Filter n rows of len values into each line of out a few times, return
+// the throughput in millions of values per second:
+static double vfilter(int level, const short *const *rows,
+                      const short *weights, int n, int len, uchar *out) {
+  fl_pixel_simd_level(level);
+  int rounds = 0;
+  double t0 = now(), t;
+  do {
+    for (int y = 0; y < IMAGE_H; y++)
+      fl_pixel_vfilter(rows, weights, n, len, out + y * IMAGE_W * 4);
+    rounds++;
+    t = now() - t0;
+  } while (t < 0.25);
+  return rounds * (len * (double)IMAGE_H / 1e6) / t;
+}
+
+// The values and weights have the range that the area scaling of
+// Fl_RGB_Image::copy() uses: weights that add up to 128 and values from
+// 0 to 255 * 128. An odd number of rows and a
+// length that is not a multiple of 32 also test the ends of the loops.
+static void run_vfilter(const char *name, int n, const uchar *image,
+                        uchar *ref, uchar *out, int best) {
+  char line[256];
+  int l = snprintf(line, sizeof(line), "%s", name);
+  const int len = IMAGE_W * 4 - 5;
+  short *data = new short[n * len];
+  const short **rows = new const short *[n];
+  short *weights = new short[n];
+  int sum = 0;
+  for (int k = 0; k < n; k++) {
+    weights[k] = (short)(k < n - 1 ? 128 / n - k : 128 - sum);
+    sum += weights[k];
+    rows[k] = data + k * len;
+    for (int i = 0; i < len; i++) {
+      const uchar *p = image + 2 * (k * len + i);
+      data[k * len + i] = (short)(((p[0] << 8) | p[1]) % (255 * 128 + 1));
+    }
+  }
+  memset(ref, 0, IMAGE_W * IMAGE_H * 4);
+  vfilter(FL_PIXEL_C, rows, weights, n, len, ref);
+  for (int level = FL_PIXEL_C; level <= FL_PIXEL_AVX2; level++) {
+    if (level > best) {
+      l += snprintf(line + l, sizeof(line) - l, "\t-");
+      continue;
+    }
+    memset(out, 0, IMAGE_W * IMAGE_H * 4);
+    double mvs = vfilter(level, rows, weights, n, len, out);
+    int ok = !memcmp(out, ref, IMAGE_W * IMAGE_H * 4);
+    l += snprintf(line + l, sizeof(line) - l, "\t%.0f%s", mvs, ok ? "" : " (MISMATCH)");
+  }
+  report(line);
+  delete[] data;
+  delete[] rows;
+  delete[] weights;
+}
+
+static void run_cb(Fl_Widget *, void *) {
+  fl_cursor(FL_CURSOR_WAIT);
+  results->clear();
+  results->add("@bFormat\t@bC\t@bSSE2\t@bSSSE3\t@bAVX2");
+  Fl::check();
+
+  int best = fl_pixel_simd_level(FL_PIXEL_AVX2);
+  uchar *image = new uchar[IMAGE_W * IMAGE_H * 4];
+  uchar *ref = new uchar[IMAGE_W * IMAGE_H * 4];
+  uchar *out = new uchar[IMAGE_W * IMAGE_H * 4];
+  srand(1);
+  for (int i = 0; i < IMAGE_W * IMAGE_H * 4; i++) image[i] = (uchar)rand();
+
+  static const struct {
+    const char *name;
+    const signed char *order;
+  } formats[] = {
+    { "xrgb", fl_pixel_xrgb },
+    { "xbgr", fl_pixel_xbgr },
+    { "rgbx", fl_pixel_rgbx },
+    { "bgrx", fl_pixel_bgrx }
+  };
+  char name[64];
+  for (int i = 0; i < 4; i++) {
+    snprintf(name, sizeof(name), "RGB to %s (MP/s)", formats[i].name);
+    run_format(name, 3, formats[i].order, image, ref, out, best);
+    snprintf(name, sizeof(name), "RGBA to %s (MP/s)", formats[i].name);
+    run_format(name, 4, formats[i].order, image, ref, out, best);
+  }
+  run_format("RGBA to premul. ARGB (MP/s)", 4, 0, image, ref, out, best);
+  run_blend("Blend, alpha in byte 3 (MP/s)", 3, image, ref, out, best);
+  run_blend("Blend, alpha in byte 0 (MP/s)", 0, image, ref, out, best);
+  run_vfilter("Column filter, 3 rows (M/s)", 3, image, ref, out, best);
+  run_vfilter("Column filter, 4 rows (M/s)", 4, image, ref, out, best);
+  fl_pixel_simd_level(FL_PIXEL_AVX2);
+
+  // the whole fl_draw_image() with the best kernels:
+  static const int depths[] = { 3, 4 };
+  for (int i = 0; i < 2; i++) {
+    window->make_current();
+    Fl_Offscreen offscreen = fl_create_offscreen(IMAGE_W, IMAGE_H);
+    fl_begin_offscreen(offscreen);
+    int rounds = 0;
+    double t0 = now(), t;
+    do {
+      fl_draw_image(image, 0, 0, IMAGE_W, IMAGE_H, depths[i]);
+#ifdef USE_X11
+      XSync(fl_display, False);
+#endif
+      rounds++;
+      t = now() - t0;
+    } while (t < 0.5);
+    fl_end_offscreen();
+    fl_delete_offscreen(offscreen);
+    char line[256];
+    snprintf(line, sizeof(line), "fl_draw_image() %s (MP/s)\t%.0f",
+             depths[i] == 3 ? "RGB" : "RGBA",
+             rounds * (IMAGE_W * IMAGE_H / 1e6) / t);
+    report(line);
+  }
+
+  delete[] image;
+  delete[] ref;
+  delete[] out;
+  fl_cursor(FL_CURSOR_DEFAULT);
+}
+
+int main(int argc, char **argv) {
+  window = new Fl_Double_Window(560, 300, "fl_draw_image() conversion benchmark");
+  Fl_Button *run = new Fl_Button(450, 10, 100, 25, "Run");
+  run->callback(run_cb);
+  results = new Fl_Browser(10, 45, 540, 245);
+  static int widths[] = { 220, 70, 70, 70, 0 };
+  results->column_widths(widths);
+  results->column_char('\t');
+  window->resizable(results);
+  window->end();
+  window->show(argc, argv);
+  return Fl::run();
+}
+
+//
+// End of "$Id$".
+//
@@ -0,0 +1,803 @@
+//
+// "$Id$"
+//
+// Randomized Fl_Text_Buffer test program for the Fast Light Tool Kit (FLTK).
+//
+// Copyright 1998-2016 by Bill Spitzak and others.
+//
+// This library is free software. Distribution and use rights are outlined in
+// the file "COPYING" which should have been included with this file.  If this
+// file is missing or damaged, see the license at:
+//
+//     http://www.fltk.org/COPYING.php
+//
+// Please report all bugs and problems on the following page:
+//
+//     http://www.fltk.org/str.php
+//
+
+// Applies a long random sequence of insertions, deletions, replacements,
+// undo and redo to four text buffers at once: a gap buffer and a piece
+// table, each with and without the line index. After every step all of
+// them must hold the same text as a plain character array that is edited
+// with memmove(). Line navigation and plain string searches are compared
+// with simple loops over that array, and random regular expressions are
+// compared with a backtracking matcher, which has the same leftmost and
+// greedy semantics as the Pike VM in Fl_Text_Search.
+//
+// Every failure is listed with the seed and step. "textfuzz -batch [seed]"
+// runs the test without opening a window and exits with a non-zero status
+// if anything failed. Undo and redo are only checked if FLTK was built with
+// FLTK_ABI_VERSION 10304 or higher.
+
+#include <FL/Fl.H>
+#include <FL/Fl_Double_Window.H>
+#include <FL/Fl_Browser.H>
+#include <FL/Fl_Button.H>
+#include <FL/Fl_Int_Input.H>
+#include <FL/Fl_Text_Buffer.H>
+#include <FL/Fl_Text_Search.H>
+#include <FL/fl_draw.H>
+#include <FL/fl_utf8.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+Fl_Browser *results;
+Fl_Int_Input *seed_input;
+
+static const int ROUNDS = 6;
+static const int STEPS = 1500;
+static const int MAX_FAILURES = 20;
+
+static unsigned long seed, rng;
+static int round_no, step_no, failures;
+
+static int rnd(int n) {
+  rng = (rng * 1103515245UL + 12345UL) & 0xffffffffUL;
+  return (int)((rng >> 8) % (unsigned long)n);
+}
+
+static void fail(const char *fmt, ...) {
+  if (++failures > MAX_FAILURES) return;
+  char msg[200], line[256];
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(msg, sizeof(msg), fmt, ap);
+  va_end(ap);
+  snprintf(line, sizeof(line), "seed %lu, round %d, step %d: %s",
+           seed, round_no, step_no, msg);
+  puts(line);
+  if (results) results->add(line);
+}
+
+//
+// Expected contents of the buffers and the edits that undo and redo revert
+//
+
+static char *ref;
+static int ref_len, ref_size;
+
+static void ref_replace(int start, int end, const char *text) {
+  int n = (int)strlen(text);
+  if (ref_len - (end - start) + n + 1 > ref_size) {
+    ref_size = 2 * (ref_len + n) + 1;
+    ref = (char *)realloc(ref, ref_size);
+  }
+  memmove(ref + start + n, ref + end, ref_len - end + 1);
+  memcpy(ref + start, text, n);
+  ref_len += n - (end - start);
+}
+
+// returns a character boundary at or before pos
+static int align(int pos) {
+  while (pos > 0 && pos < ref_len && (ref[pos] & 0xc0) == 0x80) pos--;
+  return pos;
+}
+
+static int random_pos() { return align(rnd(ref_len + 1)); }
+
+static const char *pieces[] = {
+  "a", "b", "x", "A", "B", " ", "\n", "\xc3\xa9", "\xc3\x89", "ab", "\n\n"
+};
+
+static char chunk[8200];
+
+static const char *random_text(int bytes) {
+  int n = 0;
+  chunk[0] = 0;
+  while (n < bytes) {
+    const char *p = pieces[rnd(sizeof(pieces) / sizeof(pieces[0]))];
+    strcpy(chunk + n, p);
+    n += (int)strlen(p);
+  }
+  return chunk;
+}
+
+struct Edit {
+  int pos;
+  char *removed, *inserted;
+};
+
+struct Group {
+  Edit *edits;
+  int n;
+};
+
+struct GroupStack {
+  Group *groups;
+  int n, size;
+};
+
+static GroupStack undo_stack, redo_stack;
+static Group current;
+
+static void push(GroupStack &s, const Group &g) {
+  if (s.n == s.size) {
+    s.size = s.size ? 2 * s.size : 64;
+    s.groups = (Group *)realloc(s.groups, s.size * sizeof(Group));
+  }
+  s.groups[s.n++] = g;
+}
+
+static void free_group(Group &g) {
+  for (int i = 0; i < g.n; i++) {
+    free(g.edits[i].removed);
+    free(g.edits[i].inserted);
+  }
+  free(g.edits);
+  g.edits = 0;
+  g.n = 0;
+}
+
+static void clear(GroupStack &s) {
+  while (s.n) free_group(s.groups[--s.n]);
+}
+
+//
+// The buffers under test
+//
+
+static const int NBUF = 4;
+static Fl_Text_Buffer *bufs[NBUF];
+static const char *names[NBUF] = {
+  "gap buffer", "gap buffer with line index",
+  "piece table", "piece table with line index"
+};
+static int have_undo;   // the undo history is a 1.3.4 ABI feature
+
+static void edit(int start, int end, const char *text) {
+  if (start == end && !*text) return;
+  Edit e;
+  e.pos = start;
+  e.removed = (char *)malloc(end - start + 1);
+  memcpy(e.removed, ref + start, end - start);
+  e.removed[end - start] = 0;
+  e.inserted = strdup(text);
+  current.edits = (Edit *)realloc(current.edits, (current.n + 1) * sizeof(Edit));
+  current.edits[current.n++] = e;
+  for (int i = 0; i < NBUF; i++) {
+    if (end > start && *text) bufs[i]->replace(start, end, text);
+    else if (end > start) bufs[i]->remove(start, end);
+    else bufs[i]->insert(start, text);
+  }
+  ref_replace(start, end, text);
+}
+
+static int check_text(const char *what) {
+  int ok = 1;
+  for (int i = 0; i < NBUF; i++) {
+    char *t = bufs[i]->text();
+    if (bufs[i]->length() != ref_len || memcmp(t, ref, ref_len + 1)) {
+      fail("%s: text differs after %s", names[i], what);
+      ok = 0;
+    }
+    free(t);
+  }
+  return ok;
+}
+
+static void check_undo_state() {
+  for (int i = 0; i < NBUF; i++) {
+    if (!bufs[i]->can_undo() != !undo_stack.n)
+      fail("%s: can_undo() is %d", names[i], bufs[i]->can_undo());
+    if (!bufs[i]->can_redo() != !redo_stack.n)
+      fail("%s: can_redo() is %d", names[i], bufs[i]->can_redo());
+  }
+}
+
+// one group of edits, mostly typing and backspacing at a cursor
+static void random_edits(int big) {
+  static int cursor;
+  char *before = (char *)malloc(ref_len + 1);
+  memcpy(before, ref, ref_len + 1);
+  int before_len = ref_len;
+  int limit = big ? 65536 : 1500;
+  for (int i = 0; i < NBUF; i++) bufs[i]->begin_undo_group();
+  int n = 1 + rnd(4);
+  if (cursor > ref_len) cursor = ref_len;
+  cursor = align(cursor);
+  while (n--) {
+    int r = rnd(10), a = random_pos(), b = random_pos();
+    if (a > b) { int t = a; a = b; b = t; }
+    if (ref_len > limit && r < 5) r = 5 + (r & 1);
+    if (r < 3) {
+      const char *t = random_text(1);
+      edit(cursor, cursor, t);
+      cursor += (int)strlen(t);
+    } else if (r < 4) {
+      if (cursor > 0) {
+        int p = align(cursor - 1);
+        edit(p, cursor, "");
+        cursor = p;
+      }
+    } else if (r < 5) {
+      edit(a, a, random_text(big ? rnd(8192) : rnd(40)));
+      cursor = a;
+    } else if (r < 7) {
+      if (b - a > (big ? 1024 : 200)) b = align(a + (big ? 1024 : 200));
+      edit(a, b, "");
+      cursor = a;
+    } else if (r < 8) {
+      edit(a, b, random_text(rnd(20)));
+      cursor = a;
+    } else {
+      cursor = a;
+    }
+  }
+  // an empty group would not be recorded, so make sure that one is
+  if (ref_len == before_len && !memcmp(ref, before, ref_len))
+    edit(cursor, cursor, "x");
+  for (int i = 0; i < NBUF; i++) bufs[i]->end_undo_group();
+  free(before);
+  if (current.n) {
+    push(undo_stack, current);
+    current.edits = 0;
+    current.n = 0;
+  }
+  clear(redo_stack);
+}
+
+static void undo_redo(int redo) {
+  GroupStack &from = redo ? redo_stack : undo_stack;
+  GroupStack &to = redo ? undo_stack : redo_stack;
+  Group g = from.groups[--from.n];
+  if (redo) {
+    for (int i = 0; i < g.n; i++)
+      ref_replace(g.edits[i].pos, g.edits[i].pos + (int)strlen(g.edits[i].removed),
+                  g.edits[i].inserted);
+  } else {
+    for (int i = g.n - 1; i >= 0; i--)
+      ref_replace(g.edits[i].pos, g.edits[i].pos + (int)strlen(g.edits[i].inserted),
+                  g.edits[i].removed);
+  }
+  push(to, g);
+  for (int i = 0; i < NBUF; i++) {
+    int ret = redo ? bufs[i]->redo() : bufs[i]->undo();
+    if (ret != 1) fail("%s: %s() returned %d", names[i], redo ? "redo" : "undo", ret);
+  }
+}
+
+//
+// Line navigation
+//
+
+static int ref_line_start(int pos) {
+  while (pos > 0 && ref[pos - 1] != '\n') pos--;
+  return pos;
+}
+
+static int ref_line_end(int pos) {
+  while (pos < ref_len && ref[pos] != '\n') pos++;
+  return pos;
+}
+
+static int ref_count_lines(int start, int end) {
+  int n = 0;
+  for (int pos = start; pos < end; pos++)
+    if (ref[pos] == '\n') n++;
+  return n;
+}
+
+static int ref_skip_lines(int pos, int nLines) {
+  if (nLines <= 0) return pos;
+  for (; pos < ref_len; pos++)
+    if (ref[pos] == '\n' && --nLines == 0) return pos + 1;
+  return ref_len;
+}
+
+static int ref_rewind_lines(int pos, int nLines) {
+  if (pos <= 1) return 0;
+  int n = (nLines < 0 ? 0 : nLines) + 1;
+  while (pos > 0) {
+    pos--;
+    if (ref[pos] == '\n' && --n == 0) return pos + 1;
+  }
+  return 0;
+}
+
+static void check_lines(int big) {
+  for (int k = 0; k < 4; k++) {
+    int a = random_pos(), b = random_pos(), n = rnd(big ? 300 : 5);
+    if (a > b) { int t = a; a = b; b = t; }
+    for (int i = 0; i < NBUF; i++) {
+      Fl_Text_Buffer *buf = bufs[i];
+      int v;
+      if ((v = buf->line_start(a)) != ref_line_start(a))
+        fail("%s: line_start(%d) is %d", names[i], a, v);
+      if ((v = buf->line_end(a)) != ref_line_end(a))
+        fail("%s: line_end(%d) is %d", names[i], a, v);
+      if ((v = buf->count_lines(a, b)) != ref_count_lines(a, b))
+        fail("%s: count_lines(%d, %d) is %d", names[i], a, b, v);
+      if ((v = buf->skip_lines(a, n)) != ref_skip_lines(a, n))
+        fail("%s: skip_lines(%d, %d) is %d", names[i], a, n, v);
+      if ((v = buf->rewind_lines(b, n)) != ref_rewind_lines(b, n))
+        fail("%s: rewind_lines(%d, %d) is %d", names[i], b, n, v);
+    }
+  }
+}
+
+//
+// Plain string search
+//
+
+static int same_text(const char *s, const char *needle, int m, int matchCase) {
+  for (int i = 0; i < m; ) {
+    int la, lb;
+    unsigned a = fl_utf8decode(s + i, s + m, &la);
+    unsigned b = fl_utf8decode(needle + i, needle + m, &lb);
+    if (la != lb || (a != b && (matchCase || fl_tolower(a) != fl_tolower(b))))
+      return 0;
+    i += la;
+  }
+  return 1;
+}
+
+static int ref_search_forward(int pos, const char *needle, int matchCase) {
+  int m = (int)strlen(needle);
+  for (; pos + m <= ref_len; pos++)
+    if (same_text(ref + pos, needle, m, matchCase)) return pos;
+  return -1;
+}
+
+static int ref_search_backward(int pos, const char *needle, int matchCase) {
+  int m = (int)strlen(needle);
+  if (pos > ref_len - m) pos = ref_len - m;
+  for (; pos >= 0; pos--)
+    if (same_text(ref + pos, needle, m, matchCase)) return pos;
+  return -1;
+}
+
+struct MatchList {
+  int *pos;
+  int n, size;
+};
+
+static void add_match(int pos, int length, void *data) {
+  MatchList *l = (MatchList *)data;
+  if (l->n + 2 > l->size) {
+    l->size = l->size ? 2 * l->size : 64;
+    l->pos = (int *)realloc(l->pos, l->size * sizeof(int));
+  }
+  l->pos[l->n++] = pos;
+  l->pos[l->n++] = pos + length;
+}
+
+static void check_matches(const MatchList &got, const MatchList &want,
+                          const char *name, const char *pattern) {
+  if (got.n != want.n)
+    fail("%s: find_all(\"%s\") found %d matches instead of %d",
+         name, pattern, got.n / 2, want.n / 2);
+  else
+    for (int j = 0; j < got.n; j++)
+      if (got.pos[j] != want.pos[j]) {
+        fail("%s: find_all(\"%s\") match %d is %d..%d instead of %d..%d",
+             name, pattern, j / 2, got.pos[j & ~1], got.pos[j | 1],
+             want.pos[j & ~1], want.pos[j | 1]);
+        break;
+      }
+}
+
+static void check_search() {
+  char needle[64];
+  if (ref_len && rnd(2)) {
+    // a piece of the text, maybe in a different case
+    int a = random_pos(), b = align(a + 1 + rnd(6));
+    if (b <= a) b = ref_len;
+    if (b - a > 16) b = a;
+    memcpy(needle, ref + a, b - a);
+    needle[b - a] = 0;
+    if (rnd(2))
+      for (char *p = needle; *p; p++) {
+        if (*p >= 'a' && *p <= 'z') *p -= 32;
+        else if (*p == '\xa9') *p = '\x89';
+      }
+  } else {
+    strcpy(needle, random_text(1 + rnd(3)));
+  }
+  if (!*needle) return;
+  int matchCase = rnd(2), start = random_pos(), found;
+  int fwd = ref_search_forward(start, needle, matchCase);
+  int back = ref_search_backward(start, needle, matchCase);
+  int a = random_pos(), b = random_pos(), m = (int)strlen(needle);
+  if (a > b) { int t = a; a = b; b = t; }
+  MatchList want = { 0, 0, 0 }, got = { 0, 0, 0 };
+  for (int p = a; p + m <= b; )
+    if (same_text(ref + p, needle, m, matchCase)) {
+      add_match(p, m, &want);
+      p += m;
+    } else p++;
+  Fl_Text_Search search(needle, matchCase ? Fl_Text_Search::MATCH_CASE : 0);
+  for (int i = 0; i < NBUF; i++) {
+    if (!bufs[i]->search_forward(start, needle, &found, matchCase)) found = -1;
+    if (found != fwd)
+      fail("%s: search_forward(%d, \"%s\") found %d instead of %d",
+           names[i], start, needle, found, fwd);
+    if (!bufs[i]->search_backward(start, needle, &found, matchCase)) found = -1;
+    if (found != back)
+      fail("%s: search_backward(%d, \"%s\") found %d instead of %d",
+           names[i], start, needle, found, back);
+    got.n = 0;
+    search.find_all(bufs[i], a, b, add_match, &got);
+    check_matches(got, want, names[i], needle);
+  }
+  free(want.pos);
+  free(got.pos);
+}
+
+//
+// Regular expressions
+//
+
+enum { R_CHAR, R_ANY, R_CLASS, R_BOL, R_EOL, R_CAT, R_ALT, R_STAR, R_PLUS, R_QUEST };
+
+struct RNode {
+  int type;
+  unsigned c;
+  int negate, nranges;
+  unsigned lo[3], hi[3];
+  RNode *left, *right;          // right of R_PLUS is the star of left
+};
+
+static RNode nodes[256];
+static int nnodes;
+
+static RNode *new_node(int type, RNode *left = 0, RNode *right = 0) {
+  RNode *n = nodes + nnodes++;
+  memset(n, 0, sizeof(*n));
+  n->type = type;
+  n->left = left;
+  n->right = right;
+  return n;
+}
+
+static const unsigned class_chars[] = { ' ', 'A', 'B', 'a', 'b', 'x', 0xc9, 0xe9 };
+static const unsigned pattern_chars[] = { 'a', 'b', 'x', 'A', 'B', ' ', 0xe9, 0xc9 };
+
+static RNode *gen_alt(int depth, int quantified);
+
+// Quantified parts contain no assertions, no quantifiers and no newline,
+// so they always consume a character and never span more than one line.
+static RNode *gen_item(int depth, int quantified) {
+  if (!quantified && rnd(3) == 0) {
+    RNode *operand = gen_item(depth, 1);
+    int type = R_STAR + rnd(3);
+    RNode *n = new_node(type, operand);
+    if (type == R_PLUS) n->right = new_node(R_STAR, operand);
+    return n;
+  }
+  RNode *n;
+  switch (rnd(10)) {
+    case 5:
+      return new_node(R_ANY);
+    case 6:
+    case 7:
+      n = new_node(R_CLASS);
+      n->negate = rnd(3) == 0;
+      n->nranges = 1 + rnd(2);
+      for (int i = 0; i < n->nranges; i++) {
+        int a = rnd(8), b = rnd(8);
+        n->lo[i] = class_chars[a < b ? a : b];
+        n->hi[i] = class_chars[a < b ? b : a];
+      }
+      if (n->negate) {
+        n->lo[n->nranges] = n->hi[n->nranges] = '\n';
+        n->nranges++;
+      }
+      return n;
+    case 8:
+      if (!quantified) return new_node(rnd(2) ? R_BOL : R_EOL);
+      break;
+    case 9:
+      if (depth > 0) return gen_alt(depth - 1, quantified);
+      break;
+  }
+  n = new_node(R_CHAR);
+  n->c = (!quantified && rnd(8) == 0) ? '\n' : pattern_chars[rnd(8)];
+  return n;
+}
+
+static RNode *gen_alt(int depth, int quantified) {
+  RNode *n = 0;
+  do {
+    RNode *cat = gen_item(depth, quantified);
+    for (int k = rnd(3); k > 0; k--)
+      cat = new_node(R_CAT, cat, gen_item(depth, quantified));
+    n = n ? new_node(R_ALT, n, cat) : cat;
+  } while (rnd(4) == 0);
+  return n;
+}
+
+static void render_char(char *&p, unsigned c) {
+  if (c == '\n') { *p++ = '\\'; *p++ = 'n'; }
+  else p += fl_utf8encode(c, p);
+}
+
+// ctx is 0 at the top and in alternatives, 1 in a concatenation and
+// 2 as the operand of a quantifier
+static void render(const RNode *n, char *&p, int ctx) {
+  int paren = (n->type == R_ALT && ctx > 0) || (n->type == R_CAT && ctx == 2);
+  if (paren) *p++ = '(';
+  switch (n->type) {
+    case R_CHAR: render_char(p, n->c); break;
+    case R_ANY: *p++ = '.'; break;
+    case R_BOL: *p++ = '^'; break;
+    case R_EOL: *p++ = '$'; break;
+    case R_CLASS:
+      *p++ = '[';
+      if (n->negate) *p++ = '^';
+      for (int i = 0; i < n->nranges; i++) {
+        render_char(p, n->lo[i]);
+        if (n->hi[i] != n->lo[i]) { *p++ = '-'; render_char(p, n->hi[i]); }
+      }
+      *p++ = ']';
+      break;
+    case R_CAT: render(n->left, p, 1); render(n->right, p, 1); break;
+    case R_ALT: render(n->left, p, 0); *p++ = '|'; render(n->right, p, 0); break;
+    case R_STAR: render(n->left, p, 2); *p++ = '*'; break;
+    case R_PLUS: render(n->left, p, 2); *p++ = '+'; break;
+    case R_QUEST: render(n->left, p, 2); *p++ = '?'; break;
+  }
+  if (paren) *p++ = ')';
+  *p = 0;
+}
+
+// the text as characters, and the byte offset of every character
+static unsigned *chars;
+static int *offsets, nchars;
+static int r_limit, r_case;
+
+static void decode_text() {
+  chars = (unsigned *)realloc(chars, (ref_len + 1) * sizeof(unsigned));
+  offsets = (int *)realloc(offsets, (ref_len + 1) * sizeof(int));
+  nchars = 0;
+  for (int pos = 0; pos < ref_len; ) {
+    int l;
+    offsets[nchars] = pos;
+    chars[nchars++] = fl_utf8decode(ref + pos, ref + ref_len, &l);
+    pos += l;
+  }
+  offsets[nchars] = ref_len;
+}
+
+static int match_atom(const RNode *n, unsigned c) {
+  if (n->type == R_ANY) return c != '\n';
+  if (n->type == R_CHAR)
+    return c == n->c || (!r_case && fl_tolower(c) == fl_tolower(n->c));
+  int in = 0;
+  for (int i = 0; i < n->nranges; i++) {
+    unsigned l = fl_tolower(c), u = fl_toupper(c);
+    if ((c >= n->lo[i] && c <= n->hi[i]) ||
+        (!r_case && ((l >= n->lo[i] && l <= n->hi[i]) ||
+                     (u >= n->lo[i] && u <= n->hi[i]))))
+      in = 1;
+  }
+  return in != n->negate;
+}
+
+// what remains to be matched after a node
+struct Cont {
+  const RNode *n;
+  const Cont *next;
+};
+
+static int match_node(const RNode *n, int i, const Cont *k);
+
+static int match_cont(const Cont *k, int i) {
+  return k ? match_node(k->n, i, k->next) : i;
+}
+
+// returns the end of the first match in backtracking order, or -1
+static int match_node(const RNode *n, int i, const Cont *k) {
+  int r;
+  Cont c;
+  switch (n->type) {
+    case R_BOL:
+      return (i == 0 || chars[i - 1] == '\n') ? match_cont(k, i) : -1;
+    case R_EOL:
+      return (i == nchars || chars[i] == '\n') ? match_cont(k, i) : -1;
+    case R_CAT:
+      c.n = n->right; c.next = k;
+      return match_node(n->left, i, &c);
+    case R_ALT:
+      r = match_node(n->left, i, k);
+      return r >= 0 ? r : match_node(n->right, i, k);
+    case R_STAR:
+      c.n = n; c.next = k;
+      r = match_node(n->left, i, &c);
+      return r >= 0 ? r : match_cont(k, i);
+    case R_PLUS:
+      c.n = n->right; c.next = k;
+      return match_node(n->left, i, &c);
+    case R_QUEST:
+      r = match_node(n->left, i, k);
+      return r >= 0 ? r : match_cont(k, i);
+  }
+  if (i >= r_limit || !match_atom(n, chars[i])) return -1;
+  return match_cont(k, i + 1);
+}
+
+static int ref_regex(const RNode *re, int from, int to, int limit, int *s, int *e) {
+  r_limit = limit;
+  for (int i = from; i <= to; i++)
+    if ((*e = match_node(re, i, 0)) >= 0) {
+      *s = i;
+      return 1;
+    }
+  return 0;
+}
+
+static int ref_regex_backward(const RNode *re, int start, int *s, int *e) {
+  int lineStart = start;
+  while (lineStart > 0 && chars[lineStart - 1] != '\n') lineStart--;
+  for (;;) {
+    int pos = lineStart, ms, me, found = 0;
+    while (pos <= start && ref_regex(re, pos, start, nchars, &ms, &me)) {
+      *s = ms;
+      *e = me;
+      found = 1;
+      pos = me > ms ? me : ms + 1;
+      if (ms >= nchars) break;
+    }
+    if (found) return 1;
+    if (lineStart == 0) return 0;
+    start = lineStart - 1;
+    lineStart = start;
+    while (lineStart > 0 && chars[lineStart - 1] != '\n') lineStart--;
+  }
+}
+
+static void check_regex() {
+  char pattern[1024], *p = pattern;
+  nnodes = 0;
+  RNode *re = gen_alt(2, 0);
+  render(re, p, 0);
+  r_case = rnd(2);
+  Fl_Text_Search search(pattern, Fl_Text_Search::REGEX |
+                        (r_case ? Fl_Text_Search::MATCH_CASE : 0));
+  if (search.error()) {
+    fail("\"%s\": %s", pattern, search.error());
+    return;
+  }
+  decode_text();
+  int start = rnd(nchars + 1), a = rnd(nchars + 1), b = rnd(nchars + 1);
+  if (a > b) { int t = a; a = b; b = t; }
+  int fs = -1, fe = -1, bs = -1, be = -1, s, e;
+  if (ref_regex(re, start, nchars, nchars, &s, &e)) {
+    fs = offsets[s];
+    fe = offsets[e];
+  }
+  if (ref_regex_backward(re, start, &s, &e)) {
+    bs = offsets[s];
+    be = offsets[e];
+  }
+  MatchList want = { 0, 0, 0 }, got = { 0, 0, 0 };
+  for (int pos = a; pos <= b && ref_regex(re, pos, b, b, &s, &e); ) {
+    add_match(offsets[s], offsets[e] - offsets[s], &want);
+    if (e > s) pos = e;
+    else if (s < b) pos = s + 1;
+    else break;
+  }
+  for (int i = 0; i < NBUF; i++) {
+    if (!search.find_forward(bufs[i], offsets[start], &s, &e)) s = e = -1;
+    if (s != fs || e != fe)
+      fail("%s: find_forward(%d, \"%s\") found %d..%d instead of %d..%d",
+           names[i], offsets[start], pattern, s, e, fs, fe);
+    if (!search.find_backward(bufs[i], offsets[start], &s, &e)) s = e = -1;
+    if (s != bs || e != be)
+      fail("%s: find_backward(%d, \"%s\") found %d..%d instead of %d..%d",
+           names[i], offsets[start], pattern, s, e, bs, be);
+    got.n = 0;
+    search.find_all(bufs[i], offsets[a], offsets[b], add_match, &got);
+    check_matches(got, want, names[i], pattern);
+  }
+  free(want.pos);
+  free(got.pos);
+}
+
+//
+// Test driver
+//
+
+// Rounds alternate between small texts, which are searched with regular
+// expressions, and large ones, which use the line index.
+static void run_round(int big) {
+  bufs[0] = new Fl_Text_Buffer(Fl_Text_Buffer::GAP_BUFFER, 0, 16);
+  bufs[1] = new Fl_Text_Buffer(Fl_Text_Buffer::GAP_BUFFER, 0, 16);
+  bufs[2] = new Fl_Text_Buffer(Fl_Text_Buffer::PIECE_TABLE);
+  bufs[3] = new Fl_Text_Buffer(Fl_Text_Buffer::PIECE_TABLE);
+  bufs[1]->line_index(1);
+  bufs[3]->line_index(1);
+  for (int i = 0; i < NBUF; i++) bufs[i]->undo_limit(1 << 30);
+  have_undo = bufs[0]->undo_limit() != 0;
+  if (!ref) ref = (char *)malloc(ref_size = 256);
+  ref_len = 0;
+  ref[0] = 0;
+  for (step_no = 0; step_no < STEPS && failures <= MAX_FAILURES; step_no++) {
+    int r = rnd(20);
+    const char *what = "edit";
+    if (have_undo && r < 3 && undo_stack.n) {
+      undo_redo(0);
+      what = "undo";
+    } else if (have_undo && r < 5 && redo_stack.n) {
+      undo_redo(1);
+      what = "redo";
+    } else {
+      random_edits(big);
+    }
+    if (!check_text(what)) break;
+    if (have_undo) check_undo_state();
+    check_lines(big);
+    if (step_no % 4 == 0) check_search();
+    if (!big && step_no % 4 == 2) check_regex();
+  }
+  clear(undo_stack);
+  clear(redo_stack);
+  for (int i = 0; i < NBUF; i++) {
+    delete bufs[i];
+    bufs[i] = 0;
+  }
+}
+
+static void run(unsigned long s) {
+  seed = rng = s;
+  failures = 0;
+  for (round_no = 0; round_no < ROUNDS && failures <= MAX_FAILURES; round_no++)
+    run_round(round_no & 1);
+  char line[256];
+  snprintf(line, sizeof(line), "seed %lu: %d rounds of %d steps, %d failures%s",
+           seed, ROUNDS, STEPS, failures,
+           have_undo ? "" : " (undo not checked)");
+  puts(line);
+  if (results) results->add(line);
+}
+
+static void run_cb(Fl_Widget *, void *) {
+  results->clear();
+  fl_cursor(FL_CURSOR_WAIT);
+  Fl::check();
+  run(strtoul(seed_input->value(), 0, 10));
+  fl_cursor(FL_CURSOR_DEFAULT);
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && !strcmp(argv[1], "-batch")) {
+    run(argc > 2 ? strtoul(argv[2], 0, 10) : 1);
+    return failures != 0;
+  }
+  Fl_Double_Window *window = new Fl_Double_Window(560, 300, "Fl_Text_Buffer random test");
+  seed_input = new Fl_Int_Input(60, 10, 100, 25, "Seed:");
+  seed_input->value("1");
+  Fl_Button *b = new Fl_Button(450, 10, 100, 25, "Run");
+  b->callback(run_cb);
+  results = new Fl_Browser(10, 45, 540, 245);
+  window->resizable(results);
+  window->end();
+  window->show(argc, argv);
+  return Fl::run();
+}
+
+//
+// End of "$Id$".
+//
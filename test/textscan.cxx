@@ -0,0 +1,169 @@
+//
+// "$Id$"
+//
+// Fl_Text_Buffer scanning benchmark for the Fast Light Tool Kit (FLTK).
+//
+// Copyright 1998-2016 by Bill Spitzak and others.
+//
+// This library is free software. Distribution and use rights are outlined in
+// the file "COPYING" which should have been included with this file.  If this
+// file is missing or damaged, see the license at:
+//
+//     http://www.fltk.org/COPYING.php
+//
+// Please report all bugs and problems on the following page:
+//
+//     http://www.fltk.org/str.php
+//
+
+// Fills a text buffer with a few hundred megabytes of text and times the
+// line counting and character search functions of Fl_Text_Buffer against
+// the byte-at-a-time loops that were used before the vectorized scanning
+// kernels existed. The results are shown in the browser and also printed
+// to stdout.
+
+#include <FL/Fl.H>
+#include <FL/Fl_Double_Window.H>
+#include <FL/Fl_Browser.H>
+#include <FL/Fl_Button.H>
+#include <FL/Fl_Choice.H>
+#include <FL/Fl_Text_Buffer.H>
+#include <FL/fl_draw.H>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+Fl_Browser *results;
+Fl_Choice *size_choice;
+
+static const int sizes[] = { 16, 64, 256, 512 };
+
+//
+// The reference loops compare one byte per iteration, exactly like
+// Fl_Text_Buffer did on either side of its gap.
+//
+
+static int ref_count_lines(const char *buf, int start, int end) {
+  int n = 0;
+  for (int pos = start; pos < end; pos++)
+    if (buf[pos] == '\n') n++;
+  return n;
+}
+
+static int ref_skip_lines(const char *buf, int len, int start, int nLines) {
+  int n = 0;
+  for (int pos = start; pos < len; pos++)
+    if (buf[pos] == '\n' && ++n == nLines) return pos + 1;
+  return len;
+}
+
+static int ref_rewind_lines(const char *buf, int start, int nLines) {
+  int n = -1;
+  for (int pos = start - 1; pos >= 0; pos--)
+    if (buf[pos] == '\n' && ++n >= nLines) return pos + 1;
+  return 0;
+}
+
+static int ref_findchar(const char *buf, int len, char c) {
+  for (int pos = 0; pos < len; pos++)
+    if (buf[pos] == c) return pos;
+  return len;
+}
+
+static double now() {
+  return (double)clock() / CLOCKS_PER_SEC;
+}
+
+static void report(const char *what, double t_ref, double t_new, int mb) {
+  char line[256];
+  snprintf(line, sizeof(line), "%s\t%.1f ms\t%.1f ms\t%.0f MB/s\tx%.1f",
+           what, t_ref * 1000.0, t_new * 1000.0,
+           t_new > 0 ? mb / t_new : 0.0, t_new > 0 ? t_ref / t_new : 0.0);
+  results->add(line);
+  puts(line);
+  results->bottomline(results->size());
+  Fl::check();
+}
+
+static void run_cb(Fl_Widget *, void *) {
+  int mb = sizes[size_choice->value()];
+  int len = mb * 1024 * 1024;
+
+  fl_cursor(FL_CURSOR_WAIT);
+  results->clear();
+  results->add("@bOperation\t@bBefore\t@bNow\t@bThroughput\t@bSpeedup");
+  Fl::check();
+
+  // build text with lines of 20..120 characters
+  char *text = (char*)malloc(len + 1);
+  srand(1);
+  for (int i = 0; i < len; ) {
+    int n = 20 + rand() % 100;
+    if (i + n >= len) n = len - i - 1;
+    if (n > 0) memset(text + i, 'a' + rand() % 26, n);
+    i += n;
+    text[i++] = '\n';
+  }
+  text[len] = 0;
+
+  Fl_Text_Buffer *buf = new Fl_Text_Buffer();
+  buf->text(text);
+  // place the gap in the middle so that every scan crosses it
+  buf->insert(len / 2, "\n");
+  buf->remove(len / 2, len / 2 + 1);
+
+  double t0, t1, t2;
+  int total, r1, r2;
+
+  t0 = now(); r1 = ref_count_lines(text, 0, len);
+  t1 = now(); r2 = buf->count_lines(0, len);
+  t2 = now();
+  report(r1 == r2 ? "count_lines" : "count_lines (MISMATCH)", t1 - t0, t2 - t1, mb);
+  total = r2;
+
+  t0 = now(); r1 = ref_skip_lines(text, len, 0, total);
+  t1 = now(); r2 = buf->skip_lines(0, total);
+  t2 = now();
+  report(r1 == r2 ? "skip_lines" : "skip_lines (MISMATCH)", t1 - t0, t2 - t1, mb);
+
+  t0 = now(); r1 = ref_rewind_lines(text, len, total);
+  t1 = now(); r2 = buf->rewind_lines(len, total);
+  t2 = now();
+  report(r1 == r2 ? "rewind_lines" : "rewind_lines (MISMATCH)", t1 - t0, t2 - t1, mb);
+
+  t0 = now(); r1 = ref_findchar(text, len, '#');
+  t1 = now(); buf->findchar_forward(0, '#', &r2);
+  t2 = now();
+  report(r1 == r2 ? "findchar_forward" : "findchar_forward (MISMATCH)", t1 - t0, t2 - t1, mb);
+
+  t0 = now(); ref_findchar(text, len, '#');
+  t1 = now(); buf->findchar_backward(len, '#', &r2);
+  t2 = now();
+  report(r2 == 0 ? "findchar_backward" : "findchar_backward (MISMATCH)", t1 - t0, t2 - t1, mb);
+
+  delete buf;
+  free(text);
+  fl_cursor(FL_CURSOR_DEFAULT);
+}
+
+int main(int argc, char **argv) {
+  Fl_Double_Window *window = new Fl_Double_Window(560, 300, "Fl_Text_Buffer scanning benchmark");
+  size_choice = new Fl_Choice(110, 10, 100, 25, "Buffer size:");
+  size_choice->add("16 MB|64 MB|256 MB|512 MB");
+  size_choice->value(2);
+  Fl_Button *run = new Fl_Button(450, 10, 100, 25, "Run");
+  run->callback(run_cb);
+  results = new Fl_Browser(10, 45, 540, 245);
+  static int widths[] = { 160, 90, 90, 110, 0 };
+  results->column_widths(widths);
+  results->column_char('\t');
+  window->resizable(results);
+  window->end();
+  window->show(argc, argv);
+  return Fl::run();
+}
+
+//
+// End of "$Id$".
+//
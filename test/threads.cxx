@@ -26,7 +26,11 @@
 #  include <FL/fl_ask.H>
 #  include "threads.h"
 #  include <stdio.h>
+#  include <string.h>
 #  include <math.h>
+#  ifndef WIN32
+#    include <sys/time.h>
+#  endif
 
 Fl_Thread prime_thread;
 
@@ -109,8 +113,98 @@ extern "C" void* prime_func(void* p)
   return 0L;
 }
 
+// Thread pool benchmark: "threads -bench" counts the primes below
+// BENCH_BLOCKS * BENCH_SIZE, first in the main thread and then in tasks
+// posted with Fl::post_task(), and measures the cost of a task by
+// posting lots of empty ones. There is no window, so the benchmark
+// calls Fl::wait(double), as Fl::wait() would return right away.
+
+#  define BENCH_BLOCKS 2000
+#  define BENCH_SIZE   2000
+#  define BENCH_EMPTY  100000
+
+struct Bench_Block {
+  int start;
+  int count;
+};
+
+static Bench_Block bench_blocks[BENCH_BLOCKS];
+static int bench_left;
+static long bench_total;
+
+static double bench_time() {
+#  ifdef WIN32
+  return GetTickCount() / 1000.0;
+#  else
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+#  endif
+}
+
+static int count_primes(int start, int end) {
+  int count = 0;
+  for (int n = start < 2 ? 2 : start; n < end; n++) {
+    int hn = (int)sqrt((double)n), pp;
+    for (pp = 2; pp <= hn; pp++) if (n % pp == 0) break;
+    if (pp > hn) count++;
+  }
+  return count;
+}
+
+static void bench_task(void *p) {
+  Bench_Block *b = (Bench_Block *)p;
+  b->count = count_primes(b->start, b->start + BENCH_SIZE);
+}
+
+static void bench_done(void *p) {
+  bench_total += ((Bench_Block *)p)->count;
+  bench_left--;
+}
+
+static void empty_task(void *) {}
+
+static void empty_done(void *) {
+  bench_left--;
+}
+
+static int run_bench() {
+  Fl::lock();
+
+  double t = bench_time();
+  bench_total = 0;
+  for (int i = 0; i < BENCH_BLOCKS; i++) {
+    bench_blocks[i].start = i * BENCH_SIZE;
+    bench_task(bench_blocks + i);
+    bench_total += bench_blocks[i].count;
+  }
+  double serial = bench_time() - t;
+  printf("main thread: %ld primes in %.3f seconds\n", bench_total, serial);
+
+  t = bench_time();
+  bench_total = 0;
+  bench_left = BENCH_BLOCKS;
+  for (int i = 0; i < BENCH_BLOCKS; i++)
+    Fl::post_task(bench_task, bench_done, bench_blocks + i);
+  while (bench_left > 0) Fl::wait(1.0);
+  double pool = bench_time() - t;
+  printf("%d threads: %ld primes in %.3f seconds, %.1f times as fast\n",
+         Fl::task_threads(), bench_total, pool, pool > 0.0 ? serial / pool : 0.0);
+
+  t = bench_time();
+  bench_left = BENCH_EMPTY;
+  for (int i = 0; i < BENCH_EMPTY; i++)
+    Fl::post_task(empty_task, empty_done);
+  while (bench_left > 0) Fl::wait(1.0);
+  printf("%d empty tasks in %.3f seconds\n", BENCH_EMPTY, bench_time() - t);
+
+  return 0;
+}
+
 int main(int argc, char **argv)
 {
+  if (argc > 1 && !strcmp(argv[1], "-bench")) return run_bench();
+
   Fl_Double_Window* w = new Fl_Double_Window(200, 200, "Single Thread");
   browser1 = new Fl_Browser(0, 0, 200, 175);
   w->resizable(browser1);